@@ -0,0 +1,345 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Benchmark mode
+// Description: Scripted camera path, frame timing and JSON reporting used by --benchmark.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <fstream>          // ifstream, ofstream
+#include <sstream>          // istringstream
+#include <algorithm>        // sort
+#include <chrono>           // steady_clock
+#include <cmath>            // ceil
+#include <cstdio>           // snprintf
+
+#include "benchmark.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // Seconds on a monotonic clock
+    double Now()
+    {
+        return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Yaw/pitch (in the camera's degree convention) that look from a position towards a target
+    CameraKeyframe LookAt(const glm::vec3& position, const glm::vec3& target)
+    {
+        glm::vec3 direction = glm::normalize(target - position);
+        CameraKeyframe key;
+        key.position = position;
+        key.yaw = glm::degrees(atan2f(direction.z, direction.x));
+        key.pitch = glm::degrees(asinf(direction.y));
+        return key;
+    }
+
+    // Uniform Catmull-Rom interpolation
+    float CatmullRom(float p0, float p1, float p2, float p3, float t)
+    {
+        float t2 = t * t;
+        float t3 = t2 * t;
+        return 0.5f * ((2.0f * p1) + (-p0 + p2) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (-p0 + 3.0f * p1 - 3.0f * p2 + p3) * t3);
+    }
+
+    // The string as a quoted JSON string; the renderer name comes from the driver and may hold any character
+    string JsonString(const string& text)
+    {
+        string quoted = "\"";
+        for (char c : text)
+        {
+            const unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+                quoted += string("\\") + c;
+            else if (byte < 0x20)
+            {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", byte);
+                quoted += escape;
+            }
+            else
+                quoted += c;
+        }
+        return quoted + "\"";
+    }
+
+    void WriteStats(ofstream& file, const char* name, const FrameTimeStats& stats)
+    {
+        file << "      " << JsonString(name) << ": { \"min\": " << stats.min << ", \"mean\": " << stats.mean << ", \"p50\": " << stats.p50
+            << ", \"p95\": " << stats.p95 << ", \"p99\": " << stats.p99 << " }";
+    }
+}
+
+
+// Default path: a loop around the countertop, always facing the laptop and book
+//---------------------------------------------------------------------------------
+CameraPath CameraPath::Default()
+{
+    const glm::vec3 target(0.0f, -0.3f, -1.5f);
+
+    CameraPath path;
+    path.mKeyframes.push_back(LookAt(glm::vec3(0.0f, 0.0f, 5.0f), target));
+    path.mKeyframes.push_back(LookAt(glm::vec3(3.5f, 1.0f, 3.0f), target));
+    path.mKeyframes.push_back(LookAt(glm::vec3(4.5f, 2.5f, -1.5f), target));
+    path.mKeyframes.push_back(LookAt(glm::vec3(1.0f, 3.5f, -5.0f), target));
+    path.mKeyframes.push_back(LookAt(glm::vec3(-3.5f, 2.0f, -3.5f), target));
+    path.mKeyframes.push_back(LookAt(glm::vec3(-4.0f, 0.5f, 1.5f), target));
+
+    // Keep yaw continuous so the spline never spins the long way around
+    for (size_t i = 1; i < path.mKeyframes.size(); ++i)
+    {
+        while (path.mKeyframes[i].yaw - path.mKeyframes[i - 1].yaw > 180.0f)
+            path.mKeyframes[i].yaw -= 360.0f;
+        while (path.mKeyframes[i].yaw - path.mKeyframes[i - 1].yaw < -180.0f)
+            path.mKeyframes[i].yaw += 360.0f;
+    }
+    return path;
+}
+
+// Read "x y z yaw pitch" keyframes from a text file
+//---------------------------------------------------
+bool CameraPath::LoadFromFile(const char* filename)
+{
+    ifstream file(filename);
+    if (!file)
+    {
+        cout << "Failed to open camera path " << filename << endl;
+        return false;
+    }
+
+    vector<CameraKeyframe> keyframes;
+    string line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream stream(line);
+        CameraKeyframe key;
+        if (stream >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+            keyframes.push_back(key);
+    }
+
+    if (keyframes.size() < 2)
+    {
+        cout << "Camera path " << filename << " needs at least two keyframes" << endl;
+        return false;
+    }
+
+    mKeyframes = keyframes;
+    return true;
+}
+
+// Sample the closed spline at t in [0, 1)
+//-----------------------------------------
+CameraKeyframe CameraPath::Sample(float t) const
+{
+    const int count = static_cast<int>(mKeyframes.size());
+    float segment = t * count;
+    int i1 = static_cast<int>(segment) % count;
+    float local = segment - floorf(segment);
+
+    const CameraKeyframe& k0 = mKeyframes[(i1 + count - 1) % count];
+    const CameraKeyframe& k1 = mKeyframes[i1];
+    const CameraKeyframe& k2 = mKeyframes[(i1 + 1) % count];
+    const CameraKeyframe& k3 = mKeyframes[(i1 + 2) % count];
+
+    CameraKeyframe key;
+    for (int axis = 0; axis < 3; ++axis)
+        key.position[axis] = CatmullRom(k0.position[axis], k1.position[axis], k2.position[axis], k3.position[axis], local);
+    key.yaw = CatmullRom(k0.yaw, k1.yaw, k2.yaw, k3.yaw, local);
+    key.pitch = CatmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, local);
+    return key;
+}
+
+
+// Nearest-rank percentiles over a series of frame times
+//-------------------------------------------------------
+FrameTimeStats ComputeFrameTimeStats(vector<double> samples)
+{
+    FrameTimeStats stats;
+    if (samples.empty())
+        return stats;
+
+    sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample : samples)
+        sum += sample;
+
+    auto percentile = [&samples](double p) {
+        size_t rank = static_cast<size_t>(ceil(p * samples.size()));
+        return samples[rank > 0 ? rank - 1 : 0];
+    };
+
+    stats.min = samples.front();
+    stats.mean = sum / samples.size();
+    stats.p50 = percentile(0.50);
+    stats.p95 = percentile(0.95);
+    stats.p99 = percentile(0.99);
+    return stats;
+}
+
+
+Benchmark::Benchmark(const CameraPath& path, int warmupFrames, int measuredFrames)
+    : mPath(path), mWarmupFrames(warmupFrames), mMeasuredFrames(measuredFrames)
+{
+    glGenQueries(QUERY_COUNT, mQueries);
+    for (int i = 0; i < QUERY_COUNT; ++i)
+        mQueryFrame[i] = -1;
+}
+
+Benchmark::~Benchmark()
+{
+    glDeleteQueries(QUERY_COUNT, mQueries);
+}
+
+// Start a new run: outstanding GPU results still belong to the previous one
+//---------------------------------------------------------------------------
+void Benchmark::BeginRun(const string& name)
+{
+    if (!mRuns.empty())
+        CollectGpuTimes(true);
+
+    Run run;
+    run.name = name;
+    run.cpuMs.reserve(mMeasuredFrames);
+    run.gpuMs.reserve(mMeasuredFrames);
+    run.frameMs.reserve(mMeasuredFrames);
+    mRuns.push_back(run);
+    mFrame = 0;
+}
+
+// Place the camera at this frame's point on the path
+//----------------------------------------------------
+void Benchmark::ApplyCamera(Camera& camera) const
+{
+    float t = static_cast<float>(mFrame % mMeasuredFrames) / mMeasuredFrames;
+    CameraKeyframe key = mPath.Sample(t);
+    camera.SetPose(key.position, key.yaw, key.pitch);
+}
+
+void Benchmark::BeginFrame()
+{
+    // Reuse the oldest query; read its result first if it is still pending
+    int slot = mFrame % QUERY_COUNT;
+    if (mQueryFrame[slot] >= 0)
+        CollectGpuTimes(false);
+    if (mQueryFrame[slot] >= 0)
+        CollectGpuTimes(true);
+
+    mFrameStart = Now();
+    glBeginQuery(GL_TIME_ELAPSED, mQueries[slot]);
+    mQueryFrame[slot] = mFrame;
+}
+
+void Benchmark::EndSubmit()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    mSubmitEnd = Now();
+}
+
+void Benchmark::EndFrame()
+{
+    double frameEnd = Now();
+    if (mFrame >= mWarmupFrames)
+    {
+        Run& run = mRuns.back();
+        run.cpuMs.push_back((mSubmitEnd - mFrameStart) * 1000.0);
+        run.frameMs.push_back((frameEnd - mFrameStart) * 1000.0);
+    }
+    ++mFrame;
+    CollectGpuTimes(false);
+}
+
+// Read back finished GPU timer queries; with wait set, block until all of them are available
+//--------------------------------------------------------------------------------------------
+void Benchmark::CollectGpuTimes(bool wait)
+{
+    for (int i = 0; i < QUERY_COUNT; ++i)
+    {
+        if (mQueryFrame[i] < 0)
+            continue;
+
+        GLint available = GL_FALSE;
+        if (!wait)
+            glGetQueryObjectiv(mQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!wait && !available)
+            continue;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(mQueries[i], GL_QUERY_RESULT, &elapsed);
+        if (mQueryFrame[i] >= mWarmupFrames)
+            mRuns.back().gpuMs.push_back(elapsed / 1.0e6);
+        mQueryFrame[i] = -1;
+    }
+}
+
+// Record or overwrite a named counter on the current run
+//--------------------------------------------------------
+void Benchmark::SetCounter(const string& name, double value)
+{
+    for (auto& counter : mRuns.back().counters)
+    {
+        if (counter.first == name)
+        {
+            counter.second = value;
+            return;
+        }
+    }
+    mRuns.back().counters.push_back(make_pair(name, value));
+}
+
+// Write every run's statistics as JSON
+//--------------------------------------
+bool Benchmark::WriteReport(const char* filename, const string& renderer, int width, int height)
+{
+    CollectGpuTimes(true);
+
+    ofstream file(filename);
+    if (!file)
+    {
+        cout << "Failed to open " << filename << " for writing" << endl;
+        return false;
+    }
+
+    file << "{\n";
+    file << "  \"renderer\": " << JsonString(renderer) << ",\n";
+    file << "  \"resolution\": [" << width << ", " << height << "],\n";
+    file << "  \"warmup_frames\": " << mWarmupFrames << ",\n";
+    file << "  \"frames\": " << mMeasuredFrames << ",\n";
+    file << "  \"delta_time\": " << DELTA_TIME << ",\n";
+    file << "  \"camera_keyframes\": " << mPath.KeyframeCount() << ",\n";
+    file << "  \"runs\": [\n";
+
+    for (size_t i = 0; i < mRuns.size(); ++i)
+    {
+        const Run& run = mRuns[i];
+        FrameTimeStats cpu = ComputeFrameTimeStats(run.cpuMs);
+        FrameTimeStats gpu = ComputeFrameTimeStats(run.gpuMs);
+        FrameTimeStats frame = ComputeFrameTimeStats(run.frameMs);
+        double fps = frame.mean > 0.0 ? 1000.0 / frame.mean : 0.0;
+
+        file << "    {\n";
+        file << "      \"name\": " << JsonString(run.name) << ",\n";
+        WriteStats(file, "cpu_ms", cpu);
+        file << ",\n";
+        WriteStats(file, "gpu_ms", gpu);
+        file << ",\n";
+        WriteStats(file, "frame_ms", frame);
+        file << ",\n";
+        file << "      \"fps\": " << fps << ",\n";
+        file << "      \"counters\": {";
+        for (size_t c = 0; c < run.counters.size(); ++c)
+            file << (c == 0 ? " " : ", ") << JsonString(run.counters[c].first) << ": " << run.counters[c].second;
+        file << (run.counters.empty() ? "}" : " }") << "\n";
+        file << "    }" << (i + 1 < mRuns.size() ? "," : "") << "\n";
+
+        cout << "INFO: Benchmark run '" << run.name << "': " << fps << " fps, cpu mean " << cpu.mean << " ms, gpu mean "
+            << gpu.mean << " ms, frame p99 " << frame.p99 << " ms" << endl;
+    }
+
+    file << "  ]\n";
+    file << "}\n";
+
+    cout << "INFO: Benchmark report written to " << filename << endl;
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,110 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Deterministic benchmark mode: replays a spline camera path with a fixed time step and reports CPU and GPU frame time
+ * statistics as JSON.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "camera.h"
+
+// A point on the scripted camera path
+struct CameraKeyframe
+{
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+// Closed Catmull-Rom spline through camera keyframes
+class CameraPath
+{
+public:
+    // Built-in path that circles the desk while looking at it
+    static CameraPath Default();
+
+    // Reads keyframes from a text file with one "x y z yaw pitch" entry per line ('#' starts a comment)
+    bool LoadFromFile(const char* filename);
+
+    // Samples the path at t in [0, 1)
+    CameraKeyframe Sample(float t) const;
+
+    size_t KeyframeCount() const { return mKeyframes.size(); }
+
+private:
+    std::vector<CameraKeyframe> mKeyframes;
+};
+
+// min/mean/percentiles of one series of frame times, in milliseconds
+struct FrameTimeStats
+{
+    double min = 0.0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+};
+
+FrameTimeStats ComputeFrameTimeStats(std::vector<double> samples);
+
+// Drives the camera along the path for a fixed number of frames and records frame timings
+class Benchmark
+{
+public:
+    static constexpr float DELTA_TIME = 1.0f / 60.0f; // fixed simulation step used instead of wall-clock time
+
+    Benchmark(const CameraPath& path, int warmupFrames, int measuredFrames);
+    ~Benchmark();
+
+    // Starts a named measurement run; the camera path restarts from the beginning
+    void BeginRun(const std::string& name);
+
+    bool RunFinished() const { return mFrame >= mWarmupFrames + mMeasuredFrames; }
+
+    // Places the camera on the path for the current frame
+    void ApplyCamera(Camera& camera) const;
+
+    // Frame brackets: BeginFrame before rendering, EndSubmit once all GL commands of the frame are issued,
+    // EndFrame after the frame was presented
+    void BeginFrame();
+    void EndSubmit();
+    void EndFrame();
+
+    // Attaches an extra per-run value (draw counts, culling statistics, ...) to the report
+    void SetCounter(const std::string& name, double value);
+
+    bool WriteReport(const char* filename, const std::string& renderer, int width, int height);
+
+private:
+    struct Run
+    {
+        std::string name;
+        std::vector<double> cpuMs;    // time spent issuing the frame's GL commands
+        std::vector<double> gpuMs;    // GPU time measured with GL_TIME_ELAPSED queries
+        std::vector<double> frameMs;  // wall time of the whole frame including present
+        std::vector<std::pair<std::string, double>> counters;
+    };
+
+    static const int QUERY_COUNT = 4; // queries in flight before a result is read back
+
+    void CollectGpuTimes(bool wait);
+
+    CameraPath mPath;
+    int mWarmupFrames;
+    int mMeasuredFrames;
+    int mFrame = 0;
+
+    std::vector<Run> mRuns;
+    GLuint mQueries[QUERY_COUNT] = {};
+    int mQueryFrame[QUERY_COUNT];     // frame each query was issued for, -1 when idle
+    double mFrameStart = 0.0;
+    double mSubmitEnd = 0.0;
+};
+
+#endif
@@ -0,0 +1,496 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Block compression
+// Description: BC1, BC3 and BC7 (mode 6) block encoders for the texture bake, spread over the thread pool.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // min, max, swap
+#include <cmath>            // fabs, sqrt
+#include <cstdint>          // uint16_t, uint64_t
+#include <cstring>          // memcpy
+
+#include "block_compression.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_SSE2 1
+#include <emmintrin.h>      // SSE2 intrinsics
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // The 16 texels of a block as float channels, so four texels fill an SSE register
+    struct Block
+    {
+        alignas(16) float channel[4][16]; // r, g, b, a
+    };
+
+    // BC7 4-bit index weights, in 64ths of the way from endpoint 0 to endpoint 1
+    const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // Gather a block, clamping to the last row and column at the right and top edges
+    void LoadBlock(const unsigned char* rgba, int width, int height, int blockX, int blockY, Block& block)
+    {
+        for (int y = 0; y < 4; ++y)
+        {
+            const int row = min(blockY * 4 + y, height - 1);
+            for (int x = 0; x < 4; ++x)
+            {
+                const unsigned char* texel = rgba + (static_cast<size_t>(row) * width + min(blockX * 4 + x, width - 1)) * 4;
+                for (int c = 0; c < 4; ++c)
+                    block.channel[c][y * 4 + x] = texel[c];
+            }
+        }
+    }
+
+    // t[i] = dot(texel i - origin, axis) over the first channels channels
+    void ProjectTexels(const Block& block, int channels, const float origin[4], const float axis[4], float t[16])
+    {
+#if defined(BLOCK_SSE2)
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int c = 0; c < channels; ++c)
+            {
+                const __m128 offset = _mm_sub_ps(_mm_load_ps(&block.channel[c][i]), _mm_set1_ps(origin[c]));
+                sum = _mm_add_ps(sum, _mm_mul_ps(offset, _mm_set1_ps(axis[c])));
+            }
+            _mm_storeu_ps(&t[i], sum);
+        }
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            t[i] = 0.0f;
+            for (int c = 0; c < channels; ++c)
+                t[i] += (block.channel[c][i] - origin[c]) * axis[c];
+        }
+#endif
+    }
+
+    // Index of the nearest of the four RGB palette entries for every texel; returns the summed squared error
+    float NearestColors(const Block& block, const float palette[4][3], int indices[16])
+    {
+        float error = 0.0f;
+#if defined(BLOCK_SSE2)
+        for (int i = 0; i < 16; i += 4)
+        {
+            const __m128 r = _mm_load_ps(&block.channel[0][i]);
+            const __m128 g = _mm_load_ps(&block.channel[1][i]);
+            const __m128 b = _mm_load_ps(&block.channel[2][i]);
+            __m128 best = _mm_set1_ps(1e30f);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < 4; ++p)
+            {
+                const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+                const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+                const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+                const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32(p)));
+                best = _mm_min_ps(distance, best);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(&indices[i]), bestIndex);
+
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, best);
+            error += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+#else
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = 1e30f;
+            for (int p = 0; p < 4; ++p)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const float d = block.channel[c][i] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = p;
+                }
+            }
+            error += best;
+        }
+#endif
+        return error;
+    }
+
+    // Endpoints along the principal axis of the texels, found by power iteration on their covariance
+    void PrincipalEndpoints(const Block& block, int channels, float e0[4], float e1[4])
+    {
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int i = 0; i < 16; ++i)
+                mean[c] += block.channel[c][i];
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int j = 0; j < channels; ++j)
+            {
+                for (int k = j; k < channels; ++k)
+                    covariance[j][k] += (block.channel[j][i] - mean[j]) * (block.channel[k][i] - mean[k]);
+            }
+        }
+        for (int j = 0; j < channels; ++j)
+        {
+            for (int k = 0; k < j; ++k)
+                covariance[j][k] = covariance[k][j];
+        }
+
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float length = 0.0f;
+            for (int j = 0; j < channels; ++j)
+            {
+                for (int k = 0; k < channels; ++k)
+                    next[j] += covariance[j][k] * axis[k];
+                length += next[j] * next[j];
+            }
+            if (length < 1e-12f)
+                break; // a flat block: every axis is as good as any other
+            length = 1.0f / sqrt(length);
+            for (int j = 0; j < channels; ++j)
+                axis[j] = next[j] * length;
+        }
+
+        float t[16];
+        ProjectTexels(block, channels, mean, axis, t);
+        const float low = *min_element(t, t + 16);
+        const float high = *max_element(t, t + 16);
+        for (int c = 0; c < channels; ++c)
+        {
+            e0[c] = min(max(mean[c] + axis[c] * low, 0.0f), 255.0f);
+            e1[c] = min(max(mean[c] + axis[c] * high, 0.0f), 255.0f);
+        }
+    }
+
+    // Least-squares endpoints for fixed interpolation weights (fraction of the way to e1 of each texel); false when
+    // the weights cannot separate the endpoints
+    bool RefitEndpoints(const Block& block, int channels, const float weights[16], float e0[4], float e1[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            const float a = 1.0f - weights[i], b = weights[i];
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < channels; ++c)
+            {
+                ax[c] += a * block.channel[c][i];
+                bx[c] += b * block.channel[c][i];
+            }
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (fabs(determinant) < 1e-6f)
+            return false;
+        for (int c = 0; c < channels; ++c)
+        {
+            e0[c] = min(max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+            e1[c] = min(max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    uint16_t To565(const float color[3])
+    {
+        const int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+        const int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+        const int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    void From565(uint16_t packed, float color[3])
+    {
+        const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = static_cast<float>((r << 3) | (r >> 2));
+        color[1] = static_cast<float>((g << 2) | (g >> 4));
+        color[2] = static_cast<float>((b << 3) | (b >> 2));
+    }
+
+    // Quantize the endpoints, order them for four-color mode and pick every texel's index; returns the squared error
+    float QuantizeBC1(const Block& block, const float e0[4], const float e1[4], uint16_t& c0, uint16_t& c1, int indices[16])
+    {
+        c0 = To565(e0);
+        c1 = To565(e1);
+        if (c0 < c1)
+            swap(c0, c1); // c0 > c1 selects the four-color palette; equal endpoints leave every texel on index 0
+
+        float palette[4][3];
+        From565(c0, palette[0]);
+        From565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        return NearestColors(block, palette, indices);
+    }
+
+    void EncodeBC1(const Block& block, unsigned char* out)
+    {
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 3, e0, e1);
+
+        uint16_t c0, c1;
+        int indices[16];
+        float error = QuantizeBC1(block, e0, e1, c0, c1, indices);
+
+        // One least-squares pass on the chosen indices usually pulls the endpoints closer to the texels
+        const float indexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = indexWeights[indices[i]];
+        float r0[4], r1[4];
+        From565(c0, r0);
+        From565(c1, r1);
+        if (c0 != c1 && RefitEndpoints(block, 3, weights, r0, r1))
+        {
+            uint16_t refit0, refit1;
+            int refitIndices[16];
+            const float refitError = QuantizeBC1(block, r0, r1, refit0, refit1, refitIndices);
+            if (refitError < error)
+            {
+                c0 = refit0;
+                c1 = refit1;
+                memcpy(indices, refitIndices, sizeof(indices));
+            }
+        }
+
+        uint32_t bits = 0;
+        if (c0 != c1)
+        {
+            for (int i = 0; i < 16; ++i)
+                bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+        }
+        out[0] = static_cast<unsigned char>(c0);
+        out[1] = static_cast<unsigned char>(c0 >> 8);
+        out[2] = static_cast<unsigned char>(c1);
+        out[3] = static_cast<unsigned char>(c1 >> 8);
+        for (int i = 0; i < 4; ++i)
+            out[4 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    // BC3's alpha block: the extremes as endpoints with the six interpolated values between them
+    void EncodeAlpha(const Block& block, unsigned char* out)
+    {
+        const float* alpha = block.channel[3];
+        const int high = static_cast<int>(*max_element(alpha, alpha + 16));
+        const int low = static_cast<int>(*min_element(alpha, alpha + 16));
+        uint64_t bits = 0;
+        if (high != low)
+        {
+            const float scale = 7.0f / (high - low);
+            for (int i = 0; i < 16; ++i)
+            {
+                // Step s of 7 from the high end; the interpolated values use indices 2-7 in that order
+                const int step = static_cast<int>((high - alpha[i]) * scale + 0.5f);
+                const int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+                bits |= static_cast<uint64_t>(index) << (3 * i);
+            }
+        }
+        out[0] = static_cast<unsigned char>(high);
+        out[1] = static_cast<unsigned char>(low);
+        for (int i = 0; i < 6; ++i)
+            out[2 + i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+
+    // Mode 6 endpoint: 7 bits per channel and a bit shared by the channels, chosen to minimize the rounding error
+    void QuantizeBC7Endpoint(const float endpoint[4], int quantized[4], int& pBit, float reconstructed[4])
+    {
+        float bestError = 1e30f;
+        for (int p = 0; p < 2; ++p)
+        {
+            int q[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c)
+            {
+                q[c] = min(max(static_cast<int>((endpoint[c] - p) / 2.0f + 0.5f), 0), 127);
+                const float d = static_cast<float>((q[c] << 1) | p) - endpoint[c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pBit = p;
+                for (int c = 0; c < 4; ++c)
+                {
+                    quantized[c] = q[c];
+                    reconstructed[c] = static_cast<float>((q[c] << 1) | p);
+                }
+            }
+        }
+    }
+
+    struct BC7Candidate
+    {
+        int quantized[2][4];
+        int pBits[2];
+        int indices[16];
+        float error;
+    };
+
+    void EvaluateBC7(const Block& block, const float e0[4], const float e1[4], BC7Candidate& candidate)
+    {
+        float r0[4], r1[4];
+        QuantizeBC7Endpoint(e0, candidate.quantized[0], candidate.pBits[0], r0);
+        QuantizeBC7Endpoint(e1, candidate.quantized[1], candidate.pBits[1], r1);
+
+        float axis[4];
+        float length = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            axis[c] = r1[c] - r0[c];
+            length += axis[c] * axis[c];
+        }
+        float t[16] = {};
+        if (length > 0.0f)
+        {
+            for (int c = 0; c < 4; ++c)
+                axis[c] /= length;
+            ProjectTexels(block, 4, r0, axis, t);
+        }
+
+        // The projection lands next to the right weight; the uneven weight steps are settled by trying the neighbors
+        candidate.error = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            const float weight = t[i] * 64.0f;
+            int index = min(max(static_cast<int>(t[i] * 15.0f + 0.5f), 0), 15);
+            if (index > 0 && fabs(BC7_WEIGHTS[index - 1] - weight) < fabs(BC7_WEIGHTS[index] - weight))
+                --index;
+            else if (index < 15 && fabs(BC7_WEIGHTS[index + 1] - weight) < fabs(BC7_WEIGHTS[index] - weight))
+                ++index;
+            candidate.indices[i] = index;
+
+            for (int c = 0; c < 4; ++c)
+            {
+                const int value = ((64 - BC7_WEIGHTS[index]) * static_cast<int>(r0[c]) + BC7_WEIGHTS[index] * static_cast<int>(r1[c]) + 32) >> 6;
+                const float d = value - block.channel[c][i];
+                candidate.error += d * d;
+            }
+        }
+    }
+
+    // Little-endian bit stream filling one 128-bit block
+    struct BitWriter
+    {
+        uint64_t words[2] = { 0, 0 };
+        int position = 0;
+
+        void Write(uint32_t value, int bits)
+        {
+            for (int i = 0; i < bits; ++i, ++position)
+                words[position >> 6] |= static_cast<uint64_t>((value >> i) & 1) << (position & 63);
+        }
+    };
+
+    void EncodeBC7(const Block& block, unsigned char* out)
+    {
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 4, e0, e1);
+
+        BC7Candidate best;
+        EvaluateBC7(block, e0, e1, best);
+
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = BC7_WEIGHTS[best.indices[i]] / 64.0f;
+        if (RefitEndpoints(block, 4, weights, e0, e1))
+        {
+            BC7Candidate refit;
+            EvaluateBC7(block, e0, e1, refit);
+            if (refit.error < best.error)
+                best = refit;
+        }
+
+        // The first texel's index is stored without its top bit, so it must be below 8: mirror the block when it is not
+        if (best.indices[0] >= 8)
+        {
+            swap(best.quantized[0], best.quantized[1]);
+            swap(best.pBits[0], best.pBits[1]);
+            for (int& index : best.indices)
+                index = 15 - index;
+        }
+
+        BitWriter writer;
+        writer.Write(1u << 6, 7); // mode 6
+        for (int c = 0; c < 4; ++c)
+        {
+            writer.Write(best.quantized[0][c], 7);
+            writer.Write(best.quantized[1][c], 7);
+        }
+        writer.Write(best.pBits[0], 1);
+        writer.Write(best.pBits[1], 1);
+        writer.Write(best.indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            writer.Write(best.indices[i], 4);
+
+        for (int i = 0; i < 16; ++i)
+            out[i] = static_cast<unsigned char>(writer.words[i >> 3] >> (8 * (i & 7)));
+    }
+}
+
+
+size_t BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+const char* BlockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    default: return "BC7";
+    }
+}
+
+size_t CompressedSize(BlockFormat format, int width, int height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+// Each job encodes one row of blocks; rows write disjoint parts of out
+//----------------------------------------------------------------------
+void CompressImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, ThreadPool& pool)
+{
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    const size_t blockBytes = BlockBytes(format);
+
+    pool.ParallelFor(blocksY, [=](size_t blockY) {
+        Block block;
+        unsigned char* row = out + blockY * blocksX * blockBytes;
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            LoadBlock(rgba, width, height, blockX, static_cast<int>(blockY), block);
+            unsigned char* encoded = row + blockX * blockBytes;
+            switch (format)
+            {
+            case BlockFormat::BC1:
+                EncodeBC1(block, encoded);
+                break;
+            case BlockFormat::BC3:
+                EncodeAlpha(block, encoded);
+                EncodeBC1(block, encoded + 8);
+                break;
+            case BlockFormat::BC7:
+                EncodeBC7(block, encoded);
+                break;
+            }
+        }
+    });
+}
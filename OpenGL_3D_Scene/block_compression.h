@@ -0,0 +1,32 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Block compression: encoders for the BC formats the baked textures are stored in. Every 4x4 texel block is encoded on its
+ * own, so rows of blocks are spread over the thread pool, and the per-texel work of a block (projecting texels onto the
+ * endpoint axis and picking the nearest palette entry) runs four texels at a time with SSE2.
+ *   BC1: 8 bytes per block, RGB with two 5:6:5 endpoints and 2-bit indices (8:1 against RGBA8)
+ *   BC3: 16 bytes per block, a BC1 color block after an 8-bit alpha block with 3-bit indices
+ *   BC7: 16 bytes per block, encoded in mode 6 only: RGBA endpoints of 7 bits plus a shared bit and 4-bit indices
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cstddef>
+
+#include "thread_pool.h"
+
+enum class BlockFormat
+{
+    BC1,
+    BC3,
+    BC7
+};
+
+size_t BlockBytes(BlockFormat format);
+const char* BlockFormatName(BlockFormat format);
+
+// Bytes of a width x height image in the format; partial blocks at the edges count as whole ones
+size_t CompressedSize(BlockFormat format, int width, int height);
+
+// Encodes RGBA8 texels row by row into out, which must hold CompressedSize bytes. Edge blocks repeat the last texel.
+void CompressImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,280 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Clustered lighting
+// Description: Cluster grid construction and the per-frame assignment of point lights to clusters.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // min, max
+#include <cmath>            // log, pow
+
+#include "clustered_lighting.h"
+#include "shader.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const GLuint ASSIGN_GROUP_SIZE = 64; // local_size_x of light_assign_shader.cs
+
+    // Whether a sphere reaches a box: the squared distance from the center to the box is within the squared radius
+    bool SphereTouchesBox(const glm::vec4& sphere, const glm::vec4& lower, const glm::vec4& upper)
+    {
+        float distance = 0.0f;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float below = lower[axis] - sphere[axis];
+            const float above = sphere[axis] - upper[axis];
+            const float outside = max(0.0f, max(below, above));
+            distance += outside * outside;
+        }
+        return distance <= sphere.w * sphere.w;
+    }
+
+    int ClusterIndex(int x, int y, int z)
+    {
+        return x + ClusteredLighting::GRID_X * (y + ClusteredLighting::GRID_Y * z);
+    }
+}
+
+
+ClusteredLighting::ClusteredLighting(ThreadPool& pool)
+    : mPool(pool), mClusterBounds(CLUSTER_COUNT), mSliceIndices(GRID_Z), mSliceCandidates(GRID_Z), mSliceDropped(GRID_Z),
+    mClusterRanges(CLUSTER_COUNT)
+{
+}
+
+bool ClusteredLighting::Create(bool gpuAssignment)
+{
+    if (gpuAssignment)
+    {
+        Shader assignShader("shaderFiles/light_assign_shader.cs");
+        GLint linked = GL_FALSE;
+        glGetProgramiv(assignShader.ID, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            cout << "Light assignment program failed to build" << endl;
+            glDeleteProgram(assignShader.ID);
+            return false;
+        }
+        mAssignProgram = assignShader.ID;
+    }
+
+    mClusterBuffer.create(CLUSTER_BLOCK_BINDING);
+    glGenBuffers(1, &mLightBuffer);
+    glGenBuffers(1, &mClusterRangeBuffer);
+    glGenBuffers(1, &mLightIndexBuffer);
+    glGenBuffers(1, &mClusterBoundsBuffer);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterRangeBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * sizeof(ClusterRange), nullptr, GL_STREAM_DRAW);
+    if (mAssignProgram)
+    {
+        // The compute pass gives every cluster a fixed slot of MAX_LIGHTS_PER_CLUSTER indices
+        mLightIndexCapacity = CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(uint32_t);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mLightIndexBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, mLightIndexCapacity, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterBoundsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNT * sizeof(ClusterBounds), nullptr, GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    cout << "INFO: Clustered lighting " << GRID_X << "x" << GRID_Y << "x" << GRID_Z << " clusters, lights assigned on the "
+        << (mAssignProgram ? "GPU" : "CPU") << endl;
+    return true;
+}
+
+void ClusteredLighting::Destroy()
+{
+    glDeleteProgram(mAssignProgram);
+    mClusterBuffer.destroy();
+    glDeleteBuffers(1, &mLightBuffer);
+    glDeleteBuffers(1, &mClusterRangeBuffer);
+    glDeleteBuffers(1, &mLightIndexBuffer);
+    glDeleteBuffers(1, &mClusterBoundsBuffer);
+    mAssignProgram = mLightBuffer = mClusterRangeBuffer = mLightIndexBuffer = mClusterBoundsBuffer = 0;
+    mLightCapacity = mLightIndexCapacity = 0;
+    mWidth = mHeight = 0;
+}
+
+// View-space boxes of the clusters: each tile's corner rays, cut at the depths bounding each slice
+//-------------------------------------------------------------------------------------------------
+void ClusteredLighting::BuildClusters(const glm::mat4& projection, int width, int height)
+{
+    mProjection = projection;
+    mWidth = width;
+    mHeight = height;
+
+    // Unprojecting through the inverse handles perspective and orthographic projections alike
+    const glm::mat4 inverse = glm::inverse(projection);
+    auto unproject = [&inverse](float x, float y, float z) {
+        const glm::vec4 point = inverse * glm::vec4(x, y, z, 1.0f);
+        return glm::vec3(point) / point.w;
+    };
+
+    const float nearDepth = -unproject(0.0f, 0.0f, -1.0f).z;
+    const float farDepth = -unproject(0.0f, 0.0f, 1.0f).z;
+    const float logRange = log(farDepth / nearDepth);
+    for (int z = 0; z <= GRID_Z; ++z)
+        mSliceDepths[z] = nearDepth * pow(farDepth / nearDepth, static_cast<float>(z) / GRID_Z);
+
+    mBlock.params = glm::vec4(static_cast<float>(width) / GRID_X, static_cast<float>(height) / GRID_Y,
+        GRID_Z / logRange, -GRID_Z * log(nearDepth) / logRange);
+
+    for (int y = 0; y < GRID_Y; ++y)
+    {
+        for (int x = 0; x < GRID_X; ++x)
+        {
+            // The tile's four corner rays, from the near to the far plane
+            glm::vec3 nearCorners[4], farCorners[4];
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                const float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / GRID_X;
+                const float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / GRID_Y;
+                nearCorners[corner] = unproject(ndcX, ndcY, -1.0f);
+                farCorners[corner] = unproject(ndcX, ndcY, 1.0f);
+            }
+
+            for (int z = 0; z < GRID_Z; ++z)
+            {
+                glm::vec3 lower(1e30f), upper(-1e30f);
+                for (int bound = 0; bound < 2; ++bound)
+                {
+                    const float depth = mSliceDepths[z + bound];
+                    for (int corner = 0; corner < 4; ++corner)
+                    {
+                        const glm::vec3 ray = farCorners[corner] - nearCorners[corner];
+                        const float t = (-depth - nearCorners[corner].z) / ray.z;
+                        const glm::vec3 point = nearCorners[corner] + ray * t;
+                        lower = glm::min(lower, point);
+                        upper = glm::max(upper, point);
+                    }
+                }
+                ClusterBounds& bounds = mClusterBounds[ClusterIndex(x, y, z)];
+                bounds.lower = glm::vec4(lower, 0.0f);
+                bounds.upper = glm::vec4(upper, 0.0f);
+            }
+        }
+    }
+
+    if (mAssignProgram)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterBoundsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mClusterBounds.size() * sizeof(ClusterBounds), mClusterBounds.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+// The lists of one depth slice. Only the slice's own clusters and lists are written, so slices run in parallel.
+//---------------------------------------------------------------------------------------------------------------
+void ClusteredLighting::AssignSlice(int slice)
+{
+    // Lights reaching the slice's depth range at all
+    vector<uint32_t>& candidates = mSliceCandidates[slice];
+    candidates.clear();
+    const float nearDepth = mSliceDepths[slice];
+    const float farDepth = mSliceDepths[slice + 1];
+    for (size_t i = 0; i < mViewLights.size(); ++i)
+    {
+        const float depth = -mViewLights[i].z;
+        if (depth + mViewLights[i].w >= nearDepth && depth - mViewLights[i].w <= farDepth)
+            candidates.push_back(static_cast<uint32_t>(i));
+    }
+
+    vector<uint32_t>& indices = mSliceIndices[slice];
+    indices.clear();
+    mSliceDropped[slice] = 0;
+    for (int y = 0; y < GRID_Y; ++y)
+    {
+        for (int x = 0; x < GRID_X; ++x)
+        {
+            const int cluster = ClusterIndex(x, y, slice);
+            const ClusterBounds& bounds = mClusterBounds[cluster];
+            ClusterRange& range = mClusterRanges[cluster];
+            range.offset = static_cast<uint32_t>(indices.size()); // relative to the slice until Update joins the slices
+            range.count = 0;
+            for (uint32_t light : candidates)
+            {
+                if (!SphereTouchesBox(mViewLights[light], bounds.lower, bounds.upper))
+                    continue;
+                if (range.count == MAX_LIGHTS_PER_CLUSTER)
+                {
+                    ++mSliceDropped[slice];
+                    continue;
+                }
+                indices.push_back(light);
+                ++range.count;
+            }
+        }
+    }
+}
+
+// Upload into a buffer that only grows
+//--------------------------------------
+void ClusteredLighting::Upload(GLuint buffer, size_t& capacity, const void* data, size_t size)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    if (size > capacity)
+    {
+        capacity = max(size, capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    }
+    if (size > 0)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ClusteredLighting::Update(GLStateCache& state, const vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] != mWidth || viewport[3] != mHeight || projection != mProjection)
+        BuildClusters(projection, viewport[2], viewport[3]);
+
+    mBlock.grid = glm::uvec4(GRID_X, GRID_Y, GRID_Z, static_cast<GLuint>(lights.size()));
+    mClusterBuffer.update(mBlock);
+    Upload(mLightBuffer, mLightCapacity, lights.data(), lights.size() * sizeof(PointLight));
+
+    if (mAssignProgram)
+    {
+        // One invocation per cluster; the lighting shader reads the lists once the pass has written them
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, mLightBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, mClusterRangeBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_BINDING, mLightIndexBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BOUNDS_BINDING, mClusterBoundsBuffer);
+        state.UseProgram(mAssignProgram);
+        glDispatchCompute((CLUSTER_COUNT + ASSIGN_GROUP_SIZE - 1) / ASSIGN_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        return;
+    }
+
+    mViewLights.resize(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i)
+        mViewLights[i] = glm::vec4(glm::vec3(view * glm::vec4(glm::vec3(lights[i].positionRadius), 1.0f)), lights[i].positionRadius.w);
+
+    mPool.ParallelFor(GRID_Z, [this](size_t slice) { AssignSlice(static_cast<int>(slice)); });
+
+    // Join the slices' lists into one and make the ranges absolute
+    mLightIndices.clear();
+    mMaxClusterLights = 0;
+    mDropped = 0;
+    for (int z = 0; z < GRID_Z; ++z)
+    {
+        const uint32_t base = static_cast<uint32_t>(mLightIndices.size());
+        mLightIndices.insert(mLightIndices.end(), mSliceIndices[z].begin(), mSliceIndices[z].end());
+        mDropped += mSliceDropped[z];
+        for (int cluster = ClusterIndex(0, 0, z); cluster < ClusterIndex(0, 0, z + 1); ++cluster)
+        {
+            mClusterRanges[cluster].offset += base;
+            mMaxClusterLights = max(mMaxClusterLights, mClusterRanges[cluster].count);
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mClusterRangeBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mClusterRanges.size() * sizeof(ClusterRange), mClusterRanges.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    Upload(mLightIndexBuffer, mLightIndexCapacity, mLightIndices.data(), mLightIndices.size() * sizeof(uint32_t));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BINDING, mLightBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, mClusterRangeBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_BINDING, mLightIndexBuffer);
+}
@@ -0,0 +1,114 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Clustered forward lighting: the view frustum is split into a grid of screen tiles and logarithmic depth slices, and each
+ * cluster gets the list of point lights whose spheres reach it. The lists are built every frame, on the CPU with one
+ * thread pool job per depth slice or on the GPU with a compute pass, and the lighting shader only walks the list of the
+ * cluster its fragment falls in, so the cost per pixel follows the lights nearby rather than the lights in the scene.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "gl_state_cache.h"
+#include "thread_pool.h"
+#include "uniform_buffer.h"
+
+// Point light; mirrors the std430 PointLight struct of the shaders
+struct PointLight
+{
+    glm::vec4 positionRadius;   // xyz: world-space position, w: distance at which the light fades out completely
+    glm::vec4 color;            // rgb: color scaled by intensity
+};
+
+class ClusteredLighting
+{
+public:
+    static const int GRID_X = 16;   // screen tiles across
+    static const int GRID_Y = 12;   // screen tiles down; 16x12 keeps the tiles square in the 4:3 window
+    static const int GRID_Z = 24;   // depth slices, spaced logarithmically between the near and far planes
+    static const int CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+    static const uint32_t MAX_LIGHTS_PER_CLUSTER = 64; // bounds the shading cost of a fragment
+
+    static const GLuint CLUSTER_BLOCK_BINDING = 1;  // uniform block with the grid parameters
+    static const GLuint LIGHT_BINDING = 7;          // shader storage bindings of the lights,
+    static const GLuint CLUSTER_BINDING = 8;        // each cluster's range of the index list,
+    static const GLuint LIGHT_INDEX_BINDING = 9;    // the index list itself
+    static const GLuint CLUSTER_BOUNDS_BINDING = 10; // and the clusters' view-space boxes (GPU assignment only)
+
+    explicit ClusteredLighting(ThreadPool& pool);
+
+    // With gpuAssignment the lists are built by a compute pass; returns false when its program fails to build
+    bool Create(bool gpuAssignment);
+    void Destroy();
+
+    // Assigns this frame's lights to the clusters of the view and uploads everything the lighting shader reads.
+    // The camera uniform block must already hold view for the GPU assignment.
+    void Update(GLStateCache& state, const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+
+    bool GpuAssignment() const { return mAssignProgram != 0; }
+
+    // Statistics of the last CPU assignment
+    size_t AssignedCount() const { return mLightIndices.size(); }   // entries in all cluster lists
+    uint32_t MaxClusterLights() const { return mMaxClusterLights; }
+    size_t DroppedCount() const { return mDropped; }                // assignments cut by MAX_LIGHTS_PER_CLUSTER
+
+private:
+    // std140 block read by the lighting and assignment shaders
+    struct ClusterBlock
+    {
+        glm::uvec4 grid;    // xyz: cluster counts, w: number of lights
+        glm::vec4 params;   // xy: pixels per tile, z and w: scale and bias mapping log(view depth) to a slice
+    };
+
+    // Offset and length of one cluster's part of the index list
+    struct ClusterRange
+    {
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    // View-space box of one cluster, padded for std430
+    struct ClusterBounds
+    {
+        glm::vec4 lower;
+        glm::vec4 upper;
+    };
+
+    void BuildClusters(const glm::mat4& projection, int width, int height);
+    void AssignSlice(int slice);
+    void Upload(GLuint buffer, size_t& capacity, const void* data, size_t size);
+
+    ThreadPool& mPool;
+    UniformBuffer<ClusterBlock> mClusterBuffer;
+    ClusterBlock mBlock;
+    GLuint mAssignProgram = 0;
+    GLuint mLightBuffer = 0;
+    GLuint mClusterRangeBuffer = 0;
+    GLuint mLightIndexBuffer = 0;
+    GLuint mClusterBoundsBuffer = 0;
+    size_t mLightCapacity = 0;      // bytes allocated for each growing buffer
+    size_t mLightIndexCapacity = 0;
+
+    // Cluster geometry, rebuilt when the projection or the viewport changes
+    glm::mat4 mProjection = glm::mat4(0.0f);
+    int mWidth = 0;
+    int mHeight = 0;
+    std::vector<ClusterBounds> mClusterBounds;
+    float mSliceDepths[GRID_Z + 1];
+
+    // CPU assignment
+    std::vector<glm::vec4> mViewLights;                 // xyz: view-space position, w: radius
+    std::vector<std::vector<uint32_t>> mSliceIndices;   // each slice's lists, written by its own job
+    std::vector<std::vector<uint32_t>> mSliceCandidates;
+    std::vector<size_t> mSliceDropped;
+    std::vector<ClusterRange> mClusterRanges;
+    std::vector<uint32_t> mLightIndices;
+    uint32_t mMaxClusterLights = 0;
+    size_t mDropped = 0;
+};
+
+#endif
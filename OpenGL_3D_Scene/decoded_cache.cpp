@@ -0,0 +1,160 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Decoded image cache
+// Description: Uncompressed, memory-mappable files holding the decoded mip chains of the scene images.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // max
+#include <atomic>           // atomic
+#include <cerrno>           // errno, EEXIST
+#include <cstdint>          // uint32_t, uint64_t
+#include <cstdio>           // rename, remove
+#include <cstring>          // memcmp, memcpy, memset
+#include <fstream>          // ofstream
+
+#include "decoded_cache.h"
+
+#ifdef _WIN32
+#include <direct.h>         // _mkdir
+#else
+#include <sys/stat.h>       // mkdir
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const char MAGIC[8] = { 'S', 'C', 'N', 'M', 'I', 'P', 'S', '1' };
+    const int MAX_LEVELS = 32;
+    const size_t DATA_ALIGNMENT = 4096;     // level 0 starts on a page of its own
+    const size_t LEVEL_ALIGNMENT = 64;      // later levels start on a cache line
+
+    // Written as it is in memory: the cache never leaves the machine that wrote it
+    struct Header
+    {
+        char magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t filter;
+        uint32_t levelCount;
+        uint32_t reserved;
+        char sourceHash[16];                // hex digits, as in the file name
+        uint64_t offsets[MAX_LEVELS];       // from the start of the file
+    };
+
+    size_t Align(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    int LevelCount(int width, int height)
+    {
+        int levels = 1;
+        while ((width | height) >> levels)
+            ++levels;
+        return levels;
+    }
+
+    size_t LevelSize(int width, int height, int channels, int level)
+    {
+        return static_cast<size_t>(max(width >> level, 1)) * max(height >> level, 1) * channels;
+    }
+
+    Header MakeHeader(const string& sourceHash, int width, int height, int channels, MipFilter filter)
+    {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.width = static_cast<uint32_t>(width);
+        header.height = static_cast<uint32_t>(height);
+        header.channels = static_cast<uint32_t>(channels);
+        header.filter = static_cast<uint32_t>(filter);
+        header.levelCount = static_cast<uint32_t>(LevelCount(width, height));
+        memcpy(header.sourceHash, sourceHash.data(), min(sourceHash.size(), sizeof(header.sourceHash)));
+
+        size_t offset = Align(sizeof(Header), DATA_ALIGNMENT);
+        for (uint32_t level = 0; level < header.levelCount; ++level)
+        {
+            header.offsets[level] = offset;
+            offset = Align(offset + LevelSize(width, height, channels, level), LEVEL_ALIGNMENT);
+        }
+        return header;
+    }
+}
+
+
+bool CreateDecodedCacheDirectory(const string& directory)
+{
+#ifdef _WIN32
+    return _mkdir(directory.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+string DecodedCachePath(const string& directory, const string& sourceHash, int width, int height, int channels, MipFilter filter)
+{
+    return directory + "/" + sourceHash + "-" + to_string(width) + "x" + to_string(height) + "x" + to_string(channels) + "-"
+        + MipFilterName(filter) + ".mips";
+}
+
+// Everything the name encodes is checked again, so a renamed or truncated entry is never streamed
+//---------------------------------------------------------------------------------------------------
+bool OpenDecodedCache(const string& path, const string& sourceHash, int width, int height, int channels, MipFilter filter,
+    DecodedCacheEntry& entry)
+{
+    if (!entry.file.Open(path))
+        return false;
+
+    const Header expected = MakeHeader(sourceHash, width, height, channels, filter);
+    const int levels = static_cast<int>(expected.levelCount);
+    const size_t end = expected.offsets[levels - 1] + LevelSize(width, height, channels, levels - 1);
+    if (entry.file.Size() < end || memcmp(entry.file.Data(), &expected, sizeof(Header)) != 0)
+    {
+        entry.file.Close();
+        return false;
+    }
+
+    entry.levels.resize(levels);
+    for (int level = 0; level < levels; ++level)
+        entry.levels[level] = entry.file.Data() + expected.offsets[level];
+    return true;
+}
+
+bool WriteDecodedCache(const string& path, const string& sourceHash, int width, int height, int channels, MipFilter filter,
+    const vector<vector<unsigned char>>& levels)
+{
+    const Header header = MakeHeader(sourceHash, width, height, channels, filter);
+    if (levels.size() != header.levelCount)
+        return false;
+
+    // Workers finishing the same image at once write separate temporaries; the last rename wins with identical bytes
+    static atomic<unsigned> sequence(0);
+    const string temporary = path + "." + to_string(sequence++) + ".tmp";
+    {
+        ofstream file(temporary, ios::binary | ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const vector<char> padding(DATA_ALIGNMENT, 0);
+        size_t position = sizeof(header);
+        for (size_t level = 0; level < levels.size(); ++level)
+        {
+            file.write(padding.data(), static_cast<streamsize>(header.offsets[level] - position));
+            file.write(reinterpret_cast<const char*>(levels[level].data()), static_cast<streamsize>(levels[level].size()));
+            position = header.offsets[level] + levels[level].size();
+        }
+        if (!file)
+        {
+            file.close();
+            remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    // rename does not replace an existing file on Windows; the entry already there is as good as this one
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Decoded image cache: the mip chain a decode worker builds for an image (flipped rows, scaled to its texture's size,
+ * every level down to 1x1), stored uncompressed so a later run maps the file and streams the levels straight from the
+ * mapped pages, with no decode and no mip generation. Entries are named by the hash of the source file's bytes together
+ * with everything else that shapes the levels, so an edited image or another size or filter simply misses. Unlike the
+ * baked KTX2 files the levels stay RGB(A)8, needing no format support and losing nothing to block compression.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef DECODED_CACHE_H
+#define DECODED_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "mip_chain.h"
+
+// A cache entry mapped by OpenDecodedCache; levels point into the mapping, level 0 first
+struct DecodedCacheEntry
+{
+    MappedFile file;
+    std::vector<const unsigned char*> levels;
+};
+
+// Creates the cache directory when it does not exist yet; false if it cannot be created
+bool CreateDecodedCacheDirectory(const std::string& directory);
+
+// Entry of an image whose source bytes hash to sourceHash (SourceHash in texture_bake.h), decoded to channels channels
+// and mipped with filter from width x height
+std::string DecodedCachePath(const std::string& directory, const std::string& sourceHash, int width, int height, int channels,
+    MipFilter filter);
+
+// Maps the entry and checks that its header and level sizes match; entry is left closed when they do not
+bool OpenDecodedCache(const std::string& path, const std::string& sourceHash, int width, int height, int channels, MipFilter filter,
+    DecodedCacheEntry& entry);
+
+// Writes levels (as BuildMipChain returns them) under a temporary name and renames it into place, so a run that is killed
+// or races another never leaves a partial entry behind
+bool WriteDecodedCache(const std::string& path, const std::string& sourceHash, int width, int height, int channels, MipFilter filter,
+    const std::vector<std::vector<unsigned char>>& levels);
+
+#endif
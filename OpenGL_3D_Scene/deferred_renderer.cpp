@@ -0,0 +1,130 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Deferred renderer
+// Description: G-buffer management and the full-screen lighting pass of the deferred shading path.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+
+#include "deferred_renderer.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    GLuint CreateTarget(GLenum format, int width, int height)
+    {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
+}
+
+
+bool DeferredRenderer::Create(const glm::vec3& keyLightPosition)
+{
+    Shader lightingShader("shaderFiles/deferred_lighting.vs", "shaderFiles/deferred_lighting.fs");
+    GLint linked = GL_FALSE;
+    glGetProgramiv(lightingShader.ID, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        cout << "Deferred lighting program failed to build" << endl;
+        glDeleteProgram(lightingShader.ID);
+        return false;
+    }
+    mLightingProgram = lightingShader.ID;
+    mInverseViewProjection = lightingShader.uniform<glm::mat4>("inverseViewProjection");
+
+    glUseProgram(mLightingProgram);
+    Shader::set(lightingShader.uniform<glm::vec3>("lightPos"), keyLightPosition);
+    glUseProgram(0);
+
+    glGenVertexArrays(1, &mEmptyVertexArray);
+    return true;
+}
+
+void DeferredRenderer::Destroy()
+{
+    glDeleteProgram(mLightingProgram);
+    glDeleteVertexArrays(1, &mEmptyVertexArray);
+    glDeleteFramebuffers(1, &mFramebuffer);
+    glDeleteTextures(1, &mAlbedoTexture);
+    glDeleteTextures(1, &mNormalTexture);
+    glDeleteTextures(1, &mDrawIdTexture);
+    glDeleteTextures(1, &mDepthTexture);
+    mLightingProgram = mEmptyVertexArray = mFramebuffer = 0;
+    mAlbedoTexture = mNormalTexture = mDrawIdTexture = mDepthTexture = 0;
+    mWidth = mHeight = 0;
+}
+
+// (Re)allocate the G-buffer for a framebuffer of the given size
+//----------------------------------------------------------------
+void DeferredRenderer::Resize(int width, int height)
+{
+    glDeleteFramebuffers(1, &mFramebuffer);
+    glDeleteTextures(1, &mAlbedoTexture);
+    glDeleteTextures(1, &mNormalTexture);
+    glDeleteTextures(1, &mDrawIdTexture);
+    glDeleteTextures(1, &mDepthTexture);
+
+    mWidth = width;
+    mHeight = height;
+    mAlbedoTexture = CreateTarget(GL_RGBA8, width, height);
+    mNormalTexture = CreateTarget(GL_RG16_SNORM, width, height);
+    mDrawIdTexture = CreateTarget(GL_R16UI, width, height);
+    mDepthTexture = CreateTarget(GL_DEPTH_COMPONENT24, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &mFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mAlbedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, mNormalTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, mDrawIdTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, mDepthTexture, 0);
+    const GLenum attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(3, attachments);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        cout << "G-buffer framebuffer is incomplete" << endl;
+
+    // 4 + 4 + 2 bytes of color per pixel next to the depth
+    cout << "INFO: G-buffer " << width << "x" << height << ", " << (width * height * 10) / 1024 << " KB of color targets" << endl;
+}
+
+void DeferredRenderer::BeginGeometry(GLStateCache& state)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &mTargetFramebuffer);
+    if (viewport[2] != mWidth || viewport[3] != mHeight)
+    {
+        Resize(viewport[2], viewport[3]);
+        state.Invalidate(); // Resize binds textures directly
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+
+    // Only depth decides which pixels the lighting pass shades, so the color targets keep last frame's contents
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+// One full-screen triangle; it writes the G-buffer depth as its own, so the target ends up with the scene's depth
+//------------------------------------------------------------------------------------------------------------------
+void DeferredRenderer::Resolve(GLStateCache& state, const glm::mat4& viewProjection)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, mTargetFramebuffer);
+
+    state.UseProgram(mLightingProgram);
+    Shader::set(mInverseViewProjection, glm::inverse(viewProjection));
+    state.BindTexture(ALBEDO_UNIT, GL_TEXTURE_2D, mAlbedoTexture);
+    state.BindTexture(NORMAL_UNIT, GL_TEXTURE_2D, mNormalTexture);
+    state.BindTexture(DRAW_ID_UNIT, GL_TEXTURE_2D, mDrawIdTexture);
+    state.BindTexture(DEPTH_UNIT, GL_TEXTURE_2D, mDepthTexture);
+    state.BindVertexArray(mEmptyVertexArray);
+
+    glDepthFunc(GL_ALWAYS);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDepthFunc(GL_LESS);
+}
@@ -0,0 +1,54 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Deferred shading: the object programs' G-buffer variants write each visible surface's albedo, octahedral normal and
+ * draw index into a compact G-buffer, and one full-screen pass then lights every pixel once, rebuilding the position
+ * from depth and walking the clustered light list of the pixel. Shading cost follows the pixels on screen instead of
+ * the fragments drawn, so overdraw and many lights no longer multiply.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef DEFERRED_RENDERER_H
+#define DEFERRED_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state_cache.h"
+#include "shader.h"
+
+class DeferredRenderer
+{
+public:
+    // Texture units the lighting pass reads the G-buffer from; above the scene texture arrays' units 0-7
+    static const GLuint ALBEDO_UNIT = 8;
+    static const GLuint NORMAL_UNIT = 9;
+    static const GLuint DRAW_ID_UNIT = 10;
+    static const GLuint DEPTH_UNIT = 11;
+
+    // Builds the lighting pass program; keyLightPosition is the forward shader's lightPos
+    bool Create(const glm::vec3& keyLightPosition);
+    void Destroy();
+
+    // Binds the G-buffer, sized to the current viewport, and clears it. The framebuffer bound until now is the one
+    // the lighting pass writes to.
+    void BeginGeometry(GLStateCache& state);
+
+    // Lights the G-buffer into the framebuffer bound before BeginGeometry and copies its depth there, so forward
+    // passes drawn afterwards depth test against the scene. The per-draw data and the cluster lists must be bound.
+    void Resolve(GLStateCache& state, const glm::mat4& viewProjection);
+
+private:
+    void Resize(int width, int height);
+
+    GLuint mLightingProgram = 0;
+    GLuint mEmptyVertexArray = 0;   // the full-screen triangle is generated from gl_VertexID
+    GLuint mFramebuffer = 0;
+    GLuint mAlbedoTexture = 0;      // RGBA8: rgb albedo, a 1 for lit surfaces and 0 for unlit ones
+    GLuint mNormalTexture = 0;      // RG16_SNORM: octahedral world-space normal
+    GLuint mDrawIdTexture = 0;      // R16UI: index of the surface's per-draw data
+    GLuint mDepthTexture = 0;
+    GLint mTargetFramebuffer = 0;
+    int mWidth = 0;
+    int mHeight = 0;
+
+    Uniform<glm::mat4> mInverseViewProjection;
+};
+
+#endif
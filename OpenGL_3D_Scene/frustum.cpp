@@ -0,0 +1,110 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Frustum culling
+// Description: Plane extraction and the batched box-versus-frustum test.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <cmath>            // fabs
+
+#include "frustum.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE2 1
+#include <emmintrin.h>      // SSE2 intrinsics
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // Scalar test of one box; also handles the boxes left over after the four-wide loop
+    bool BoxVisible(const Frustum& frustum, const BoxBatch& boxes, size_t i)
+    {
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            float distance = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+            float radius = fabs(plane.x) * boxes.extentX[i] + fabs(plane.y) * boxes.extentY[i] + fabs(plane.z) * boxes.extentZ[i];
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+}
+
+
+// Gribb-Hartmann: each plane is the sum or difference of the fourth row of the matrix and one of the others
+//-----------------------------------------------------------------------------------------------------------
+Frustum Frustum::FromViewProjection(const glm::mat4& viewProjection)
+{
+    // glm is column-major: row r is (m[0][r], m[1][r], m[2][r], m[3][r])
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r)
+        rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0]; // left
+    frustum.planes[1] = rows[3] - rows[0]; // right
+    frustum.planes[2] = rows[3] + rows[1]; // bottom
+    frustum.planes[3] = rows[3] - rows[1]; // top
+    frustum.planes[4] = rows[3] + rows[2]; // near
+    frustum.planes[5] = rows[3] - rows[2]; // far
+    return frustum;
+}
+
+void BoxBatch::Clear()
+{
+    centerX.clear(); centerY.clear(); centerZ.clear();
+    extentX.clear(); extentY.clear(); extentZ.clear();
+}
+
+void BoxBatch::Add(const glm::vec3& center, const glm::vec3& extent)
+{
+    centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+    extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+}
+
+// Arvo: the world extent along each axis is the sum of the box extents scaled by the absolute matrix entries
+//-----------------------------------------------------------------------------------------------------------
+void TransformBox(const glm::mat4& transform, const glm::vec3& center, const glm::vec3& extent, glm::vec3& worldCenter, glm::vec3& worldExtent)
+{
+    worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+    const glm::mat3 absolute(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+    worldExtent = absolute * extent;
+}
+
+// A box is outside a plane when even its corner furthest along the plane normal is behind it
+//--------------------------------------------------------------------------------------------
+void CullBoxes(const Frustum& frustum, const BoxBatch& boxes, vector<uint8_t>& visible)
+{
+    const size_t count = boxes.Size();
+    visible.resize(count);
+
+    size_t i = 0;
+#ifdef FRUSTUM_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 centerX = _mm_loadu_ps(&boxes.centerX[i]);
+        const __m128 centerY = _mm_loadu_ps(&boxes.centerY[i]);
+        const __m128 centerZ = _mm_loadu_ps(&boxes.centerZ[i]);
+        const __m128 extentX = _mm_loadu_ps(&boxes.extentX[i]);
+        const __m128 extentY = _mm_loadu_ps(&boxes.extentY[i]);
+        const __m128 extentZ = _mm_loadu_ps(&boxes.extentZ[i]);
+
+        __m128 outside = zero;
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y)));
+            distance = _mm_add_ps(distance, _mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(fabs(plane.x))), _mm_mul_ps(extentY, _mm_set1_ps(fabs(plane.y))));
+            radius = _mm_add_ps(radius, _mm_mul_ps(extentZ, _mm_set1_ps(fabs(plane.z))));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        const int mask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; ++lane)
+            visible[i + lane] = (mask >> lane) & 1 ? 0 : 1;
+    }
+#endif
+    for (; i < count; ++i)
+        visible[i] = BoxVisible(frustum, boxes, i) ? 1 : 0;
+}
@@ -0,0 +1,40 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * View-frustum culling: the six planes of a view-projection matrix and a batch test of world-space bounding boxes against
+ * them, four boxes at a time with SSE2 where available.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Frustum
+{
+    // xyz: normal pointing into the frustum, w: offset; a point p is inside a plane when dot(xyz, p) + w >= 0
+    glm::vec4 planes[6];
+
+    // Planes of the clip volume of viewProjection, in the space the matrix maps from (world space for projection * view)
+    static Frustum FromViewProjection(const glm::mat4& viewProjection);
+};
+
+// Axis-aligned boxes in structure-of-arrays form so the batch test loads four boxes per component
+struct BoxBatch
+{
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    void Clear();
+    void Add(const glm::vec3& center, const glm::vec3& extent);
+    size_t Size() const { return centerX.size(); }
+};
+
+// World-space box around an object-space box under an affine transform
+void TransformBox(const glm::mat4& transform, const glm::vec3& center, const glm::vec3& extent, glm::vec3& worldCenter, glm::vec3& worldExtent);
+
+// Sets visible[i] to 1 when box i touches the frustum and to 0 when it lies entirely outside one of its planes
+void CullBoxes(const Frustum& frustum, const BoxBatch& boxes, std::vector<uint8_t>& visible);
+
+#endif
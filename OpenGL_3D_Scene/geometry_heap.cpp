@@ -0,0 +1,222 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Geometry heap
+// Description: Buddy suballocation of mesh vertex and index ranges from shared immutable buffers.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // max, min
+
+#include "geometry_heap.h"
+#include "gl_extensions.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const uint64_t MIN_VERTEX_BLOCK = 16;   // vertices
+    const uint64_t MIN_INDEX_BLOCK = 64;    // bytes; keeps every range aligned for both index types
+
+    uint64_t NextPowerOfTwo(uint64_t value)
+    {
+        uint64_t result = 1;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    uint64_t PreviousPowerOfTwo(uint64_t value)
+    {
+        uint64_t result = 1;
+        while (result * 2 <= value)
+            result <<= 1;
+        return result;
+    }
+
+    size_t IndexSize(GLenum indexType)
+    {
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    // Allocate a buffer's storage once; immutable when the driver supports it
+    void CreateStorage(GLenum target, GLsizeiptr size)
+    {
+        if (gGLExt.bufferStorage)
+            gGLExt.BufferStorage(target, size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        else
+            glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+    }
+}
+
+
+BuddyAllocator::BuddyAllocator(uint64_t capacity, uint64_t minBlock)
+    : mMinBlock(NextPowerOfTwo(max<uint64_t>(minBlock, 1)))
+{
+    mCapacity = capacity >= mMinBlock ? PreviousPowerOfTwo(capacity / mMinBlock) * mMinBlock : 0;
+    if (mCapacity == 0)
+        return;
+
+    unsigned orders = 1;
+    while (BlockSize(orders - 1) < mCapacity)
+        ++orders;
+    mFree.resize(orders);
+    mFree.back().insert(0);
+}
+
+// Take the smallest free block that fits, splitting larger blocks in halves on the way down
+//------------------------------------------------------------------------------------------
+bool BuddyAllocator::Allocate(uint64_t size, uint64_t& offset)
+{
+    unsigned order = 0;
+    while (order < mFree.size() && BlockSize(order) < size)
+        ++order;
+
+    unsigned available = order;
+    while (available < mFree.size() && mFree[available].empty())
+        ++available;
+    if (available >= mFree.size())
+        return false;
+
+    offset = *mFree[available].begin();
+    mFree[available].erase(mFree[available].begin());
+    while (available > order)
+    {
+        --available;
+        mFree[available].insert(offset + BlockSize(available));
+    }
+
+    mAllocated[offset] = order;
+    mUsed += BlockSize(order);
+    return true;
+}
+
+// Return a block and merge it with its buddy for as long as the buddy is free as well
+//-------------------------------------------------------------------------------------
+void BuddyAllocator::Free(uint64_t offset)
+{
+    auto found = mAllocated.find(offset);
+    if (found == mAllocated.end())
+        return;
+
+    unsigned order = found->second;
+    mAllocated.erase(found);
+    mUsed -= BlockSize(order);
+
+    while (order + 1 < mFree.size())
+    {
+        uint64_t buddy = offset ^ BlockSize(order);
+        auto free = mFree[order].find(buddy);
+        if (free == mFree[order].end())
+            break;
+        mFree[order].erase(free);
+        offset = min(offset, buddy);
+        ++order;
+    }
+    mFree[order].insert(offset);
+}
+
+
+// Open a page for a layout: one vertex buffer, one index buffer and the VAO tying them together
+//------------------------------------------------------------------------------------------------
+GeometryHeap::Page& GeometryHeap::CreatePage(const VertexLayout& layout, size_t vertexCount, size_t indexBytes)
+{
+    Page page;
+    page.layout = layout;
+
+    uint64_t vertexCapacity = max(PreviousPowerOfTwo(DEFAULT_VERTEX_PAGE_BYTES / layout.stride), NextPowerOfTwo(vertexCount));
+    uint64_t indexCapacity = max<uint64_t>(DEFAULT_INDEX_PAGE_BYTES, NextPowerOfTwo(indexBytes));
+    page.vertices = BuddyAllocator(vertexCapacity, MIN_VERTEX_BLOCK);
+    page.indices = BuddyAllocator(indexCapacity, MIN_INDEX_BLOCK);
+
+    glGenVertexArrays(1, &page.vao);
+    glBindVertexArray(page.vao);
+
+    glGenBuffers(1, &page.vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, page.vertexBuffer);
+    CreateStorage(GL_ARRAY_BUFFER, page.vertices.Capacity() * layout.stride);
+    layout.Apply();
+
+    glGenBuffers(1, &page.indexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.indexBuffer); // Element buffer binding is stored in the VAO
+    CreateStorage(GL_ELEMENT_ARRAY_BUFFER, page.indices.Capacity());
+
+    mPages.push_back(page);
+    return mPages.back();
+}
+
+// Find room for the mesh in a page of its layout and upload its data there
+//--------------------------------------------------------------------------
+void GeometryHeap::Allocate(GLMesh& mesh, const VertexLayout& layout, const void* vertices, size_t vertexCount,
+    const void* indices, size_t indexCount, GLenum indexType)
+{
+    const size_t indexBytes = indexCount * IndexSize(indexType);
+
+    Page* target = nullptr;
+    uint64_t vertexOffset = 0, indexOffset = 0;
+    for (Page& page : mPages)
+    {
+        if (!(page.layout == layout) || !page.vertices.Allocate(vertexCount, vertexOffset))
+            continue;
+        if (page.indices.Allocate(indexBytes, indexOffset))
+        {
+            target = &page;
+            break;
+        }
+        page.vertices.Free(vertexOffset);
+    }
+
+    if (!target)
+    {
+        target = &CreatePage(layout, vertexCount, indexBytes);
+        target->vertices.Allocate(vertexCount, vertexOffset);
+        target->indices.Allocate(indexBytes, indexOffset);
+    }
+
+    glBindVertexArray(target->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, target->vertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * layout.stride, vertexCount * layout.stride, vertices);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indexOffset, indexBytes, indices);
+
+    mesh.vao = target->vao;
+    mesh.baseVertex = static_cast<GLint>(vertexOffset);
+    mesh.firstIndex = static_cast<GLuint>(indexOffset / IndexSize(indexType));
+}
+
+// Give the mesh's ranges back to its page
+//-----------------------------------------
+void GeometryHeap::Free(GLMesh& mesh)
+{
+    for (Page& page : mPages)
+    {
+        if (page.vao != mesh.vao)
+            continue;
+        page.vertices.Free(static_cast<uint64_t>(mesh.baseVertex));
+        page.indices.Free(static_cast<uint64_t>(mesh.firstIndex) * IndexSize(mesh.indexType));
+        break;
+    }
+    mesh.vao = 0;
+    mesh.nIndices = 0;
+}
+
+void GeometryHeap::Destroy()
+{
+    for (Page& page : mPages)
+    {
+        glDeleteVertexArrays(1, &page.vao);
+        glDeleteBuffers(1, &page.vertexBuffer);
+        glDeleteBuffers(1, &page.indexBuffer);
+    }
+    mPages.clear();
+}
+
+void GeometryHeap::Report() const
+{
+    for (size_t i = 0; i < mPages.size(); ++i)
+    {
+        const Page& page = mPages[i];
+        cout << "INFO: Geometry page " << i << " (" << page.layout.stride << "-byte vertices): "
+            << page.vertices.Used() << "/" << page.vertices.Capacity() << " vertices, "
+            << page.indices.Used() << "/" << page.indices.Capacity() << " index bytes" << endl;
+    }
+    cout << "INFO: Geometry heap: " << mPages.size() << " VAOs and " << mPages.size() * 2 << " buffers for all meshes ("
+        << (gGLExt.bufferStorage ? "immutable" : "mutable") << " storage)" << endl;
+}
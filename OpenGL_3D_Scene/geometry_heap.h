@@ -0,0 +1,72 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Geometry heap: mesh vertices and indices suballocated from a few large buffers. Each vertex layout owns pages of one
+ * vertex buffer, one index buffer and one VAO; a GLMesh only records its page's VAO and where its data lives.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef GEOMETRY_HEAP_H
+#define GEOMETRY_HEAP_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh.h"
+
+// Binary buddy allocator over [0, capacity) in abstract units; blocks are powers of two of at least minBlock units
+class BuddyAllocator
+{
+public:
+    BuddyAllocator(uint64_t capacity = 0, uint64_t minBlock = 1);
+
+    bool Allocate(uint64_t size, uint64_t& offset);
+    void Free(uint64_t offset);
+
+    uint64_t Capacity() const { return mCapacity; }
+    uint64_t Used() const { return mUsed; } // includes the padding of each block up to its power of two
+
+private:
+    uint64_t BlockSize(unsigned order) const { return mMinBlock << order; }
+
+    uint64_t mCapacity;
+    uint64_t mMinBlock;
+    uint64_t mUsed = 0;
+    std::vector<std::set<uint64_t>> mFree;              // free block offsets per order, order 0 being minBlock
+    std::unordered_map<uint64_t, unsigned> mAllocated;  // offset -> order of live blocks
+};
+
+class GeometryHeap
+{
+public:
+    static const GLsizeiptr DEFAULT_VERTEX_PAGE_BYTES = 4 << 20;
+    static const GLsizeiptr DEFAULT_INDEX_PAGE_BYTES = 1 << 20;
+
+    // Copies already encoded vertices (layout.stride bytes each) and indices into a page of the layout and points the
+    // mesh at them: shared VAO, base vertex and first index. Opens a new page when the existing ones are full.
+    void Allocate(GLMesh& mesh, const VertexLayout& layout, const void* vertices, size_t vertexCount,
+        const void* indices, size_t indexCount, GLenum indexType);
+    void Free(GLMesh& mesh);
+
+    void Destroy();
+
+    // Prints page count and space used per buffer type
+    void Report() const;
+
+private:
+    struct Page
+    {
+        VertexLayout layout;
+        GLuint vao = 0;
+        GLuint vertexBuffer = 0;
+        GLuint indexBuffer = 0;
+        BuddyAllocator vertices;    // units: vertices
+        BuddyAllocator indices;     // units: bytes
+    };
+
+    Page& CreatePage(const VertexLayout& layout, size_t vertexCount, size_t indexBytes);
+
+    std::vector<Page> mPages;
+};
+
+#endif
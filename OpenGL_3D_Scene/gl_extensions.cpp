@@ -0,0 +1,69 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: GL extensions
+// Description: Loads the post-4.3 entry points the renderer uses when the driver provides them.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <cstring>          // strcmp
+
+#include "gl_extensions.h"
+
+using namespace std; // Standard namespace
+
+GLExtensions gGLExt;
+
+// Unnamed namespace
+namespace
+{
+    // Context version as major * 10 + minor
+    int GLVersion()
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        return major * 10 + minor;
+    }
+}
+
+
+// Search the context's extension list
+//-------------------------------------
+bool HasGLExtension(const char* name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Resolve the optional entry points
+//-----------------------------------
+void LoadGLExtensions(GLADloadproc load)
+{
+    const int version = GLVersion();
+
+    gGLExt = GLExtensions();
+    if (version >= 44 || HasGLExtension("GL_ARB_buffer_storage"))
+        gGLExt.BufferStorage = (PFNSCENEBUFFERSTORAGEPROC)load("glBufferStorage");
+    gGLExt.bufferStorage = gGLExt.BufferStorage != nullptr;
+
+    cout << "INFO: Immutable buffer storage " << (gGLExt.bufferStorage ? "available" : "unavailable, using glBufferData") << endl;
+
+    // The book's faces pick their handle per vertex, so a handle is not uniform across a draw; only NV_gpu_shader5 makes
+    // sampling through such divergent handles defined, and without it the scene stays on texture arrays
+    if (HasGLExtension("GL_ARB_bindless_texture") && HasGLExtension("GL_NV_gpu_shader5"))
+    {
+        gGLExt.GetTextureHandle = (PFNSCENEGETTEXTUREHANDLEPROC)load("glGetTextureHandleARB");
+        gGLExt.MakeTextureHandleResident = (PFNSCENEMAKETEXTUREHANDLERESIDENTPROC)load("glMakeTextureHandleResidentARB");
+        gGLExt.MakeTextureHandleNonResident = (PFNSCENEMAKETEXTUREHANDLENONRESIDENTPROC)load("glMakeTextureHandleNonResidentARB");
+    }
+    gGLExt.bindlessTexture = gGLExt.GetTextureHandle && gGLExt.MakeTextureHandleResident && gGLExt.MakeTextureHandleNonResident;
+
+    cout << "INFO: Bindless textures " << (gGLExt.bindlessTexture ? "available" : "unavailable, using texture arrays") << endl;
+
+    gGLExt.textureCompressionS3TC = HasGLExtension("GL_EXT_texture_compression_s3tc");
+}
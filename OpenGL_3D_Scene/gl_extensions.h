@@ -0,0 +1,52 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Entry points and tokens newer than the GL 4.3 core profile the bundled glad loader was generated for. They are loaded
+ * through the same proc address function as glad and are null when the driver lacks them.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_DYNAMIC_STORAGE_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+
+// EXT_texture_compression_s3tc, for the baked BC1 and BC3 textures (BC7 is core since GL 4.2)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+typedef void (APIENTRYP PFNSCENEBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// ARB_bindless_texture
+typedef GLuint64 (APIENTRYP PFNSCENEGETTEXTUREHANDLEPROC)(GLuint texture);
+typedef void (APIENTRYP PFNSCENEMAKETEXTUREHANDLERESIDENTPROC)(GLuint64 handle);
+typedef void (APIENTRYP PFNSCENEMAKETEXTUREHANDLENONRESIDENTPROC)(GLuint64 handle);
+
+struct GLExtensions
+{
+    bool bufferStorage = false; // immutable buffer storage (GL 4.4 or ARB_buffer_storage)
+    PFNSCENEBUFFERSTORAGEPROC BufferStorage = nullptr;
+
+    bool bindlessTexture = false; // 64-bit texture handles usable from shaders, also when divergent (ARB_bindless_texture + NV_gpu_shader5)
+    PFNSCENEGETTEXTUREHANDLEPROC GetTextureHandle = nullptr;
+    PFNSCENEMAKETEXTUREHANDLERESIDENTPROC MakeTextureHandleResident = nullptr;
+    PFNSCENEMAKETEXTUREHANDLENONRESIDENTPROC MakeTextureHandleNonResident = nullptr;
+
+    bool textureCompressionS3TC = false; // BC1-BC3 texture formats (EXT_texture_compression_s3tc)
+};
+
+extern GLExtensions gGLExt;
+
+// True when the context reports the extension in its GL_EXTENSIONS list
+bool HasGLExtension(const char* name);
+
+// Call once after glad has loaded the core entry points
+void LoadGLExtensions(GLADloadproc load);
+
+#endif
@@ -0,0 +1,80 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: GL state cache
+// Description: Redundant bind elimination for the per-frame submission path.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include "gl_state_cache.h"
+
+// Count the request and report whether it needs a GL call
+//---------------------------------------------------------
+bool GLStateCache::Changed(GLuint& current, GLuint value)
+{
+    if (current == value)
+    {
+        ++mCounters.skipped;
+        return false;
+    }
+    current = value;
+    ++mCounters.issued;
+    return true;
+}
+
+void GLStateCache::UseProgram(GLuint program)
+{
+    if (Changed(mProgram, program))
+        glUseProgram(program);
+}
+
+void GLStateCache::BindVertexArray(GLuint vao)
+{
+    if (Changed(mVertexArray, vao))
+        glBindVertexArray(vao);
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    if (unit >= MAX_TEXTURE_UNITS)
+    {
+        // Outside the shadowed range: always issue
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        mActiveUnit = unit;
+        mCounters.issued += 2;
+        return;
+    }
+
+    if (mTextureTargets[unit] == target && mTextures[unit] == texture)
+    {
+        ++mCounters.skipped;
+        return;
+    }
+
+    // Selecting the unit is only paid for when the binding itself changes
+    if (mActiveUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        mActiveUnit = unit;
+        ++mCounters.issued;
+    }
+    glBindTexture(target, texture);
+    mTextureTargets[unit] = target;
+    mTextures[unit] = texture;
+    ++mCounters.issued;
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& current = target == GL_DRAW_INDIRECT_BUFFER ? mIndirectBuffer : mArrayBuffer;
+    if (Changed(current, buffer))
+        glBindBuffer(target, buffer);
+}
+
+void GLStateCache::Invalidate()
+{
+    mProgram = mVertexArray = mActiveUnit = UNKNOWN;
+    mArrayBuffer = mIndirectBuffer = UNKNOWN;
+    for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; ++unit)
+    {
+        mTextures[unit] = UNKNOWN;
+        mTextureTargets[unit] = GL_NONE;
+    }
+}
@@ -0,0 +1,60 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * GL state cache: shadows the bindings the renderer changes per draw and skips calls that would not change anything.
+ * Code that changes the same state behind the cache's back must call Invalidate before the cache is used again.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef GL_STATE_CACHE_H
+#define GL_STATE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// A texture bound to a unit; draws request their textures as sets of these
+struct TextureBinding
+{
+    GLuint unit;
+    GLenum target;
+    GLuint texture;
+};
+
+class GLStateCache
+{
+public:
+    static const GLuint MAX_TEXTURE_UNITS = 16;
+
+    // Calls issued to GL and calls skipped because the state was already current
+    struct Counters
+    {
+        size_t issued = 0;
+        size_t skipped = 0;
+    };
+
+    GLStateCache() { Invalidate(); }
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vao);
+    void BindTexture(GLuint unit, GLenum target, GLuint texture);   // selects the unit only when a bind is issued
+    void BindBuffer(GLenum target, GLuint buffer);                  // GL_ARRAY_BUFFER and GL_DRAW_INDIRECT_BUFFER
+
+    // Forgets every binding so the next request of each is issued
+    void Invalidate();
+
+    void ResetCounters() { mCounters = Counters(); }
+    const Counters& GetCounters() const { return mCounters; }
+
+private:
+    bool Changed(GLuint& current, GLuint value);
+
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint mProgram = UNKNOWN;
+    GLuint mVertexArray = UNKNOWN;
+    GLuint mActiveUnit = UNKNOWN;
+    GLuint mTextures[MAX_TEXTURE_UNITS];          // texture last bound on each unit
+    GLenum mTextureTargets[MAX_TEXTURE_UNITS];    // and the target it was bound to
+    GLuint mArrayBuffer = UNKNOWN;
+    GLuint mIndirectBuffer = UNKNOWN;
+    Counters mCounters;
+};
+
+#endif
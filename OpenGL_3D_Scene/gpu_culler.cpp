@@ -0,0 +1,210 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: GPU culler
+// Description: Compute-shader frustum and Hi-Z occlusion culling that writes the render queue's indirect commands.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // max
+
+#include "gpu_culler.h"
+#include "frustum.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const GLuint CULL_GROUP_SIZE = 64;  // local_size_x of cull_shader.cs
+    const GLuint HIZ_GROUP_SIZE = 8;    // local_size_x and local_size_y of hiz_shader.cs
+    const GLuint HIZ_SOURCE_IMAGE = 0;  // image units of hiz_shader.cs
+    const GLuint HIZ_TARGET_IMAGE = 1;
+
+    GLuint GroupCount(int size, GLuint groupSize)
+    {
+        return (static_cast<GLuint>(size) + groupSize - 1) / groupSize;
+    }
+}
+
+
+bool GpuCuller::Create()
+{
+    Shader cullShader("shaderFiles/cull_shader.cs");
+    Shader hiZShader("shaderFiles/hiz_shader.cs");
+    GLint cullLinked = GL_FALSE, hiZLinked = GL_FALSE;
+    glGetProgramiv(cullShader.ID, GL_LINK_STATUS, &cullLinked);
+    glGetProgramiv(hiZShader.ID, GL_LINK_STATUS, &hiZLinked);
+    if (!cullLinked || !hiZLinked)
+    {
+        cout << "GPU culling programs failed to build" << endl;
+        glDeleteProgram(cullShader.ID);
+        glDeleteProgram(hiZShader.ID);
+        return false;
+    }
+    mCullProgram = cullShader.ID;
+    mHiZProgram = hiZShader.ID;
+
+    mCullUniforms.drawCount = cullShader.uniform<int>("drawCount");
+    mCullUniforms.frustumPlanes = cullShader.location("frustumPlanes[0]");
+    mCullUniforms.hiZValid = cullShader.uniform<bool>("hiZValid");
+    mCullUniforms.retestPass = cullShader.uniform<bool>("retestPass");
+    mCullUniforms.hiZViewProjection = cullShader.uniform<glm::mat4>("hiZViewProjection");
+    mCullUniforms.hiZSize = cullShader.location("hiZSize");
+    mCullUniforms.hiZLevels = cullShader.uniform<int>("hiZLevels");
+    mFromDepth = hiZShader.uniform<bool>("fromDepth");
+
+    glGenBuffers(1, &mCountBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+void GpuCuller::Destroy()
+{
+    glDeleteProgram(mCullProgram);
+    glDeleteProgram(mHiZProgram);
+    glDeleteBuffers(1, &mCountBuffer);
+    glDeleteTextures(1, &mDepthTexture);
+    glDeleteTextures(1, &mHiZTexture);
+    mCullProgram = mHiZProgram = mCountBuffer = mDepthTexture = mHiZTexture = 0;
+    mWidth = mHeight = mLevels = 0;
+    mHiZValid = false;
+}
+
+void GpuCuller::Begin(const glm::mat4& viewProjection)
+{
+    mViewProjection = viewProjection;
+
+    // Zeroed here rather than in Cull so a frame without draws reports none
+    const GLuint zero[2] = { 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Without a pyramid from the previous frame nothing is hidden, so there is nothing to test again
+//-----------------------------------------------------------------------------------------------
+bool GpuCuller::Cull(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest)
+{
+    const bool hiZValid = mHiZValid;
+    Dispatch(state, count, bounds, sourceCommands, commands, retest, false);
+    return hiZValid;
+}
+
+void GpuCuller::Retest(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest)
+{
+    CaptureDepth(state);
+    Dispatch(state, count, bounds, sourceCommands, commands, retest, true);
+}
+
+// One invocation per draw; the multi-draws must not read the commands before the pass has written them
+//-------------------------------------------------------------------------------------------------------
+void GpuCuller::Dispatch(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest,
+    bool retestPass)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, bounds);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SOURCE_COMMAND_BINDING, sourceCommands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COUNT_BINDING, mCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RETEST_BINDING, retest);
+
+    const Frustum frustum = Frustum::FromViewProjection(mViewProjection);
+    state.UseProgram(mCullProgram);
+    Shader::set(mCullUniforms.drawCount, static_cast<int>(count));
+    glUniform4fv(mCullUniforms.frustumPlanes, 6, &frustum.planes[0][0]);
+    Shader::set(mCullUniforms.hiZValid, mHiZValid);
+    Shader::set(mCullUniforms.retestPass, retestPass);
+    if (mHiZValid)
+    {
+        Shader::set(mCullUniforms.hiZViewProjection, mHiZViewProjection);
+        glUniform2i(mCullUniforms.hiZSize, mWidth, mHeight);
+        Shader::set(mCullUniforms.hiZLevels, mLevels);
+        state.BindTexture(DEPTH_TEXTURE_UNIT, GL_TEXTURE_2D, mHiZTexture);
+    }
+
+    glDispatchCompute(GroupCount(static_cast<int>(count), CULL_GROUP_SIZE), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// (Re)allocate the depth copy and the pyramid for a framebuffer of the given size
+//---------------------------------------------------------------------------------
+void GpuCuller::Resize(int width, int height)
+{
+    glDeleteTextures(1, &mDepthTexture);
+    glDeleteTextures(1, &mHiZTexture);
+
+    mWidth = width;
+    mHeight = height;
+    mLevels = 1;
+    while ((max(width, height) >> mLevels) > 0)
+        ++mLevels;
+
+    glGenTextures(1, &mDepthTexture);
+    glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &mHiZTexture);
+    glBindTexture(GL_TEXTURE_2D, mHiZTexture);
+    glTexStorage2D(GL_TEXTURE_2D, mLevels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mHiZValid = false;
+
+    cout << "INFO: Hi-Z pyramid " << width << "x" << height << ", " << mLevels << " levels" << endl;
+}
+
+// Depth copy into level 0, then one dispatch per level, each reading the level below
+//-------------------------------------------------------------------------------------
+void GpuCuller::CaptureDepth(GLStateCache& state)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    if (viewport[2] <= 0 || viewport[3] <= 0)
+        return;
+    if (viewport[2] != mWidth || viewport[3] != mHeight)
+    {
+        Resize(viewport[2], viewport[3]);
+        state.Invalidate(); // Resize binds textures directly
+    }
+
+    // The bound unit stays active because binds outside the cache's range are always issued
+    state.BindTexture(DEPTH_TEXTURE_UNIT, GL_TEXTURE_2D, mDepthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, mWidth, mHeight);
+
+    state.UseProgram(mHiZProgram);
+    for (int level = 0; level < mLevels; ++level)
+    {
+        // Level 0 reads the depth texture; its source image is bound only to keep the unit valid
+        Shader::set(mFromDepth, level == 0);
+        if (level > 0)
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glBindImageTexture(HIZ_SOURCE_IMAGE, mHiZTexture, max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(HIZ_TARGET_IMAGE, mHiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute(GroupCount(max(mWidth >> level, 1), HIZ_GROUP_SIZE), GroupCount(max(mHeight >> level, 1), HIZ_GROUP_SIZE), 1);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    mHiZViewProjection = mViewProjection;
+    mHiZValid = true;
+}
+
+GLuint GpuCuller::ReadCount(size_t offset) const
+{
+    GLuint value = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCountBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, sizeof(value), &value);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return value;
+}
+
+GLuint GpuCuller::VisibleCount() const
+{
+    return ReadCount(0);
+}
+
+GLuint GpuCuller::OccludedCount() const
+{
+    return ReadCount(sizeof(GLuint));
+}
@@ -0,0 +1,90 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * GPU-driven culling: a compute pass tests every queued draw against the view frustum and a Hi-Z pyramid (the previous
+ * frame's depth reduced to its farthest value per texel) and writes the indirect commands the render queue's
+ * multi-draws consume, with no instance for the draws it rejects. The previous frame's depth is stale once the camera
+ * or the objects move, so the draws it hides are only flagged: after the visible draws are drawn, the pyramid is
+ * rebuilt from this frame's depth and a second pass draws the flagged ones that it does not hide. The CPU never reads
+ * per-object visibility back; only the totals are kept for the benchmark. Needs GL 4.3 compute shaders, which Mesa
+ * llvmpipe provides.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef GPU_CULLER_H
+#define GPU_CULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+#include "gl_state_cache.h"
+#include "shader.h"
+
+class GpuCuller
+{
+public:
+    static const GLuint BOUNDS_BINDING = 3;          // shader storage binding of the draws' object-space boxes
+    static const GLuint SOURCE_COMMAND_BINDING = 4;  // the commands as queued
+    static const GLuint COMMAND_BINDING = 5;         // the commands the multi-draws read
+    static const GLuint COUNT_BINDING = 6;           // visible and occluded totals
+    static const GLuint RETEST_BINDING = 7;          // per-draw flags the first pass leaves for the second
+    static const GLuint DEPTH_TEXTURE_UNIT = 16;     // past the state cache's shadowed units, so binds are always issued
+
+    // Object-space box of one draw; mirrors the std430 DrawBounds struct of the cull shader
+    struct DrawBounds
+    {
+        glm::vec4 center;
+        glm::vec4 extent;
+    };
+
+    bool Create();
+    void Destroy();
+
+    // Starts a frame seen through viewProjection and zeroes the totals
+    void Begin(const glm::mat4& viewProjection);
+
+    // Culls count draws whose per-draw data is already bound at RenderQueue::DRAW_DATA_BINDING, writing commands and
+    // flagging in retest the draws hidden only by the previous frame's depth. True when Retest must follow the draws.
+    bool Cull(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest);
+
+    // Builds the pyramid from the depth drawn so far this frame and writes commands for the flagged draws it leaves visible
+    void Retest(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest);
+
+    // Copies the depth of the framebuffer just rendered and builds the Hi-Z pyramid the next frame's Cull tests against
+    void CaptureDepth(GLStateCache& state);
+
+    // Totals of the last Cull; reading them waits for the GPU, so only the benchmark asks
+    GLuint VisibleCount() const;
+    GLuint OccludedCount() const;
+
+private:
+    void Dispatch(GLStateCache& state, size_t count, GLuint bounds, GLuint sourceCommands, GLuint commands, GLuint retest,
+        bool retestPass);
+    void Resize(int width, int height);
+    GLuint ReadCount(size_t offset) const;
+
+    GLuint mCullProgram = 0;
+    GLuint mHiZProgram = 0;
+    GLuint mCountBuffer = 0;
+    GLuint mDepthTexture = 0;
+    GLuint mHiZTexture = 0;
+    int mWidth = 0;
+    int mHeight = 0;
+    int mLevels = 0;
+    bool mHiZValid = false;
+    glm::mat4 mViewProjection = glm::mat4(1.0f);
+    glm::mat4 mHiZViewProjection = glm::mat4(1.0f);
+
+    // Uniform handles of the two programs; the array and the ivec2 are set through their raw locations
+    struct CullUniforms
+    {
+        Uniform<int> drawCount;
+        GLint frustumPlanes = -1;
+        Uniform<bool> hiZValid;
+        Uniform<bool> retestPass;
+        Uniform<glm::mat4> hiZViewProjection;
+        GLint hiZSize = -1;
+        Uniform<int> hiZLevels;
+    } mCullUniforms;
+    Uniform<bool> mFromDepth;
+};
+
+#endif
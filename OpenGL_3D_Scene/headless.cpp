@@ -0,0 +1,257 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Headless rendering backend
+// Description: Surfaceless EGL context and offscreen framebuffer used when the scene runs without a window.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <fstream>          // ofstream
+#include <vector>
+#include <glad/glad.h>
+
+#include "headless.h"
+#include "gl_extensions.h"
+
+#ifdef SCENE_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>          // strstr
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+#ifdef SCENE_HAS_EGL
+    EGLDisplay gDisplay = EGL_NO_DISPLAY;
+    EGLContext gContext = EGL_NO_CONTEXT;
+#endif
+
+    // Offscreen framebuffer and its attachments
+    GLuint gFramebuffer = 0;
+    GLuint gColorBuffer = 0;
+    GLuint gDepthBuffer = 0;
+    int gWidth = 0;
+    int gHeight = 0;
+}
+
+#ifdef SCENE_HAS_EGL
+
+// Returns true if the space separated extension string contains the given extension
+//-----------------------------------------------------------------------------------
+static bool HasExtension(const char* extensions, const char* name)
+{
+    if (extensions == nullptr)
+        return false;
+
+    const size_t length = strlen(name);
+    for (const char* match = strstr(extensions, name); match != nullptr; match = strstr(match + length, name))
+    {
+        const bool startsWord = (match == extensions) || (match[-1] == ' ');
+        const bool endsWord = (match[length] == ' ') || (match[length] == '\0');
+        if (startsWord && endsWord)
+            return true;
+    }
+    return false;
+}
+
+// Opens the EGL display, preferring the Mesa surfaceless platform so no X11/Wayland server or DRM device is needed
+//------------------------------------------------------------------------------------------------------------------
+static EGLDisplay OpenDisplay()
+{
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (HasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != nullptr)
+        {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+            if (display != EGL_NO_DISPLAY)
+                return display;
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// Creates a 4.4 core profile context with no surface attached
+//-------------------------------------------------------------
+static bool CreateContext()
+{
+    gDisplay = OpenDisplay();
+    EGLint major, minor;
+    if (gDisplay == EGL_NO_DISPLAY || !eglInitialize(gDisplay, &major, &minor))
+    {
+        cout << "Failed to initialize EGL display" << endl;
+        return false;
+    }
+
+    const char* displayExtensions = eglQueryString(gDisplay, EGL_EXTENSIONS);
+    if (!HasExtension(displayExtensions, "EGL_KHR_surfaceless_context"))
+    {
+        cout << "EGL display does not support surfaceless contexts" << endl;
+        return false;
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_API))
+    {
+        cout << "Failed to bind the desktop OpenGL API" << endl;
+        return false;
+    }
+
+    // Surfaceless contexts do not need a config, but pick one when the driver requires it
+    EGLConfig config = EGL_NO_CONFIG_KHR;
+    if (!HasExtension(displayExtensions, "EGL_KHR_no_config_context"))
+    {
+        const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(gDisplay, configAttributes, &config, 1, &numConfigs) || numConfigs == 0)
+        {
+            cout << "Failed to choose an EGL config" << endl;
+            return false;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 4,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    gContext = eglCreateContext(gDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (gContext == EGL_NO_CONTEXT)
+    {
+        cout << "Failed to create EGL context (error 0x" << hex << eglGetError() << dec << ")" << endl;
+        return false;
+    }
+
+    if (!eglMakeCurrent(gDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, gContext))
+    {
+        cout << "Failed to make the EGL context current" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+#endif // SCENE_HAS_EGL
+
+
+// Create the EGL context and the offscreen framebuffer the scene renders into
+//------------------------------------------------------------------------------
+bool InitializeHeadless(int width, int height)
+{
+#ifdef SCENE_HAS_EGL
+    if (!CreateContext())
+    {
+        DestroyHeadless();
+        return false;
+    }
+
+    // glad: load all OpenGL function pointers through EGL
+    // ---------------------------------------------------
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+    {
+        cout << "Failed to initialize GLAD" << endl;
+        DestroyHeadless();
+        return false;
+    }
+    LoadGLExtensions((GLADloadproc)eglGetProcAddress);
+
+    gWidth = width;
+    gHeight = height;
+
+    // Color and depth attachments; renderbuffers are enough because nothing samples them
+    glGenRenderbuffers(1, &gColorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, gColorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &gDepthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, gDepthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &gFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, gFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gColorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gDepthBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cout << "Offscreen framebuffer is incomplete" << endl;
+        DestroyHeadless();
+        return false;
+    }
+
+    BindHeadlessFramebuffer();
+
+    // Displays GPU OpenGL version
+    //------------------------------
+    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    cout << "INFO: OpenGL Renderer: " << glGetString(GL_RENDERER) << " (headless)" << endl;
+
+    return true;
+#else
+    cout << "Headless rendering requires a build with EGL support (SCENE_HAS_EGL)" << endl;
+    return false;
+#endif
+}
+
+// Bind the offscreen framebuffer and size the viewport to it
+//------------------------------------------------------------
+void BindHeadlessFramebuffer()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, gFramebuffer);
+    glViewport(0, 0, gWidth, gHeight);
+}
+
+// Read back the offscreen framebuffer and write it as a binary PPM (P6) image
+//-----------------------------------------------------------------------------
+bool SaveHeadlessFrame(const char* filename)
+{
+    if (gFramebuffer == 0)
+        return false;
+
+    vector<unsigned char> pixels(static_cast<size_t>(gWidth) * gHeight * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gFramebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, gWidth, gHeight, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    ofstream file(filename, ios::binary);
+    if (!file)
+    {
+        cout << "Failed to open " << filename << " for writing" << endl;
+        return false;
+    }
+
+    file << "P6\n" << gWidth << " " << gHeight << "\n255\n";
+    // OpenGL's origin is the bottom left corner, image rows are stored top to bottom
+    const size_t rowSize = static_cast<size_t>(gWidth) * 3;
+    for (int row = gHeight - 1; row >= 0; --row)
+        file.write(reinterpret_cast<const char*>(&pixels[row * rowSize]), rowSize);
+
+    return static_cast<bool>(file);
+}
+
+// Destroy the offscreen framebuffer and the EGL context
+//-------------------------------------------------------
+void DestroyHeadless()
+{
+#ifdef SCENE_HAS_EGL
+    if (gContext != EGL_NO_CONTEXT)
+    {
+        glDeleteFramebuffers(1, &gFramebuffer);
+        glDeleteRenderbuffers(1, &gColorBuffer);
+        glDeleteRenderbuffers(1, &gDepthBuffer);
+        gFramebuffer = gColorBuffer = gDepthBuffer = 0;
+
+        eglMakeCurrent(gDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(gDisplay, gContext);
+        gContext = EGL_NO_CONTEXT;
+    }
+    if (gDisplay != EGL_NO_DISPLAY)
+    {
+        eglTerminate(gDisplay);
+        gDisplay = EGL_NO_DISPLAY;
+    }
+#endif
+}
@@ -0,0 +1,20 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Headless rendering backend: creates a surfaceless EGL context (Mesa llvmpipe works) and an offscreen framebuffer
+ * so the scene can be rendered on machines without a display or GPU.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Creates the EGL context, loads the GL function pointers and binds an offscreen framebuffer of the given size
+bool InitializeHeadless(int width, int height);
+
+// Binds the offscreen framebuffer as the draw target
+void BindHeadlessFramebuffer();
+
+// Writes the current contents of the offscreen framebuffer to a binary PPM image
+bool SaveHeadlessFrame(const char* filename);
+
+// Releases the offscreen framebuffer and the EGL context
+void DestroyHeadless();
+
+#endif
@@ -0,0 +1,261 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: KTX2 files
+// Description: Writes and parses the KTX2 containers of the baked, block-compressed textures.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // sort
+#include <cstdint>          // uint32_t, uint64_t
+#include <cstring>          // memcmp, memcpy
+#include <fstream>          // ifstream, ofstream
+
+#include "ktx2_file.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    const size_t HEADER_SIZE = 80;      // identifier, header and index
+    const size_t LEVEL_ENTRY_SIZE = 24; // byteOffset, byteLength and uncompressedByteLength of a level
+
+    // VkFormat values of the block formats
+    const uint32_t VK_FORMAT_BC1_RGB_UNORM_BLOCK = 131;
+    const uint32_t VK_FORMAT_BC3_UNORM_BLOCK = 137;
+    const uint32_t VK_FORMAT_BC7_UNORM_BLOCK = 145;
+
+    uint32_t VkFormat(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case BlockFormat::BC3: return VK_FORMAT_BC3_UNORM_BLOCK;
+        default: return VK_FORMAT_BC7_UNORM_BLOCK;
+        }
+    }
+
+    size_t Align(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void Put32(vector<unsigned char>& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+
+    void Set32(vector<unsigned char>& out, size_t offset, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            out[offset + i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    void Set64(vector<unsigned char>& out, size_t offset, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+            out[offset + i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+
+    uint32_t Get32(const unsigned char* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    uint64_t Get64(const unsigned char* data)
+    {
+        return Get32(data) | (static_cast<uint64_t>(Get32(data + 4)) << 32);
+    }
+
+    // Basic data format descriptor: a 4x4 block model with one sample per 64 bits of block
+    void PutDataFormatDescriptor(vector<unsigned char>& out, BlockFormat format)
+    {
+        const uint32_t KHR_DF_MODEL_BC1A = 128, KHR_DF_MODEL_BC3 = 130, KHR_DF_MODEL_BC7 = 134;
+        const uint32_t KHR_DF_PRIMARIES_BT709 = 1, KHR_DF_TRANSFER_LINEAR = 1;
+        const uint32_t KHR_DF_CHANNEL_BC3_ALPHA = 15;
+
+        const uint32_t model = format == BlockFormat::BC1 ? KHR_DF_MODEL_BC1A : format == BlockFormat::BC3 ? KHR_DF_MODEL_BC3 : KHR_DF_MODEL_BC7;
+        const uint32_t samples = format == BlockFormat::BC3 ? 2 : 1;
+        const uint32_t blockSize = 24 + 16 * samples;
+
+        Put32(out, 4 + blockSize);                          // dfdTotalSize
+        Put32(out, 0);                                      // vendorId 0 (Khronos), descriptorType 0 (basic)
+        Put32(out, 2 | (blockSize << 16));                  // versionNumber 2, descriptorBlockSize
+        Put32(out, model | (KHR_DF_PRIMARIES_BT709 << 8) | (KHR_DF_TRANSFER_LINEAR << 16));
+        Put32(out, 3 | (3 << 8));                           // texelBlockDimension: 4x4x1x1, stored minus one
+        Put32(out, static_cast<uint32_t>(BlockBytes(format))); // bytesPlane0
+        Put32(out, 0);                                      // bytesPlane4-7
+
+        if (format == BlockFormat::BC3)
+        {
+            // Alpha in the first 64 bits, color in the second
+            Put32(out, 0 | (63 << 16) | (KHR_DF_CHANNEL_BC3_ALPHA << 24));
+            Put32(out, 0);
+            Put32(out, 0);
+            Put32(out, 0xFFFFFFFF);
+            Put32(out, 64 | (63 << 16));
+        }
+        else
+            Put32(out, 0 | ((format == BlockFormat::BC7 ? 127u : 63u) << 16));
+        Put32(out, 0);                                      // samplePosition
+        Put32(out, 0);                                      // sampleLower
+        Put32(out, 0xFFFFFFFF);                             // sampleUpper
+    }
+
+    // available bytes of the file are in data; levels are checked against the full fileSize
+    bool Parse(const unsigned char* data, size_t available, size_t fileSize, Ktx2Texture& texture)
+    {
+        if (available < HEADER_SIZE || memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) != 0)
+            return false;
+
+        const uint32_t vkFormat = Get32(data + 12);
+        if (vkFormat == VK_FORMAT_BC1_RGB_UNORM_BLOCK)
+            texture.format = BlockFormat::BC1;
+        else if (vkFormat == VK_FORMAT_BC3_UNORM_BLOCK)
+            texture.format = BlockFormat::BC3;
+        else if (vkFormat == VK_FORMAT_BC7_UNORM_BLOCK)
+            texture.format = BlockFormat::BC7;
+        else
+            return false;
+
+        texture.width = static_cast<int>(Get32(data + 20));
+        texture.height = static_cast<int>(Get32(data + 24));
+        const uint32_t depth = Get32(data + 28), layers = Get32(data + 32), faces = Get32(data + 36);
+        const uint32_t levelCount = Get32(data + 40), supercompression = Get32(data + 44);
+        if (texture.width <= 0 || texture.height <= 0 || depth != 0 || layers != 0 || faces != 1 || levelCount == 0 ||
+            levelCount > 32 || supercompression != 0)
+            return false;
+        if (available < HEADER_SIZE + levelCount * LEVEL_ENTRY_SIZE)
+            return false;
+
+        texture.levels.assign(levelCount, Ktx2Level());
+        for (uint32_t level = 0; level < levelCount; ++level)
+        {
+            const unsigned char* entry = data + HEADER_SIZE + level * LEVEL_ENTRY_SIZE;
+            const uint64_t offset = Get64(entry), size = Get64(entry + 8);
+            const int width = max(texture.width >> level, 1), height = max(texture.height >> level, 1);
+            if (size != CompressedSize(texture.format, width, height) || offset + size > fileSize)
+                return false;
+            texture.levels[level].offset = static_cast<size_t>(offset);
+            texture.levels[level].size = static_cast<size_t>(size);
+        }
+
+        const uint32_t kvdOffset = Get32(data + 56), kvdLength = Get32(data + 60);
+        if (static_cast<size_t>(kvdOffset) + kvdLength > available)
+            return false;
+        texture.metadata.clear();
+        for (size_t position = kvdOffset; position + 4 <= static_cast<size_t>(kvdOffset) + kvdLength; )
+        {
+            const uint32_t length = Get32(data + position);
+            const char* pair = reinterpret_cast<const char*>(data + position + 4);
+            if (position + 4 + length > static_cast<size_t>(kvdOffset) + kvdLength)
+                return false;
+            const size_t keyLength = strnlen(pair, length);
+            if (keyLength == length)
+                return false;
+            string value(pair + keyLength + 1, length - keyLength - 1);
+            if (!value.empty() && value.back() == '\0')
+                value.pop_back();
+            texture.metadata.emplace_back(string(pair, keyLength), value);
+            position = Align(position + 4 + length, 4);
+        }
+        return true;
+    }
+}
+
+
+const string* Ktx2Texture::Find(const string& key) const
+{
+    for (const pair<string, string>& entry : metadata)
+    {
+        if (entry.first == key)
+            return &entry.second;
+    }
+    return nullptr;
+}
+
+// Header, level index, descriptor and key/value data, then the levels from the smallest to level 0 as KTX2 orders them
+//-----------------------------------------------------------------------------------------------------------------------
+bool WriteKtx2(const string& filename, const Ktx2Texture& texture, const vector<vector<unsigned char>>& levels)
+{
+    const uint32_t levelCount = static_cast<uint32_t>(levels.size());
+    vector<unsigned char> out(IDENTIFIER, IDENTIFIER + sizeof(IDENTIFIER));
+    Put32(out, VkFormat(texture.format));
+    Put32(out, 1);                                          // typeSize
+    Put32(out, static_cast<uint32_t>(texture.width));
+    Put32(out, static_cast<uint32_t>(texture.height));
+    Put32(out, 0);                                          // pixelDepth
+    Put32(out, 0);                                          // layerCount
+    Put32(out, 1);                                          // faceCount
+    Put32(out, levelCount);
+    Put32(out, 0);                                          // supercompressionScheme
+    out.resize(HEADER_SIZE + levelCount * LEVEL_ENTRY_SIZE, 0); // index and level index, filled in below
+
+    const size_t dfdOffset = out.size();
+    PutDataFormatDescriptor(out, texture.format);
+    const size_t kvdOffset = out.size();
+
+    vector<pair<string, string>> metadata = texture.metadata;
+    sort(metadata.begin(), metadata.end());
+    for (const pair<string, string>& entry : metadata)
+    {
+        Put32(out, static_cast<uint32_t>(entry.first.size() + entry.second.size() + 2));
+        out.insert(out.end(), entry.first.begin(), entry.first.end());
+        out.push_back(0);
+        out.insert(out.end(), entry.second.begin(), entry.second.end());
+        out.push_back(0);
+        out.resize(Align(out.size(), 4), 0);
+    }
+    const size_t kvdLength = out.size() - kvdOffset;
+
+    Set32(out, 48, static_cast<uint32_t>(dfdOffset));
+    Set32(out, 52, static_cast<uint32_t>(kvdOffset - dfdOffset));
+    Set32(out, 56, static_cast<uint32_t>(kvdOffset));
+    Set32(out, 60, static_cast<uint32_t>(kvdLength));
+    Set64(out, 64, 0);                                      // no supercompression global data
+    Set64(out, 72, 0);
+
+    const size_t alignment = BlockBytes(texture.format);
+    for (uint32_t level = levelCount; level-- > 0; )
+    {
+        out.resize(Align(out.size(), alignment), 0);
+        const size_t entry = HEADER_SIZE + level * LEVEL_ENTRY_SIZE;
+        Set64(out, entry, out.size());
+        Set64(out, entry + 8, levels[level].size());
+        Set64(out, entry + 16, levels[level].size());
+        out.insert(out.end(), levels[level].begin(), levels[level].end());
+    }
+
+    ofstream file(filename, ios::binary | ios::trunc);
+    file.write(reinterpret_cast<const char*>(out.data()), static_cast<streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
+
+bool ParseKtx2(const unsigned char* data, size_t size, Ktx2Texture& texture)
+{
+    return Parse(data, size, size, texture);
+}
+
+bool ReadKtx2Header(const string& filename, Ktx2Texture& texture)
+{
+    ifstream file(filename, ios::binary | ios::ate);
+    if (!file)
+        return false;
+    const size_t fileSize = static_cast<size_t>(file.tellg());
+    if (fileSize < HEADER_SIZE)
+        return false;
+
+    // The key/value data ends the prefix before the first level, wherever the header says it is
+    vector<unsigned char> prefix(HEADER_SIZE);
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(prefix.data()), HEADER_SIZE);
+    const uint32_t levelCount = Get32(prefix.data() + 40);
+    if (!file || levelCount > 32)
+        return false;
+    const size_t end = max<size_t>(HEADER_SIZE + levelCount * LEVEL_ENTRY_SIZE,
+        static_cast<size_t>(Get32(prefix.data() + 56)) + Get32(prefix.data() + 60));
+    if (end > fileSize)
+        return false;
+    prefix.resize(end);
+    file.read(reinterpret_cast<char*>(prefix.data() + HEADER_SIZE), end - HEADER_SIZE);
+    return file && Parse(prefix.data(), prefix.size(), fileSize, texture);
+}
@@ -0,0 +1,41 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * KTX2 files holding one block-compressed 2D texture with its mip chain, the container the texture bake writes. Only
+ * what the bake produces is read back: no supercompression, one layer and face, a BC1, BC3 or BC7 format.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef KTX2_FILE_H
+#define KTX2_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block_compression.h"
+
+struct Ktx2Level
+{
+    size_t offset = 0;  // from the start of the file
+    size_t size = 0;
+};
+
+struct Ktx2Texture
+{
+    BlockFormat format = BlockFormat::BC7;
+    int width = 0;
+    int height = 0;
+    std::vector<Ktx2Level> levels;                              // level 0 first
+    std::vector<std::pair<std::string, std::string>> metadata;  // key/value data
+
+    const std::string* Find(const std::string& key) const;
+};
+
+// Writes levels (level 0 first, each of the format's compressed size) and the key/value pairs in metadata
+bool WriteKtx2(const std::string& filename, const Ktx2Texture& texture, const std::vector<std::vector<unsigned char>>& levels);
+
+// Parses the header, level index and key/value data of a file read into memory; false if it is not one the bake wrote
+bool ParseKtx2(const unsigned char* data, size_t size, Ktx2Texture& texture);
+
+// Reads the first bytes of the file only, enough for ParseKtx2 to see the header and key/value data
+bool ReadKtx2Header(const std::string& filename, Ktx2Texture& texture);
+
+#endif
@@ -0,0 +1,116 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Mapped file
+// Description: Read-only memory mapping of a whole file through mmap, or CreateFileMapping on Windows.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <utility>          // swap
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>          // open
+#include <sys/mman.h>       // mmap, munmap, madvise
+#include <sys/stat.h>       // fstat
+#include <unistd.h>         // close
+#endif
+
+using namespace std; // Standard namespace
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    swap(mData, other.mData);
+    swap(mSize, other.mSize);
+#ifdef _WIN32
+    swap(mFile, other.mFile);
+    swap(mMapping, other.mMapping);
+#endif
+    other.Close();
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const string& filename)
+{
+    Close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    mFile = file;
+    mMapping = mapping;
+    mData = static_cast<const unsigned char*>(data);
+    mSize = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData)
+        UnmapViewOfFile(mData);
+    if (mMapping)
+        CloseHandle(mMapping);
+    if (mFile)
+        CloseHandle(mFile);
+    mData = nullptr;
+    mSize = 0;
+    mFile = mMapping = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const string& filename)
+{
+    Close();
+    const int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size <= 0)
+    {
+        close(file);
+        return false;
+    }
+
+    // The mapping keeps the file alive on its own, so the descriptor is closed at once
+    void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+    madvise(data, static_cast<size_t>(status.st_size), MADV_WILLNEED);
+    mData = static_cast<const unsigned char*>(data);
+    mSize = static_cast<size_t>(status.st_size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mData)
+        munmap(const_cast<unsigned char*>(mData), mSize);
+    mData = nullptr;
+    mSize = 0;
+}
+
+#endif
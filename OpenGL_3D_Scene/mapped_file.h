@@ -0,0 +1,39 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Mapped file: a whole file mapped read-only into memory, so its bytes are read straight from the page cache when they are
+ * first touched instead of being copied into a buffer up front. Move-only; the mapping is released with the object.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile() { Close(); }
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the whole file and asks the system to start reading it in; false for a missing or empty file
+    bool Open(const std::string& filename);
+    void Close();
+
+    bool IsOpen() const { return mData != nullptr; }
+    const unsigned char* Data() const { return mData; }
+    size_t Size() const { return mSize; }
+
+private:
+    const unsigned char* mData = nullptr;
+    size_t mSize = 0;
+#ifdef _WIN32
+    void* mFile = nullptr;      // HANDLEs of the file and its mapping object
+    void* mMapping = nullptr;
+#endif
+};
+
+#endif
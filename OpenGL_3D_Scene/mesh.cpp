@@ -0,0 +1,344 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Mesh building
+// Description: Vertex welding, index buffer creation and indexed draws for the scene meshes.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <cstring>          // memcmp, memcpy
+#include <cmath>            // lroundf
+#include <algorithm>        // min, max
+#include <unordered_map>
+#include <glm/gtx/transform.hpp>
+
+#include "mesh.h"
+#include "geometry_heap.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // Key into the weld table: points at one vertex of the source soup and compares its floats bitwise
+    struct VertexKey
+    {
+        const float* data;
+        int floatCount;
+
+        bool operator==(const VertexKey& other) const
+        {
+            return memcmp(data, other.data, sizeof(float) * floatCount) == 0;
+        }
+    };
+
+    // FNV-1a over the vertex bytes
+    struct VertexKeyHash
+    {
+        size_t operator()(const VertexKey& key) const
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(key.data);
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < sizeof(float) * key.floatCount; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+
+    const char* FormatName(VertexFormat format)
+    {
+        return format == VertexFormat::Quantized ? "quantized" : "float";
+    }
+
+    // Signed normalized value in [-1, 1] to a 10-bit field of GL_INT_2_10_10_10_REV
+    uint32_t PackSnorm10(float value)
+    {
+        int32_t packed = static_cast<int32_t>(lroundf(max(-1.0f, min(1.0f, value)) * 511.0f));
+        return static_cast<uint32_t>(packed) & 0x3FFu;
+    }
+
+    // Converts float source vertices to the layout's storage format. Quantized positions are stored relative to the
+    // mesh bounds; the returned matrix undoes that. Normals are pre-multiplied by the transpose of the same scale so
+    // that the normal matrix of (model * dequantize) still yields object-space normal directions.
+    vector<unsigned char> EncodeVertices(const IndexedMesh& data, const VertexLayout& layout, glm::mat4& dequantize)
+    {
+        const size_t vertexCount = data.VertexCount();
+        vector<unsigned char> encoded(vertexCount * layout.stride, 0);
+        dequantize = glm::mat4(1.0f);
+
+        if (layout.format == VertexFormat::Float)
+        {
+            memcpy(encoded.data(), data.vertices.data(), encoded.size());
+            return encoded;
+        }
+
+        glm::vec3 lower(data.vertices[0], data.vertices[1], data.vertices[2]);
+        glm::vec3 upper = lower;
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            const float* source = &data.vertices[v * data.floatsPerVertex];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                lower[axis] = min(lower[axis], source[axis]);
+                upper[axis] = max(upper[axis], source[axis]);
+            }
+        }
+        glm::vec3 center = (lower + upper) * 0.5f;
+        glm::vec3 extent = (upper - lower) * 0.5f;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (extent[axis] <= 0.0f)
+                extent[axis] = 1.0f; // flat axis: every value maps to 0
+        }
+        dequantize = glm::translate(center) * glm::scale(extent);
+
+        bool uvClamped = false;
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            const float* source = &data.vertices[v * data.floatsPerVertex];
+            unsigned char* target = &encoded[v * layout.stride];
+
+            int16_t position[4] = { 0, 0, 0, 0 };
+            for (int axis = 0; axis < 3; ++axis)
+                position[axis] = static_cast<int16_t>(lroundf((source[axis] - center[axis]) / extent[axis] * 32767.0f));
+            memcpy(target, position, sizeof(position));
+            target += sizeof(position);
+            source += 3;
+
+            if (layout.hasNormal)
+            {
+                glm::vec3 normal = glm::vec3(source[0], source[1], source[2]) * extent;
+                float length = glm::length(normal);
+                if (length > 0.0f)
+                    normal /= length;
+                uint32_t packed = PackSnorm10(normal.x) | (PackSnorm10(normal.y) << 10) | (PackSnorm10(normal.z) << 20);
+                memcpy(target, &packed, sizeof(packed));
+                target += sizeof(packed);
+                source += 3;
+            }
+
+            if (layout.hasUV)
+            {
+                uint16_t uv[2];
+                for (int i = 0; i < 2; ++i)
+                {
+                    float value = source[i];
+                    if (value < 0.0f || value > 1.0f)
+                    {
+                        uvClamped = true;
+                        value = max(0.0f, min(1.0f, value));
+                    }
+                    uv[i] = static_cast<uint16_t>(lroundf(value * 65535.0f));
+                }
+                memcpy(target, uv, sizeof(uv));
+                target += sizeof(uv);
+                source += 2;
+            }
+
+            if (layout.hasLayer)
+                *target = static_cast<unsigned char>(lroundf(max(0.0f, min(255.0f, source[0]))));
+        }
+
+        if (uvClamped)
+            cout << "WARNING: Texture coordinates outside [0, 1] were clamped by the quantized vertex layout" << endl;
+        return encoded;
+    }
+
+    glm::vec3 DequantizeScale(const GLMesh& mesh)
+    {
+        return glm::vec3(mesh.dequantize[0][0], mesh.dequantize[1][1], mesh.dequantize[2][2]);
+    }
+
+    // Object-space position to the space the mesh's vertices are stored in (the inverse of dequantize)
+    glm::vec3 StoredPosition(const GLMesh& mesh, const glm::vec3& position)
+    {
+        return (position - glm::vec3(mesh.dequantize[3])) / DequantizeScale(mesh);
+    }
+}
+
+
+// Build the attribute list of a layout
+//--------------------------------------
+VertexLayout VertexLayout::Create(VertexFormat format, bool hasNormal, bool hasUV, bool hasLayer)
+{
+    VertexLayout layout;
+    layout.format = format;
+    layout.hasNormal = hasNormal;
+    layout.hasUV = hasUV;
+    layout.hasLayer = hasLayer;
+
+    GLuint offset = 0;
+    if (format == VertexFormat::Quantized)
+    {
+        // 4 shorts keep the following attributes 4-byte aligned; the shader ignores the padding component
+        layout.attributes.push_back(Attribute{ ATTRIB_POSITION, 4, GL_SHORT, GL_TRUE, offset });
+        offset += 4 * sizeof(int16_t);
+        if (hasNormal)
+        {
+            layout.attributes.push_back(Attribute{ ATTRIB_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offset });
+            offset += sizeof(uint32_t);
+        }
+        if (hasUV)
+        {
+            layout.attributes.push_back(Attribute{ ATTRIB_UV, 2, GL_UNSIGNED_SHORT, GL_TRUE, offset });
+            offset += 2 * sizeof(uint16_t);
+        }
+        if (hasLayer)
+        {
+            // One byte read as an unnormalized float, padded to keep the stride 4-byte aligned
+            layout.attributes.push_back(Attribute{ ATTRIB_LAYER, 1, GL_UNSIGNED_BYTE, GL_FALSE, offset });
+            offset += 4;
+        }
+    }
+    else
+    {
+        layout.attributes.push_back(Attribute{ ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, offset });
+        offset += 3 * sizeof(float);
+        if (hasNormal)
+        {
+            layout.attributes.push_back(Attribute{ ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, offset });
+            offset += 3 * sizeof(float);
+        }
+        if (hasUV)
+        {
+            layout.attributes.push_back(Attribute{ ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, offset });
+            offset += 2 * sizeof(float);
+        }
+        if (hasLayer)
+        {
+            layout.attributes.push_back(Attribute{ ATTRIB_LAYER, 1, GL_FLOAT, GL_FALSE, offset });
+            offset += sizeof(float);
+        }
+    }
+    layout.stride = offset;
+    return layout;
+}
+
+// Create Vertex Attribute Pointers for every attribute of the layout
+//--------------------------------------------------------------------
+void VertexLayout::Apply() const
+{
+    for (const Attribute& attribute : attributes)
+    {
+        glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, stride, (void*)(size_t)attribute.offset);
+        glEnableVertexAttribArray(attribute.location);
+    }
+}
+
+
+// Tag every vertex of a soup with the texture layer of the index range it belongs to
+//-------------------------------------------------------------------------------------
+vector<float> AppendVertexLayer(const float* vertices, size_t vertexCount, int floatsPerVertex, const vector<RangeLayer>& layers)
+{
+    vector<float> tagged;
+    tagged.reserve(vertexCount * (floatsPerVertex + 1));
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        tagged.insert(tagged.end(), vertices + v * floatsPerVertex, vertices + (v + 1) * floatsPerVertex);
+
+        uint32_t layer = 0;
+        for (const RangeLayer& range : layers)
+        {
+            if (v >= range.range.first && v < range.range.first + range.range.count)
+            {
+                layer = range.layer;
+                break;
+            }
+        }
+        tagged.push_back(static_cast<float>(layer));
+    }
+    return tagged;
+}
+
+// Weld identical vertices: the first occurrence of each vertex keeps its data, later copies become indices
+//-----------------------------------------------------------------------------------------------------------
+IndexedMesh WeldVertices(const float* vertices, size_t vertexCount, int floatsPerVertex)
+{
+    IndexedMesh mesh;
+    mesh.floatsPerVertex = floatsPerVertex;
+    mesh.indices.reserve(vertexCount);
+
+    unordered_map<VertexKey, uint32_t, VertexKeyHash> unique;
+    unique.reserve(vertexCount);
+
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+        const float* vertex = vertices + i * floatsPerVertex;
+        VertexKey key = { vertex, floatsPerVertex };
+
+        auto found = unique.find(key);
+        if (found != unique.end())
+        {
+            mesh.indices.push_back(found->second);
+            continue;
+        }
+
+        uint32_t index = static_cast<uint32_t>(mesh.VertexCount());
+        unique.emplace(key, index);
+        mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + floatsPerVertex);
+        mesh.indices.push_back(index);
+    }
+
+    return mesh;
+}
+
+// Encode the vertices and place the mesh in the geometry heap; 16-bit indices are used whenever the vertex count allows it
+//-------------------------------------------------------------------------------------------------------------------
+void UploadIndexedMesh(GeometryHeap& heap, GLMesh& mesh, const IndexedMesh& data, const VertexLayout& layout, const char* name)
+{
+    vector<unsigned char> encoded = EncodeVertices(data, layout, mesh.dequantize);
+    mesh.layout = layout;
+
+    // Bounding box of the positions, taken into stored space by undoing the dequantize scale and offset
+    glm::vec3 lower(data.vertices[0], data.vertices[1], data.vertices[2]);
+    glm::vec3 upper = lower;
+    for (size_t v = 0; v < data.VertexCount(); ++v)
+    {
+        const glm::vec3 position(data.vertices[v * data.floatsPerVertex], data.vertices[v * data.floatsPerVertex + 1],
+            data.vertices[v * data.floatsPerVertex + 2]);
+        lower = glm::min(lower, position);
+        upper = glm::max(upper, position);
+    }
+    mesh.boundsCenter = StoredPosition(mesh, (lower + upper) * 0.5f);
+    mesh.boundsExtent = (upper - lower) * 0.5f / DequantizeScale(mesh);
+    mesh.nVertices = static_cast<GLuint>(data.VertexCount());
+    mesh.nIndices = static_cast<GLuint>(data.indices.size());
+    mesh.indexType = mesh.nVertices <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    size_t indexSize;
+    if (mesh.indexType == GL_UNSIGNED_SHORT)
+    {
+        vector<uint16_t> shortIndices(data.indices.begin(), data.indices.end());
+        indexSize = sizeof(uint16_t);
+        heap.Allocate(mesh, layout, encoded.data(), mesh.nVertices, shortIndices.data(), shortIndices.size(), mesh.indexType);
+    }
+    else
+    {
+        indexSize = sizeof(uint32_t);
+        heap.Allocate(mesh, layout, encoded.data(), mesh.nVertices, data.indices.data(), data.indices.size(), mesh.indexType);
+    }
+
+    // Report what indexing and the vertex format saved compared to the expanded float triangle soup
+    const size_t vertexSize = sizeof(float) * data.floatsPerVertex;
+    const size_t soupBytes = data.indices.size() * vertexSize;
+    const size_t indexedBytes = encoded.size() + data.indices.size() * indexSize;
+    cout << "INFO: Mesh " << name << ": " << data.indices.size() << " -> " << mesh.nVertices << " vertices, "
+        << vertexSize << " -> " << layout.stride << " bytes per vertex (" << FormatName(layout.format) << "), "
+        << soupBytes << " -> " << indexedBytes << " bytes (" << (mesh.indexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices, saved "
+        << (long long)soupBytes - (long long)indexedBytes << " bytes)" << endl;
+}
+
+// Copy the positions into stored space alongside the indices
+//------------------------------------------------------------
+void KeepOccluderGeometry(GLMesh& mesh, const IndexedMesh& data)
+{
+    auto geometry = make_shared<OccluderGeometry>();
+    geometry->positions.reserve(data.VertexCount());
+    for (size_t v = 0; v < data.VertexCount(); ++v)
+    {
+        const float* source = &data.vertices[v * data.floatsPerVertex];
+        geometry->positions.push_back(StoredPosition(mesh, glm::vec3(source[0], source[1], source[2])));
+    }
+    geometry->indices = data.indices;
+    mesh.occluder = geometry;
+}
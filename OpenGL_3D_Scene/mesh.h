@@ -0,0 +1,127 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Mesh data shared by the scene: GPU mesh handles and the build step that turns triangle soups into indexed geometry.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef MESH_H
+#define MESH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Vertex attribute locations shared by every shader program
+enum VertexAttributeLocation
+{
+    ATTRIB_POSITION = 0,
+    ATTRIB_NORMAL = 1,
+    ATTRIB_UV = 2,
+    ATTRIB_LAYER = 9,   // texture array layer offset; follows the per-draw and instance attributes (3-8)
+};
+
+// Storage format of the per-vertex attributes on the GPU
+enum class VertexFormat
+{
+    Float,      // 32-bit float position, normal and UV
+    Quantized,  // 16-bit normalized position (dequantized by the mesh's model matrix), GL_INT_2_10_10_10_REV normal, 16-bit normalized UV,
+                // 8-bit layer
+};
+
+// Describes an interleaved GPU vertex: which attributes it holds and the format and offset of each one.
+// Source data is always float: position (3), then normal (3), UV (2) and texture layer (1) when present.
+struct VertexLayout
+{
+    struct Attribute
+    {
+        GLuint location;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        GLuint offset;
+    };
+
+    VertexFormat format = VertexFormat::Float;
+    bool hasNormal = false;
+    bool hasUV = false;
+    bool hasLayer = false;
+    GLsizei stride = 0;
+    std::vector<Attribute> attributes;
+
+    static VertexLayout Create(VertexFormat format, bool hasNormal, bool hasUV, bool hasLayer = false);
+
+    int SourceFloatsPerVertex() const { return 3 + (hasNormal ? 3 : 0) + (hasUV ? 2 : 0) + (hasLayer ? 1 : 0); }
+
+    bool operator==(const VertexLayout& other) const
+    {
+        return format == other.format && hasNormal == other.hasNormal && hasUV == other.hasUV && hasLayer == other.hasLayer;
+    }
+
+    // Points the attributes of the bound VAO at the bound GL_ARRAY_BUFFER
+    void Apply() const;
+};
+
+// CPU copy of a mesh's triangles for the software occlusion rasterizer, in the same space as the stored positions
+struct OccluderGeometry
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+};
+
+// Stores the GL data relative to a given mesh: a handle to its ranges in the geometry heap
+struct GLMesh
+{
+    GLuint vao = 0;         // Vertex array object shared by every mesh of the same layout and heap page
+    GLint baseVertex = 0;   // First vertex of the mesh in the page's vertex buffer
+    GLuint firstIndex = 0;  // First index of the mesh in the page's index buffer, in units of indexType
+    GLuint nVertices = 0;   // Number of unique vertices of the mesh
+    GLuint nIndices = 0;    // Number of indices of the mesh
+    GLenum indexType = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when every index fits in 16 bits
+    VertexLayout layout;
+    glm::mat4 dequantize = glm::mat4(1.0f); // maps stored positions back to object space; multiply on the right of the model matrix
+    glm::vec3 boundsCenter = glm::vec3(0.0f); // axis-aligned box around the stored positions, so model * dequantize places it
+    glm::vec3 boundsExtent = glm::vec3(0.0f); // half size of that box
+    std::shared_ptr<const OccluderGeometry> occluder; // set for meshes that hide others; see KeepOccluderGeometry
+};
+
+// A contiguous run of indices drawn with one state setup, e.g. one textured part of a mesh
+struct IndexRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Indexed vertex data on the CPU: floatsPerVertex interleaved floats per vertex and a triangle list of indices
+struct IndexedMesh
+{
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    int floatsPerVertex = 0;
+
+    size_t VertexCount() const { return floatsPerVertex > 0 ? vertices.size() / floatsPerVertex : 0; }
+};
+
+// Layer offset given to the vertices of one index range of a triangle soup
+struct RangeLayer
+{
+    IndexRange range;
+    uint32_t layer;
+};
+
+// Appends a texture layer float to every vertex of a triangle soup: the layer of the range holding the vertex, else 0
+std::vector<float> AppendVertexLayer(const float* vertices, size_t vertexCount, int floatsPerVertex, const std::vector<RangeLayer>& layers);
+
+// Merges bit-identical vertices of a triangle soup and emits the index list that rebuilds it
+IndexedMesh WeldVertices(const float* vertices, size_t vertexCount, int floatsPerVertex);
+
+class GeometryHeap;
+
+// Encodes the vertices in the given layout and places them and the indices in the geometry heap. The mesh's VAO is
+// left bound so the caller can add instance attributes. Prints the savings against the float triangle soup.
+void UploadIndexedMesh(GeometryHeap& heap, GLMesh& mesh, const IndexedMesh& data, const VertexLayout& layout, const char* name);
+
+// Keeps the mesh's triangles on the CPU so draws of it occlude other draws. Call after UploadIndexedMesh.
+void KeepOccluderGeometry(GLMesh& mesh, const IndexedMesh& data);
+
+#endif
@@ -0,0 +1,321 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Mesh optimizer
+// Description: Vertex cache, overdraw and vertex fetch reordering for indexed meshes, applied when the meshes are built.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // stable_sort, find
+#include <cmath>            // powf
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const int FORSYTH_CACHE_SIZE = 32;      // LRU cache modelled by the Forsyth scoring function
+    const unsigned ANALYSIS_CACHE_SIZE = 16; // FIFO cache used to split clusters and to report statistics
+    const float OVERDRAW_THRESHOLD = 1.05f; // accepted ACMR growth when reordering clusters against overdraw
+
+    // Forsyth's vertex score: recently used vertices and vertices with few remaining triangles score highest
+    float VertexScore(int cachePosition, unsigned remaining)
+    {
+        if (remaining == 0)
+            return -1.0f;
+
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            // The last triangle's vertices get a fixed score so the next one does not simply reuse its edge
+            if (cachePosition < 3)
+                score = 0.75f;
+            else
+                score = powf(1.0f - float(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), 1.5f);
+        }
+        return score + 2.0f * powf(float(remaining), -0.5f);
+    }
+
+    // Number of vertices a FIFO cache has to transform for the given triangles
+    size_t CountCacheMisses(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize)
+    {
+        vector<size_t> insertedAt(vertexCount, 0); // miss count at the time the vertex entered the cache, 0 when never
+        size_t misses = 0;
+        for (size_t i = 0; i < indexCount; ++i)
+        {
+            uint32_t v = indices[i];
+            if (insertedAt[v] == 0 || misses + 1 - insertedAt[v] > cacheSize)
+                insertedAt[v] = ++misses;
+        }
+        return misses;
+    }
+
+    // Linear-speed vertex cache optimization (Tom Forsyth): greedily emit the best scoring triangle next to the cache
+    void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+    {
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0)
+            return;
+
+        // Triangles adjacent to each vertex; the first remaining[v] entries of a vertex's list are not yet emitted
+        vector<unsigned> remaining(vertexCount, 0);
+        for (size_t i = 0; i < indexCount; ++i)
+            remaining[indices[i]]++;
+
+        vector<size_t> adjacencyStart(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; ++v)
+            adjacencyStart[v + 1] = adjacencyStart[v] + remaining[v];
+
+        vector<uint32_t> adjacency(indexCount);
+        vector<size_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+        for (size_t i = 0; i < indexCount; ++i)
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+        vector<int> cachePosition(vertexCount, -1);
+        vector<float> vertexScore(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+            vertexScore[v] = VertexScore(-1, remaining[v]);
+
+        vector<float> triangleScore(triangleCount);
+        vector<bool> emitted(triangleCount, false);
+        for (size_t t = 0; t < triangleCount; ++t)
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+        vector<uint32_t> output;
+        output.reserve(indexCount);
+        vector<uint32_t> cache, newCache;
+        int best = -1;
+
+        for (size_t n = 0; n < triangleCount; ++n)
+        {
+            // Nothing adjacent to the cache: restart from the best triangle left anywhere in the mesh
+            if (best < 0)
+            {
+                float bestScore = -1.0f;
+                for (size_t t = 0; t < triangleCount; ++t)
+                {
+                    if (!emitted[t] && triangleScore[t] > bestScore)
+                    {
+                        bestScore = triangleScore[t];
+                        best = static_cast<int>(t);
+                    }
+                }
+            }
+
+            const uint32_t* triangle = indices + best * 3;
+            output.insert(output.end(), triangle, triangle + 3);
+            emitted[best] = true;
+
+            // Detach the triangle from its vertices
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = triangle[k];
+                uint32_t* first = &adjacency[adjacencyStart[v]];
+                uint32_t* last = first + remaining[v];
+                uint32_t* found = find(first, last, static_cast<uint32_t>(best));
+                if (found != last)
+                {
+                    *found = *(last - 1);
+                    remaining[v]--;
+                }
+            }
+
+            // Move the triangle's vertices to the front of the LRU cache
+            newCache.clear();
+            for (int k = 0; k < 3; ++k)
+            {
+                if (find(newCache.begin(), newCache.end(), triangle[k]) == newCache.end())
+                    newCache.push_back(triangle[k]);
+            }
+            const size_t fresh = newCache.size();
+            for (uint32_t v : cache)
+            {
+                if (find(newCache.begin(), newCache.begin() + fresh, v) == newCache.begin() + fresh)
+                    newCache.push_back(v);
+            }
+
+            // Rescore every vertex whose cache position changed, including the ones pushed out of the cache
+            for (size_t i = 0; i < newCache.size(); ++i)
+            {
+                uint32_t v = newCache[i];
+                cachePosition[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+                vertexScore[v] = VertexScore(cachePosition[v], remaining[v]);
+            }
+
+            // Rescore their triangles; the next triangle is the best one touching the cache
+            best = -1;
+            float bestScore = -1.0f;
+            for (size_t i = 0; i < newCache.size(); ++i)
+            {
+                uint32_t v = newCache[i];
+                for (size_t a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; ++a)
+                {
+                    uint32_t t = adjacency[a];
+                    triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                    if (i < FORSYTH_CACHE_SIZE && triangleScore[t] > bestScore)
+                    {
+                        bestScore = triangleScore[t];
+                        best = static_cast<int>(t);
+                    }
+                }
+            }
+
+            if (newCache.size() > FORSYTH_CACHE_SIZE)
+                newCache.resize(FORSYTH_CACHE_SIZE);
+            cache.swap(newCache);
+        }
+
+        copy(output.begin(), output.end(), indices);
+    }
+
+    glm::vec3 Position(const IndexedMesh& mesh, uint32_t vertex)
+    {
+        const float* data = &mesh.vertices[vertex * mesh.floatsPerVertex];
+        return glm::vec3(data[0], data[1], data[2]);
+    }
+
+    // Overdraw ordering (Sander et al.): split the cache-ordered triangles into clusters where the cache restarts
+    // anyway, then draw clusters that face outward from the mesh centre first so they occlude the rest
+    void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const IndexedMesh& mesh)
+    {
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount < 2)
+            return;
+
+        struct Cluster
+        {
+            size_t firstTriangle;
+            size_t triangleCount;
+            glm::vec3 centroid;
+            glm::vec3 normal;
+            float area;
+            float sortKey;
+        };
+
+        // A triangle with three cache misses starts a new cluster
+        vector<Cluster> clusters;
+        vector<size_t> insertedAt(mesh.VertexCount(), 0);
+        size_t misses = 0;
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            int triangleMisses = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                uint32_t v = indices[t * 3 + k];
+                if (insertedAt[v] == 0 || misses + 1 - insertedAt[v] > ANALYSIS_CACHE_SIZE)
+                {
+                    insertedAt[v] = ++misses;
+                    triangleMisses++;
+                }
+            }
+            if (clusters.empty() || triangleMisses == 3)
+                clusters.push_back(Cluster{ t, 0, glm::vec3(0.0f), glm::vec3(0.0f), 0.0f, 0.0f });
+            clusters.back().triangleCount++;
+        }
+        if (clusters.size() < 2)
+            return;
+
+        // Area-weighted centroid and normal of each cluster and of the whole range
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        for (Cluster& cluster : clusters)
+        {
+            for (size_t t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; ++t)
+            {
+                glm::vec3 a = Position(mesh, indices[t * 3]);
+                glm::vec3 b = Position(mesh, indices[t * 3 + 1]);
+                glm::vec3 c = Position(mesh, indices[t * 3 + 2]);
+                glm::vec3 normal = glm::cross(b - a, c - a);
+                float area = glm::length(normal);
+                cluster.centroid += (a + b + c) * (area / 3.0f);
+                cluster.normal += normal;
+                cluster.area += area;
+            }
+            meshCentroid += cluster.centroid;
+            meshArea += cluster.area;
+            if (cluster.area > 0.0f)
+                cluster.centroid /= cluster.area;
+        }
+        if (meshArea <= 0.0f)
+            return;
+        meshCentroid /= meshArea;
+
+        for (Cluster& cluster : clusters)
+        {
+            float length = glm::length(cluster.normal);
+            cluster.sortKey = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+        }
+        stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+        vector<uint32_t> sorted;
+        sorted.reserve(indexCount);
+        for (const Cluster& cluster : clusters)
+            sorted.insert(sorted.end(), indices + cluster.firstTriangle * 3, indices + (cluster.firstTriangle + cluster.triangleCount) * 3);
+
+        // Keep the new order only if it does not undo the vertex cache optimization
+        size_t before = CountCacheMisses(indices, indexCount, mesh.VertexCount(), ANALYSIS_CACHE_SIZE);
+        size_t after = CountCacheMisses(sorted.data(), indexCount, mesh.VertexCount(), ANALYSIS_CACHE_SIZE);
+        if (after <= before * OVERDRAW_THRESHOLD)
+            copy(sorted.begin(), sorted.end(), indices);
+    }
+
+    // Renumber vertices in the order the index buffer first touches them
+    void OptimizeVertexFetch(IndexedMesh& mesh)
+    {
+        const size_t vertexCount = mesh.VertexCount();
+        const uint32_t unused = 0xFFFFFFFFu;
+        vector<uint32_t> remap(vertexCount, unused);
+        uint32_t next = 0;
+        for (uint32_t& index : mesh.indices)
+        {
+            if (remap[index] == unused)
+                remap[index] = next++;
+            index = remap[index];
+        }
+
+        // Vertices no triangle references go last
+        for (uint32_t& target : remap)
+        {
+            if (target == unused)
+                target = next++;
+        }
+
+        vector<float> vertices(mesh.vertices.size());
+        for (size_t v = 0; v < vertexCount; ++v)
+            copy(mesh.vertices.begin() + v * mesh.floatsPerVertex, mesh.vertices.begin() + (v + 1) * mesh.floatsPerVertex,
+                vertices.begin() + remap[v] * mesh.floatsPerVertex);
+        mesh.vertices.swap(vertices);
+    }
+}
+
+
+// Simulate a FIFO post-transform cache over the whole index buffer
+//------------------------------------------------------------------
+VertexCacheStats AnalyzeVertexCache(const vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize)
+{
+    VertexCacheStats stats;
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    size_t misses = CountCacheMisses(indices.data(), indices.size(), vertexCount, cacheSize);
+    stats.acmr = float(misses) / (indices.size() / 3);
+    stats.atvr = float(misses) / vertexCount;
+    return stats;
+}
+
+// Run the vertex cache, overdraw and vertex fetch passes
+//--------------------------------------------------------
+void OptimizeMesh(IndexedMesh& mesh, const char* name)
+{
+    const size_t vertexCount = mesh.VertexCount();
+
+    VertexCacheStats before = AnalyzeVertexCache(mesh.indices, vertexCount, ANALYSIS_CACHE_SIZE);
+
+    OptimizeVertexCache(mesh.indices.data(), mesh.indices.size(), vertexCount);
+    OptimizeOverdraw(mesh.indices.data(), mesh.indices.size(), mesh);
+    OptimizeVertexFetch(mesh);
+
+    VertexCacheStats after = AnalyzeVertexCache(mesh.indices, vertexCount, ANALYSIS_CACHE_SIZE);
+    cout << "INFO: Mesh " << name << " optimized: ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << endl;
+}
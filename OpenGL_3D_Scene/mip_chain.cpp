@@ -0,0 +1,395 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Mip chains
+// Description: Separable, gamma-correct image scaling and mip chain generation on the CPU with SSE and AVX kernels.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // min, max, min_element, max_element
+#include <cmath>            // ceil, floor, pow, sin, sqrt, fabs
+#include <cstring>          // memcpy, strcmp
+
+#include "mip_chain.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_SSE2 1
+#include <emmintrin.h>      // SSE2 intrinsics
+#endif
+#ifdef __AVX2__
+#define MIP_AVX2 1
+#include <immintrin.h>      // AVX intrinsics
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const double PI = 3.14159265358979323846;
+    const int BAND_ROWS = 32;       // output rows a band filters; bands are the unit of work spread over the pool
+    const int COARSE_STEPS = 4096;  // entries of the table that narrows down the search for an encoded value
+
+    // Conversion of 8-bit values to linear floats and back. Encoding rounds to the nearest code in the encoded space,
+    // by finding the codes whose rounding thresholds lie below the value: a coarse table gives a lower bound and a
+    // short walk over the thresholds the rest.
+    struct ColorTable
+    {
+        float decode[256];
+        float threshold[255];       // threshold[k]: smallest linear value encoding to k + 1
+        unsigned char coarse[COARSE_STEPS + 1];
+
+        explicit ColorTable(bool srgb)
+        {
+            for (int k = 0; k < 256; ++k)
+                decode[k] = static_cast<float>(Decode(k / 255.0, srgb));
+            for (int k = 0; k < 255; ++k)
+                threshold[k] = static_cast<float>(Decode((k + 0.5) / 255.0, srgb));
+            int code = 0;
+            for (int step = 0; step <= COARSE_STEPS; ++step)
+            {
+                while (code < 255 && threshold[code] <= static_cast<float>(step) / COARSE_STEPS)
+                    ++code;
+                coarse[step] = static_cast<unsigned char>(code);
+            }
+        }
+
+        static double Decode(double value, bool srgb)
+        {
+            if (!srgb)
+                return value;
+            return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+        }
+
+        unsigned char Encode(float value) const
+        {
+            if (!(value > 0.0f))
+                return 0; // negative lobes and NaN
+            if (value >= 1.0f)
+                return 255;
+            int code = coarse[static_cast<int>(value * COARSE_STEPS)];
+            while (code < 255 && value >= threshold[code])
+                ++code;
+            return static_cast<unsigned char>(code);
+        }
+    };
+
+    const ColorTable& Table(bool srgb)
+    {
+        static const ColorTable linearTable(false);
+        static const ColorTable srgbTable(true);
+        return srgb ? srgbTable : linearTable;
+    }
+
+    double Sinc(double x)
+    {
+        if (fabs(x) < 1e-9)
+            return 1.0;
+        x *= PI;
+        return sin(x) / x;
+    }
+
+    // Modified Bessel function of the first kind, order 0, by its power series
+    double BesselI0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12)
+                break;
+        }
+        return sum;
+    }
+
+    // Kernels in units of output texels when shrinking, of source texels when enlarging
+    struct Kernel
+    {
+        double radius;
+        double (*weight)(double t);
+    };
+
+    double BoxWeight(double t)
+    {
+        return t >= -0.5 && t < 0.5 ? 1.0 : 0.0;
+    }
+
+    double TentWeight(double t)
+    {
+        return max(1.0 - fabs(t), 0.0);
+    }
+
+    double KaiserWeight(double t)
+    {
+        const double width = 3.0, alpha = 4.0;
+        if (fabs(t) >= width)
+            return 0.0;
+        const double x = t / width;
+        return Sinc(t) * BesselI0(alpha * sqrt(1.0 - x * x)) / BesselI0(alpha);
+    }
+
+    double LanczosWeight(double t)
+    {
+        return fabs(t) < 3.0 ? Sinc(t) * Sinc(t / 3.0) : 0.0;
+    }
+
+    Kernel FilterKernel(MipFilter filter, bool enlarging)
+    {
+        switch (filter)
+        {
+        case MipFilter::Box: return enlarging ? Kernel{ 1.0, TentWeight } : Kernel{ 0.5, BoxWeight };
+        case MipFilter::Lanczos: return Kernel{ 3.0, LanczosWeight };
+        default: return Kernel{ 3.0, KaiserWeight };
+        }
+    }
+
+    // Source texels and normalized weights of every output texel along one axis. Every output gets the same number of
+    // taps, the widest footprint's, with zero weights padding the narrower ones, so the kernels need no per-texel counts.
+    struct Taps
+    {
+        int count = 0;
+        vector<int> index;      // count per output texel, clamped to the image's edges
+        vector<float> weight;
+    };
+
+    Taps ComputeTaps(int size, int targetSize, const Kernel& kernel)
+    {
+        const double ratio = static_cast<double>(size) / targetSize;
+        const double scale = max(ratio, 1.0);
+        const double support = kernel.radius * scale;
+
+        // Footprints first: the first and last source texel with a nonzero weight
+        vector<int> first(targetSize), last(targetSize);
+        Taps taps;
+        for (int x = 0; x < targetSize; ++x)
+        {
+            const double center = (x + 0.5) * ratio - 0.5;
+            first[x] = static_cast<int>(floor(center - support));
+            last[x] = static_cast<int>(ceil(center + support));
+            while (first[x] < last[x] && kernel.weight((first[x] - center) / scale) == 0.0)
+                ++first[x];
+            while (last[x] > first[x] && kernel.weight((last[x] - center) / scale) == 0.0)
+                --last[x];
+            taps.count = max(taps.count, last[x] - first[x] + 1);
+        }
+
+        taps.index.assign(static_cast<size_t>(targetSize) * taps.count, 0);
+        taps.weight.assign(static_cast<size_t>(targetSize) * taps.count, 0.0f);
+        for (int x = 0; x < targetSize; ++x)
+        {
+            const double center = (x + 0.5) * ratio - 0.5;
+            const int count = last[x] - first[x] + 1;
+            vector<double> weights(count);
+            double sum = 0.0;
+            for (int k = 0; k < count; ++k)
+            {
+                weights[k] = kernel.weight((first[x] + k - center) / scale);
+                sum += weights[k];
+            }
+            for (int k = 0; k < taps.count; ++k)
+            {
+                const size_t tap = static_cast<size_t>(x) * taps.count + k;
+                taps.index[tap] = min(max(first[x] + min(k, count - 1), 0), size - 1);
+                taps.weight[tap] = k < count ? static_cast<float>(weights[k] / sum) : 0.0f;
+            }
+        }
+        return taps;
+    }
+
+    // One source row as linear RGBA floats; images without alpha get an opaque one
+    void DecodeRow(const unsigned char* row, int width, int channels, const ColorTable& color, float* out)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const unsigned char* texel = row + x * channels;
+            out[x * 4 + 0] = color.decode[texel[0]];
+            out[x * 4 + 1] = color.decode[texel[1]];
+            out[x * 4 + 2] = color.decode[texel[2]];
+            out[x * 4 + 3] = channels == 4 ? texel[3] / 255.0f : 1.0f;
+        }
+    }
+
+    void EncodeRow(const float* row, int width, int channels, const ColorTable& color, unsigned char* out)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const float* texel = row + x * 4;
+            unsigned char* target = out + x * channels;
+            target[0] = color.Encode(texel[0]);
+            target[1] = color.Encode(texel[1]);
+            target[2] = color.Encode(texel[2]);
+            if (channels == 4)
+                target[3] = static_cast<unsigned char>(min(max(texel[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    // Horizontal pass: each output texel is a weighted sum of whole RGBA texels, one SSE register each, or two output
+    // texels side by side in an AVX register
+    void FilterRow(const float* row, const Taps& columns, int targetWidth, float* out)
+    {
+        int x = 0;
+#if defined(MIP_AVX2)
+        for (; x + 2 <= targetWidth; x += 2)
+        {
+            const int* index = &columns.index[static_cast<size_t>(x) * columns.count];
+            const float* weight = &columns.weight[static_cast<size_t>(x) * columns.count];
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < columns.count; ++k)
+            {
+                const __m256 texels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(row + index[k] * 4)),
+                    _mm_loadu_ps(row + index[columns.count + k] * 4), 1);
+                const __m256 weights = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weight[k])),
+                    _mm_set1_ps(weight[columns.count + k]), 1);
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(texels, weights));
+            }
+            _mm256_storeu_ps(out + x * 4, sum);
+        }
+#endif
+        for (; x < targetWidth; ++x)
+        {
+            const int* index = &columns.index[static_cast<size_t>(x) * columns.count];
+            const float* weight = &columns.weight[static_cast<size_t>(x) * columns.count];
+#if defined(MIP_SSE2)
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < columns.count; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + index[k] * 4), _mm_set1_ps(weight[k])));
+            _mm_storeu_ps(out + x * 4, sum);
+#else
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int k = 0; k < columns.count; ++k)
+            {
+                for (int c = 0; c < 4; ++c)
+                    sum[c] += row[index[k] * 4 + c] * weight[k];
+            }
+            memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+        }
+    }
+
+    // Vertical pass: whole filtered rows scaled and summed, so every lane of a register is useful
+    void FilterColumn(const float* const* rows, const float* weight, int count, int floats, float* out)
+    {
+        int i = 0;
+#if defined(MIP_AVX2)
+        for (; i + 8 <= floats; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < count; ++k)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(weight[k])));
+            _mm256_storeu_ps(out + i, sum);
+        }
+#endif
+#if defined(MIP_SSE2)
+        for (; i + 4 <= floats; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < count; ++k)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(weight[k])));
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif
+        for (; i < floats; ++i)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < count; ++k)
+                sum += rows[k][i] * weight[k];
+            out[i] = sum;
+        }
+    }
+}
+
+
+const char* MipFilterName(MipFilter filter)
+{
+    switch (filter)
+    {
+    case MipFilter::Box: return "box";
+    case MipFilter::Lanczos: return "lanczos";
+    default: return "kaiser";
+    }
+}
+
+bool ParseMipFilter(const char* name, MipFilter& filter)
+{
+    const MipFilter filters[] = { MipFilter::Box, MipFilter::Kaiser, MipFilter::Lanczos };
+    for (MipFilter candidate : filters)
+    {
+        if (strcmp(name, MipFilterName(candidate)) == 0)
+        {
+            filter = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Filter bands of output rows: per output row, sum the decoded source rows under the kernel vertically at full width and
+// filter that one row horizontally. Vertical first keeps the larger share of the work in the contiguous, wide pass. The
+// footprints of consecutive rows only move forward, so the decoded rows live in a ring as deep as one footprint, small
+// enough to stay in cache, and each is decoded once per band.
+//--------------------------------------------------------------------------------------------------------------------------
+void ResampleImage(const unsigned char* source, int width, int height, int channels, unsigned char* target, int targetWidth,
+    int targetHeight, MipFilter filter, bool srgb, ThreadPool* pool)
+{
+    const Taps columns = ComputeTaps(width, targetWidth, FilterKernel(filter, targetWidth > width));
+    const Taps rows = ComputeTaps(height, targetHeight, FilterKernel(filter, targetHeight > height));
+    const ColorTable& color = Table(srgb);
+    const size_t sourceStride = static_cast<size_t>(width) * channels;
+    const size_t targetStride = static_cast<size_t>(targetWidth) * channels;
+    const size_t decodedStride = static_cast<size_t>(width) * 4;
+
+    auto band = [&](size_t b) {
+        const int y0 = static_cast<int>(b) * BAND_ROWS, y1 = min(y0 + BAND_ROWS, targetHeight);
+        vector<float> ring(static_cast<size_t>(rows.count) * decodedStride);
+        vector<const float*> taps(rows.count);
+        vector<float> column(decodedStride), sum(static_cast<size_t>(targetWidth) * 4);
+        int decodedTo = -1;     // last source row in the ring; row r sits in slot r % rows.count
+        for (int y = y0; y < y1; ++y)
+        {
+            const int* index = &rows.index[static_cast<size_t>(y) * rows.count];
+            const int firstRow = *min_element(index, index + rows.count), lastRow = *max_element(index, index + rows.count);
+            for (int row = max(decodedTo + 1, firstRow); row <= lastRow; ++row)
+                DecodeRow(source + row * sourceStride, width, channels, color, ring.data() + (row % rows.count) * decodedStride);
+            decodedTo = lastRow;
+
+            for (int k = 0; k < rows.count; ++k)
+                taps[k] = ring.data() + (index[k] % rows.count) * decodedStride;
+            FilterColumn(taps.data(), &rows.weight[static_cast<size_t>(y) * rows.count], rows.count, static_cast<int>(decodedStride),
+                column.data());
+            FilterRow(column.data(), columns, targetWidth, sum.data());
+            EncodeRow(sum.data(), targetWidth, channels, color, target + y * targetStride);
+        }
+    };
+
+    const size_t bands = (targetHeight + BAND_ROWS - 1) / BAND_ROWS;
+    if (pool)
+        pool->ParallelFor(bands, band);
+    else
+    {
+        for (size_t b = 0; b < bands; ++b)
+            band(b);
+    }
+}
+
+// Each level is filtered from the one before, so every step is a 2:1 reduction over the kernel's own footprint
+//---------------------------------------------------------------------------------------------------------------
+vector<vector<unsigned char>> BuildMipChain(const unsigned char* source, int sourceWidth, int sourceHeight, int channels,
+    int width, int height, MipFilter filter, bool srgb, ThreadPool* pool)
+{
+    vector<vector<unsigned char>> levels(1);
+    if (sourceWidth == width && sourceHeight == height)
+        levels[0].assign(source, source + static_cast<size_t>(width) * height * channels);
+    else
+    {
+        levels[0].resize(static_cast<size_t>(width) * height * channels);
+        ResampleImage(source, sourceWidth, sourceHeight, channels, levels[0].data(), width, height, filter, srgb, pool);
+    }
+
+    for (int levelWidth = width, levelHeight = height; levelWidth > 1 || levelHeight > 1; )
+    {
+        const int nextWidth = max(levelWidth >> 1, 1), nextHeight = max(levelHeight >> 1, 1);
+        levels.emplace_back(static_cast<size_t>(nextWidth) * nextHeight * channels);
+        ResampleImage(levels[levels.size() - 2].data(), levelWidth, levelHeight, channels, levels.back().data(), nextWidth, nextHeight,
+            filter, srgb, pool);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+    return levels;
+}
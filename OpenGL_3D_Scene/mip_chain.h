@@ -0,0 +1,37 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Mip chains built on the CPU, for the decoded textures and the texture bake alike. Scaling is separable and polyphase:
+ * every output texel of a row or column has its own list of source texels and weights, computed once per axis, and the
+ * passes run four channels at a time with SSE (the vertical pass eight at a time when built with AVX2). Color channels
+ * of sRGB images are filtered as linear light and encoded back with exact rounding; alpha is always linear.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <vector>
+
+#include "thread_pool.h"
+
+enum class MipFilter
+{
+    Box,        // 2x2 average for even sizes; cheapest, and the softest mips
+    Kaiser,     // Kaiser-windowed sinc of radius 3 (alpha 4): sharp with little ringing
+    Lanczos     // Lanczos 3: the sharpest, with visible ringing at hard edges
+};
+
+const char* MipFilterName(MipFilter filter);
+
+// Parses box, kaiser or lanczos; false for anything else
+bool ParseMipFilter(const char* name, MipFilter& filter);
+
+// Scales an image of 3 or 4 channels into target, which must hold targetWidth * targetHeight * channels bytes. The box
+// filter scales up through a tent filter instead, so enlarging is bilinear rather than nearest-neighbor. Bands of rows
+// are spread over pool when one is given; without one the caller does all the work, as a pool task must.
+void ResampleImage(const unsigned char* source, int width, int height, int channels, unsigned char* target, int targetWidth,
+    int targetHeight, MipFilter filter, bool srgb, ThreadPool* pool);
+
+// Level 0 is source scaled to width x height (copied when it has that size already); each further level halves the one
+// before, rounding down, until 1x1. Levels are tightly packed rows of channels bytes per texel.
+std::vector<std::vector<unsigned char>> BuildMipChain(const unsigned char* source, int sourceWidth, int sourceHeight, int channels,
+    int width, int height, MipFilter filter, bool srgb, ThreadPool* pool);
+
+#endif
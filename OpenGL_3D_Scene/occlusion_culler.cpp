@@ -0,0 +1,284 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Occlusion culler
+// Description: Tiled depth-only software rasterizer for occluders and the box-versus-depth test of queued draws.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // min, max
+#include <cmath>            // floor, ceil, fabs
+
+#include "occlusion_culler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2 1
+#include <emmintrin.h>      // SSE2 intrinsics
+#endif
+#ifdef __AVX2__
+#define OCCLUSION_AVX2 1
+#include <immintrin.h>      // AVX intrinsics
+#endif
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const int TILES_X = OcclusionCuller::WIDTH / OcclusionCuller::TILE_WIDTH;
+    const int TILES_Y = OcclusionCuller::HEIGHT / OcclusionCuller::TILE_HEIGHT;
+    const float MIN_AREA = 1e-6f;     // twice the pixel area under which a triangle covers no pixel center worth rasterizing
+    const float DEPTH_BIAS = 1e-4f;   // keeps draws touching or coplanar with an occluder visible
+
+    // Signed distance of a clip-space vertex from the near plane (z = -w)
+    float NearDistance(const glm::vec4& v)
+    {
+        return v.z + v.w;
+    }
+}
+
+
+OcclusionCuller::OcclusionCuller(ThreadPool& pool)
+    : mPool(pool), mDepth(WIDTH * HEIGHT, 1.0f)
+{
+}
+
+void OcclusionCuller::Begin(const glm::mat4& viewProjection)
+{
+    mViewProjection = viewProjection;
+    mTriangles.clear();
+}
+
+// Transform to clip space, then clip against the near plane only; the other sides are handled by the pixel bounds
+//----------------------------------------------------------------------------------------------------------------
+void OcclusionCuller::AddOccluder(const OccluderGeometry& geometry, const glm::mat4& model)
+{
+    const glm::mat4 transform = mViewProjection * model;
+    for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3)
+    {
+        AddTriangle(transform * glm::vec4(geometry.positions[geometry.indices[i]], 1.0f),
+            transform * glm::vec4(geometry.positions[geometry.indices[i + 1]], 1.0f),
+            transform * glm::vec4(geometry.positions[geometry.indices[i + 2]], 1.0f));
+    }
+}
+
+void OcclusionCuller::AddTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+{
+    // Sutherland-Hodgman against one plane: a triangle becomes at most a quad
+    const glm::vec4 input[3] = { a, b, c };
+    glm::vec4 clipped[4];
+    int count = 0;
+    for (int v = 0; v < 3; ++v)
+    {
+        const glm::vec4& current = input[v];
+        const glm::vec4& next = input[(v + 1) % 3];
+        const float currentDistance = NearDistance(current);
+        const float nextDistance = NearDistance(next);
+        if (currentDistance >= 0.0f)
+            clipped[count++] = current;
+        if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+            clipped[count++] = current + (next - current) * (currentDistance / (currentDistance - nextDistance));
+    }
+    if (count < 3)
+        return;
+
+    // Clip space to pixel coordinates and [0, 1] depth
+    glm::vec3 screen[4];
+    for (int v = 0; v < count; ++v)
+    {
+        const glm::vec3 ndc = glm::vec3(clipped[v]) / clipped[v].w;
+        screen[v] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+    }
+    for (int v = 2; v < count; ++v)
+        AddScreenTriangle(screen[0], screen[v - 1], screen[v]);
+}
+
+// Set up the edge functions and the depth plane once, so the tiles only evaluate them
+//-------------------------------------------------------------------------------------
+void OcclusionCuller::AddScreenTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    const glm::vec3* vertices[3] = { &a, &b, &c };
+    Triangle triangle;
+
+    // Edge k is opposite vertex k, so its value at a point is that vertex's barycentric weight times twice the area
+    for (int k = 0; k < 3; ++k)
+    {
+        const glm::vec3& from = *vertices[(k + 1) % 3];
+        const glm::vec3& to = *vertices[(k + 2) % 3];
+        triangle.edgeA[k] = from.y - to.y;
+        triangle.edgeB[k] = to.x - from.x;
+        triangle.edgeC[k] = -(triangle.edgeA[k] * from.x + triangle.edgeB[k] * from.y);
+    }
+    const float area = triangle.edgeA[0] * a.x + triangle.edgeB[0] * a.y + triangle.edgeC[0];
+    if (fabs(area) < MIN_AREA)
+        return;
+
+    triangle.depthA = (triangle.edgeA[0] * a.z + triangle.edgeA[1] * b.z + triangle.edgeA[2] * c.z) / area;
+    triangle.depthB = (triangle.edgeB[0] * a.z + triangle.edgeB[1] * b.z + triangle.edgeB[2] * c.z) / area;
+    triangle.depthC = (triangle.edgeC[0] * a.z + triangle.edgeC[1] * b.z + triangle.edgeC[2] * c.z) / area;
+
+    // No backface culling: both windings occlude, so flip clockwise triangles to keep the inside positive
+    if (area < 0.0f)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            triangle.edgeA[k] = -triangle.edgeA[k];
+            triangle.edgeB[k] = -triangle.edgeB[k];
+            triangle.edgeC[k] = -triangle.edgeC[k];
+        }
+    }
+
+    // Pixels whose centers (x + 0.5, y + 0.5) can fall inside
+    triangle.minX = max(0, (int)ceil(min({ a.x, b.x, c.x }) - 0.5f));
+    triangle.minY = max(0, (int)ceil(min({ a.y, b.y, c.y }) - 0.5f));
+    triangle.maxX = min(WIDTH - 1, (int)floor(max({ a.x, b.x, c.x }) - 0.5f));
+    triangle.maxY = min(HEIGHT - 1, (int)floor(max({ a.y, b.y, c.y }) - 0.5f));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    mTriangles.push_back(triangle);
+}
+
+void OcclusionCuller::Rasterize()
+{
+    fill(mDepth.begin(), mDepth.end(), 1.0f);
+    if (mTriangles.empty())
+        return;
+
+    // Tiles own disjoint pixels, so they need no synchronization
+    mPool.ParallelFor(TILES_X * TILES_Y, [this](size_t tile) { RasterizeTile((int)tile); });
+}
+
+// Every triangle overlapping the tile, row by row; the kernels keep the nearest depth of the covered pixel centers
+//-----------------------------------------------------------------------------------------------------------------
+void OcclusionCuller::RasterizeTile(int tile)
+{
+    const int tileMinX = (tile % TILES_X) * TILE_WIDTH;
+    const int tileMinY = (tile / TILES_X) * TILE_HEIGHT;
+    const int tileMaxX = tileMinX + TILE_WIDTH - 1;
+    const int tileMaxY = tileMinY + TILE_HEIGHT - 1;
+
+    for (const Triangle& triangle : mTriangles)
+    {
+        const int minX = max(triangle.minX, tileMinX);
+        const int maxX = min(triangle.maxX, tileMaxX);
+        const int minY = max(triangle.minY, tileMinY);
+        const int maxY = min(triangle.maxY, tileMaxY);
+        if (minX > maxX || minY > maxY)
+            continue;
+
+        for (int y = minY; y <= maxY; ++y)
+        {
+            const float py = y + 0.5f;
+            const float row0 = triangle.edgeB[0] * py + triangle.edgeC[0];
+            const float row1 = triangle.edgeB[1] * py + triangle.edgeC[1];
+            const float row2 = triangle.edgeB[2] * py + triangle.edgeC[2];
+            const float rowDepth = triangle.depthB * py + triangle.depthC;
+            float* depth = &mDepth[y * WIDTH];
+            int x = minX;
+
+            // The vector loops start on a lane-aligned pixel; the extra pixels stay inside the tile and fail the edge test
+#if defined(OCCLUSION_AVX2)
+            const __m256 laneX = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            const __m256 zero8 = _mm256_setzero_ps();
+            for (x = minX & ~7; x <= maxX; x += 8)
+            {
+                const __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneX);
+                const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(triangle.edgeA[0])), _mm256_set1_ps(row0));
+                const __m256 e1 = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(triangle.edgeA[1])), _mm256_set1_ps(row1));
+                const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(triangle.edgeA[2])), _mm256_set1_ps(row2));
+                const __m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero8, _CMP_GE_OQ),
+                    _mm256_and_ps(_mm256_cmp_ps(e1, zero8, _CMP_GE_OQ), _mm256_cmp_ps(e2, zero8, _CMP_GE_OQ)));
+                if (_mm256_movemask_ps(inside) == 0)
+                    continue;
+                const __m256 z = _mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(triangle.depthA)), _mm256_set1_ps(rowDepth));
+                const __m256 old = _mm256_loadu_ps(depth + x);
+                _mm256_storeu_ps(depth + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+            }
+#elif defined(OCCLUSION_SSE2)
+            const __m128 laneX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+            const __m128 zero4 = _mm_setzero_ps();
+            for (x = minX & ~3; x <= maxX; x += 4)
+            {
+                const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneX);
+                const __m128 e0 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.edgeA[0])), _mm_set1_ps(row0));
+                const __m128 e1 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.edgeA[1])), _mm_set1_ps(row1));
+                const __m128 e2 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.edgeA[2])), _mm_set1_ps(row2));
+                const __m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero4), _mm_and_ps(_mm_cmpge_ps(e1, zero4), _mm_cmpge_ps(e2, zero4)));
+                if (_mm_movemask_ps(inside) == 0)
+                    continue;
+                const __m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(triangle.depthA)), _mm_set1_ps(rowDepth));
+                const __m128 old = _mm_loadu_ps(depth + x);
+                const __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(depth + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#endif
+            for (; x <= maxX; ++x)
+            {
+                const float px = x + 0.5f;
+                if (triangle.edgeA[0] * px + row0 >= 0.0f && triangle.edgeA[1] * px + row1 >= 0.0f && triangle.edgeA[2] * px + row2 >= 0.0f)
+                    depth[x] = min(depth[x], triangle.depthA * px + rowDepth);
+            }
+        }
+    }
+}
+
+void OcclusionCuller::TestBoxes(const BoxBatch& boxes, vector<uint8_t>& visible) const
+{
+    for (size_t i = 0; i < boxes.Size(); ++i)
+    {
+        if (visible[i] && !BoxVisible(boxes, i))
+            visible[i] = 0;
+    }
+}
+
+// A box is hidden when every pixel its screen rectangle touches holds an occluder nearer than the box's nearest point
+//---------------------------------------------------------------------------------------------------------------------
+bool OcclusionCuller::BoxVisible(const BoxBatch& boxes, size_t i) const
+{
+    const glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+    const glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+
+    glm::vec2 lower(WIDTH, HEIGHT), upper(0.0f);
+    float nearest = 1.0f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const glm::vec3 sign((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+        const glm::vec4 clip = mViewProjection * glm::vec4(center + sign * extent, 1.0f);
+
+        // Boxes reaching the near plane cover the viewer; the rectangle of their projection is meaningless
+        if (NearDistance(clip) <= 0.0f)
+            return true;
+
+        const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        const glm::vec2 pixel((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT);
+        lower = glm::min(lower, pixel);
+        upper = glm::max(upper, pixel);
+        nearest = min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+
+    // Every pixel the rectangle overlaps, grown by one to cover the centers the occluders may have missed at their edges
+    const int minX = max(0, (int)floor(lower.x) - 1);
+    const int minY = max(0, (int)floor(lower.y) - 1);
+    const int maxX = min(WIDTH - 1, (int)ceil(upper.x));
+    const int maxY = min(HEIGHT - 1, (int)ceil(upper.y));
+    if (minX > maxX || minY > maxY)
+        return true; // off screen: the frustum test keeps the final say
+
+    const float threshold = nearest - DEPTH_BIAS;
+    for (int y = minY; y <= maxY; ++y)
+    {
+        const float* depth = &mDepth[y * WIDTH];
+        int x = minX;
+#ifdef OCCLUSION_SSE2
+        const __m128 limit = _mm_set1_ps(threshold);
+        for (; x + 4 <= maxX + 1; x += 4)
+        {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(depth + x), limit)) != 0)
+                return true;
+        }
+#endif
+        for (; x <= maxX; ++x)
+        {
+            if (depth[x] >= threshold)
+                return true;
+        }
+    }
+    return false;
+}
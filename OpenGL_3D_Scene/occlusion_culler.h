@@ -0,0 +1,63 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Software occlusion culling: the large occluders of a frame are rasterized on the CPU into a small depth-only buffer, split
+ * into tiles that the thread pool fills in parallel, and the bounding boxes of the queued draws are tested against it before
+ * submission. Row kernels shade 4 pixels at a time with SSE2, or 8 with AVX2 when the build enables it.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+#include "mesh.h"
+#include "thread_pool.h"
+
+class OcclusionCuller
+{
+public:
+    // 4:3 like the window; the tile size keeps rows a multiple of the widest kernel
+    static const int WIDTH = 256;
+    static const int HEIGHT = 192;
+    static const int TILE_WIDTH = 64;
+    static const int TILE_HEIGHT = 48;
+
+    explicit OcclusionCuller(ThreadPool& pool);
+
+    // Starts a frame seen through viewProjection and drops the previous frame's occluders
+    void Begin(const glm::mat4& viewProjection);
+
+    // Queues the triangles of geometry placed by model (which maps the geometry's stored space to world space)
+    void AddOccluder(const OccluderGeometry& geometry, const glm::mat4& model);
+
+    // Clears the depth buffer and rasterizes the queued occluders into it
+    void Rasterize();
+
+    // Clears visible[i] for the visible world-space boxes that lie entirely behind the rasterized occluders
+    void TestBoxes(const BoxBatch& boxes, std::vector<uint8_t>& visible) const;
+
+    size_t TriangleCount() const { return mTriangles.size(); } // occluder triangles rasterized by the last Rasterize
+
+private:
+    // Screen-space triangle: edge functions and the depth plane, all evaluated at pixel coordinates
+    struct Triangle
+    {
+        float edgeA[3], edgeB[3], edgeC[3]; // inside when edgeA * x + edgeB * y + edgeC >= 0 for all three
+        float depthA, depthB, depthC;       // depth = depthA * x + depthB * y + depthC
+        int minX, minY, maxX, maxY;         // pixel bounds, clamped to the buffer
+    };
+
+    void AddTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c);
+    void AddScreenTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+    void RasterizeTile(int tile);
+    bool BoxVisible(const BoxBatch& boxes, size_t i) const;
+
+    ThreadPool& mPool;
+    glm::mat4 mViewProjection = glm::mat4(1.0f);
+    std::vector<Triangle> mTriangles;
+    std::vector<float> mDepth; // WIDTH * HEIGHT post-projection depths in [0, 1], rows bottom to top like GL
+};
+
+#endif
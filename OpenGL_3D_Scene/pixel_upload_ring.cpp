@@ -0,0 +1,118 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Pixel upload ring
+// Description: Persistently mapped, fenced pixel unpack buffer segments that texture streaming uploads from.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+
+#include "gl_extensions.h"
+#include "pixel_upload_ring.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const GLuint64 WAIT_TIMEOUT_NS = 1000000000; // a blocking Begin polls the fence once a second until it signals
+}
+
+
+bool PixelUploadRing::Create(GLsizeiptr segmentSize, int segmentCount)
+{
+    mSegmentSize = segmentSize;
+    mFences.assign(segmentCount, nullptr);
+    mNext = 0;
+    mPersistent = gGLExt.bufferStorage;
+
+    const GLsizeiptr size = segmentSize * segmentCount;
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+    if (mPersistent)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gGLExt.BufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+        mMapping = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+    }
+    else
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (mPersistent && !mMapping)
+    {
+        cout << "Failed to map the pixel upload ring" << endl;
+        Destroy();
+        return false;
+    }
+
+    cout << "INFO: Pixel upload ring: " << segmentCount << " x " << (segmentSize >> 10) << " KB, "
+        << (mPersistent ? "persistently mapped" : "mapped per segment") << endl;
+    return true;
+}
+
+void PixelUploadRing::Destroy()
+{
+    for (GLsync& fence : mFences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (mMapping)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &mBuffer);
+    mBuffer = 0;
+    mMapping = nullptr;
+    mSegment = nullptr;
+}
+
+// Claim the next segment once the uploads last sourced from it have completed
+//------------------------------------------------------------------------------
+unsigned char* PixelUploadRing::Begin(bool wait)
+{
+    GLsync& fence = mFences[mNext];
+    if (fence)
+    {
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? WAIT_TIMEOUT_NS : 0);
+        while (wait && status == GL_TIMEOUT_EXPIRED)
+            status = glClientWaitSync(fence, 0, WAIT_TIMEOUT_NS);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            ++mBusy;
+            return nullptr;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    mSegmentOffset = mNext * mSegmentSize;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mBuffer);
+    if (mPersistent)
+        mSegment = mMapping + mSegmentOffset;
+    else
+    {
+        // The fence already guarantees the GL is done with the range, so the map need not synchronize
+        mSegment = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, mSegmentOffset, mSegmentSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+        if (!mSegment)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    return mSegment;
+}
+
+void PixelUploadRing::Commit()
+{
+    // A coherent persistent mapping needs nothing; a mapped range cannot be read by the GL until it is unmapped
+    if (!mPersistent)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+}
+
+void PixelUploadRing::End()
+{
+    mFences[mNext] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mNext = (mNext + 1) % static_cast<int>(mFences.size());
+    mSegment = nullptr;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
@@ -0,0 +1,50 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Pixel upload ring: a pixel unpack buffer split into segments that texture uploads are sourced from. The buffer stays
+ * persistently mapped, so pixels are copied straight into memory the GL reads; each segment is fenced once its uploads
+ * are issued and only written again after the fence has signaled, so the CPU never waits on a transfer by default.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef PIXEL_UPLOAD_RING_H
+#define PIXEL_UPLOAD_RING_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+class PixelUploadRing
+{
+public:
+    // Without immutable buffer storage each segment is mapped unsynchronized while its pixels are written instead
+    bool Create(GLsizeiptr segmentSize, int segmentCount);
+    void Destroy();
+
+    // Binds the ring to GL_PIXEL_UNPACK_BUFFER and returns the next segment to write, or null while the GPU may still
+    // read from it. With wait the call blocks until the segment is free instead.
+    unsigned char* Begin(bool wait);
+
+    // Call once the segment's pixels are written and before the uploads that read them are issued
+    void Commit();
+
+    // The pixel pointer to hand glTexSubImage* for data written into the current segment
+    const void* Offset(const unsigned char* data) const { return reinterpret_cast<const void*>(mSegmentOffset + (data - mSegment)); }
+
+    // Fences the uploads issued since Commit and unbinds the ring
+    void End();
+
+    GLsizeiptr SegmentSize() const { return mSegmentSize; }
+    bool Persistent() const { return mPersistent; }
+    size_t BusyCount() const { return mBusy; }   // Begin calls that found their segment still in use
+
+private:
+    GLuint mBuffer = 0;
+    bool mPersistent = false;
+    unsigned char* mMapping = nullptr;      // whole ring when persistent
+    GLsizeiptr mSegmentSize = 0;
+    std::vector<GLsync> mFences;            // one per segment, null when the segment is free
+    int mNext = 0;
+    unsigned char* mSegment = nullptr;      // segment between Begin and End
+    GLintptr mSegmentOffset = 0;
+    size_t mBusy = 0;
+};
+
+#endif
@@ -0,0 +1,386 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Render queue
+// Description: State-sorted indirect multi-draw submission of the scene's objects.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // max, find, find_if, remove_if, count
+#include <iostream>         // cout
+#include <utility>          // pair
+#include <cstring>          // memcpy
+#include <cmath>            // fabs
+
+#include "render_queue.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    // Key layout, most expensive state change first:
+    //   63-56 program slot | 55-48 texture set | 47-32 VAO slot | 31 32-bit indices | 30-24 unused | 23-0 depth
+    const int PROGRAM_SHIFT = 56;
+    const int TEXTURE_SET_SHIFT = 48;
+    const int VERTEX_ARRAY_SHIFT = 32;
+    const int INDEX_TYPE_SHIFT = 31;
+    const int STATE_SHIFT = INDEX_TYPE_SHIFT; // draws whose keys agree from this bit up share one multi-draw
+    const uint64_t PROGRAM_SLOTS = 1 << 8;
+    const uint64_t TEXTURE_SETS = 1 << 8;
+    const uint64_t VERTEX_ARRAY_SLOTS = 1 << 16;
+
+    // The id buffer each VAO's drawId attribute reads. VAO state belongs to the context, so every queue drawing the
+    // same meshes sees and updates the one record.
+    vector<pair<GLuint, GLuint>> gDrawIdSources;
+
+    // Position of value in slots, appended on first use
+    uint64_t Slot(vector<GLuint>& slots, GLuint value)
+    {
+        auto it = find(slots.begin(), slots.end(), value);
+        if (it != slots.end())
+            return static_cast<uint64_t>(it - slots.begin());
+        slots.push_back(value);
+        return slots.size() - 1;
+    }
+
+    // The bits of a non-negative float sort like the float; the top 24 keep 15 bits of mantissa
+    uint64_t DepthBits(float distance)
+    {
+        uint32_t bits;
+        memcpy(&bits, &distance, sizeof(bits));
+        return bits >> 8;
+    }
+
+    // Matrix that takes object-space normals to world space under model. Rotation with uniform scale keeps directions,
+    // so its upper 3x3 serves as is; anything else gets the cofactor matrix, which is the inverse transpose scaled by
+    // the determinant. Unlike the inverse it exists for singular transforms such as a scale of 0 flattening an axis:
+    // normals along the flattened axis keep their direction and the others collapse with the faces they belong to.
+    void NormalMatrix(const glm::mat4& model, glm::vec4 normalMatrix[3])
+    {
+        const glm::vec3 x(model[0]), y(model[1]), z(model[2]);
+        const float tolerance = 1e-5f * glm::dot(x, x);
+        const bool conformal = fabs(glm::dot(x, y)) <= tolerance && fabs(glm::dot(y, z)) <= tolerance && fabs(glm::dot(z, x)) <= tolerance
+            && fabs(glm::dot(x, x) - glm::dot(y, y)) <= tolerance && fabs(glm::dot(x, x) - glm::dot(z, z)) <= tolerance;
+
+        if (conformal)
+        {
+            normalMatrix[0] = glm::vec4(x, 0.0f);
+            normalMatrix[1] = glm::vec4(y, 0.0f);
+            normalMatrix[2] = glm::vec4(z, 0.0f);
+            return;
+        }
+
+        // A mirroring transform has a negative determinant, which would turn the cofactor normals inside out
+        const glm::vec3 yz = glm::cross(y, z), zx = glm::cross(z, x), xy = glm::cross(x, y);
+        const float sign = glm::dot(x, yz) < 0.0f ? -1.0f : 1.0f;
+        normalMatrix[0] = glm::vec4(sign * yz, 0.0f);
+        normalMatrix[1] = glm::vec4(sign * zx, 0.0f);
+        normalMatrix[2] = glm::vec4(sign * xy, 0.0f);
+    }
+
+    // LSD radix sort on 8-bit digits. It is stable, so draws with equal keys keep the order they were queued in.
+    // Digits that every key shares are skipped, which with few distinct states leaves only a few passes.
+    template <typename Item>
+    void RadixSort(vector<Item>& items, vector<Item>& scratch)
+    {
+        if (items.size() < 2)
+            return;
+
+        scratch.resize(items.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = {};
+            for (const Item& item : items)
+                ++counts[(item.key >> shift) & 0xFF];
+            if (counts[(items[0].key >> shift) & 0xFF] == items.size())
+                continue;
+
+            size_t offset = 0;
+            for (size_t& count : counts)
+            {
+                size_t digitCount = count;
+                count = offset;
+                offset += digitCount;
+            }
+            for (const Item& item : items)
+                scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+            items.swap(scratch);
+        }
+    }
+}
+
+
+void RenderQueue::Create()
+{
+    glGenBuffers(1, &mCommandBuffer);
+    glGenBuffers(1, &mDrawDataBuffer);
+    glGenBuffers(1, &mDrawIdBuffer);
+    glGenBuffers(1, &mSourceCommandBuffer);
+    glGenBuffers(1, &mBoundsBuffer);
+    glGenBuffers(1, &mRetestCommandBuffer);
+    glGenBuffers(1, &mRetestBuffer);
+    mTextureSets.assign(1, vector<TextureBinding>()); // NO_TEXTURES
+    Reserve(64);
+}
+
+void RenderQueue::Destroy()
+{
+    gDrawIdSources.erase(remove_if(gDrawIdSources.begin(), gDrawIdSources.end(),
+        [this](const pair<GLuint, GLuint>& source) { return source.second == mDrawIdBuffer; }), gDrawIdSources.end());
+    glDeleteBuffers(1, &mCommandBuffer);
+    glDeleteBuffers(1, &mDrawDataBuffer);
+    glDeleteBuffers(1, &mDrawIdBuffer);
+    glDeleteBuffers(1, &mSourceCommandBuffer);
+    glDeleteBuffers(1, &mBoundsBuffer);
+    glDeleteBuffers(1, &mRetestCommandBuffer);
+    glDeleteBuffers(1, &mRetestBuffer);
+    mCommandBuffer = mDrawDataBuffer = mDrawIdBuffer = mSourceCommandBuffer = mBoundsBuffer = 0;
+    mRetestCommandBuffer = mRetestBuffer = 0;
+    mCapacity = 0;
+}
+
+int RenderQueue::AddTextureSet(const vector<TextureBinding>& bindings)
+{
+    mTextureSets.push_back(bindings);
+    return static_cast<int>(mTextureSets.size() - 1);
+}
+
+void RenderQueue::Add(GLuint program, int textureSet, const GLMesh& mesh, const DrawData& data)
+{
+    Add(program, textureSet, mesh, IndexRange{ 0, mesh.nIndices }, data);
+}
+
+void RenderQueue::Add(GLuint program, int textureSet, const GLMesh& mesh, const IndexRange& range, const DrawData& data)
+{
+    Draw draw;
+    if (!MakeKey(program, textureSet, mesh, data, draw.key))
+        return;
+    draw.program = program;
+    draw.textureSet = textureSet;
+    draw.vao = mesh.vao;
+    draw.indexType = mesh.indexType;
+    draw.boundsCenter = mesh.boundsCenter;  // ranges keep the whole mesh's box
+    draw.boundsExtent = mesh.boundsExtent;
+    draw.occluder = (range.first == 0 && range.count == mesh.nIndices) ? mesh.occluder.get() : nullptr;
+    draw.command.count = range.count;
+    draw.command.instanceCount = 1;
+    draw.command.firstIndex = mesh.firstIndex + range.first;
+    draw.command.baseVertex = mesh.baseVertex;
+    draw.command.baseInstance = 0; // assigned at submit time
+    draw.data = data;
+    NormalMatrix(data.model, draw.data.normalMatrix);
+    mDraws.push_back(draw);
+}
+
+// Pack the draw's state and its distance from the viewer into a sort key; false when the state overflows its field
+//----------------------------------------------------------------------------------------------------------------------
+bool RenderQueue::MakeKey(GLuint program, int textureSet, const GLMesh& mesh, const DrawData& data, uint64_t& key)
+{
+    // A wrapped field would sort the draw into another state's run, so it is dropped instead
+    const uint64_t programSlot = Slot(mProgramSlots, program);
+    const uint64_t vertexArraySlot = Slot(mVertexArraySlots, mesh.vao);
+    if (programSlot >= PROGRAM_SLOTS || vertexArraySlot >= VERTEX_ARRAY_SLOTS || textureSet < 0
+        || static_cast<size_t>(textureSet) >= mTextureSets.size() || static_cast<uint64_t>(textureSet) >= TEXTURE_SETS)
+    {
+        if (!mKeyOverflowReported)
+            cout << "Render queue: draw dropped, program slot " << programSlot << ", texture set " << textureSet << " or VAO slot "
+                << vertexArraySlot << " is out of range for the sort key" << endl;
+        mKeyOverflowReported = true;
+        return false;
+    }
+
+    // Measured to the world-space center of the mesh's bounds: the model matrix's translation is that center only
+    // when it includes a quantized mesh's dequantization, and the object's origin with float vertices
+    const glm::vec3 center = glm::vec3(data.model * glm::vec4(mesh.boundsCenter, 1.0f));
+    const float distance = glm::length(center - mViewPosition);
+
+    key = (programSlot << PROGRAM_SHIFT)
+        | (static_cast<uint64_t>(textureSet) << TEXTURE_SET_SHIFT)
+        | (vertexArraySlot << VERTEX_ARRAY_SHIFT)
+        | (static_cast<uint64_t>(mesh.indexType == GL_UNSIGNED_INT) << INDEX_TYPE_SHIFT)
+        | DepthBits(distance);
+    return true;
+}
+
+// Test every queued draw's world-space box at once and compact the survivors in queue order
+//------------------------------------------------------------------------------------------
+void RenderQueue::Cull(const Frustum& frustum, OcclusionCuller* occlusion)
+{
+    mBounds.Clear();
+    for (const Draw& draw : mDraws)
+    {
+        glm::vec3 center, extent;
+        TransformBox(draw.data.model, draw.boundsCenter, draw.boundsExtent, center, extent);
+        mBounds.Add(center, extent);
+    }
+    CullBoxes(frustum, mBounds, mVisible);
+
+    size_t occluded = 0;
+    if (occlusion)
+    {
+        // Only occluders inside the frustum can hide anything
+        size_t frustumVisible = 0;
+        for (size_t i = 0; i < mDraws.size(); ++i)
+        {
+            if (!mVisible[i])
+                continue;
+            ++frustumVisible;
+            if (mDraws[i].occluder)
+                occlusion->AddOccluder(*mDraws[i].occluder, mDraws[i].data.model);
+        }
+        occlusion->Rasterize();
+        occlusion->TestBoxes(mBounds, mVisible);
+        occluded = frustumVisible - count(mVisible.begin(), mVisible.end(), (uint8_t)1);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < mDraws.size(); ++i)
+    {
+        if (mVisible[i])
+            mDraws[kept++] = mDraws[i];
+    }
+    mCulled += mDraws.size() - kept;
+    mOccluded += occluded;
+    mDraws.resize(kept);
+}
+
+// Grow the GPU buffers to hold at least drawCount draws
+//-------------------------------------------------------
+void RenderQueue::Reserve(size_t drawCount)
+{
+    if (drawCount <= mCapacity)
+        return;
+
+    mCapacity = max(drawCount, mCapacity * 2);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, mCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mDrawDataBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mCapacity * sizeof(DrawData), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSourceCommandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBoundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mCapacity * sizeof(GpuCuller::DrawBounds), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRetestCommandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRetestBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, mCapacity * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    vector<GLuint> ids(mCapacity);
+    for (size_t i = 0; i < mCapacity; ++i)
+        ids[i] = static_cast<GLuint>(i);
+    glBindBuffer(GL_ARRAY_BUFFER, mDrawIdBuffer);
+    glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Sort the draws by state, upload them and issue one multi-draw per run of equal state
+//--------------------------------------------------------------------------------------
+void RenderQueue::Submit(GLStateCache& state, GpuCuller* culling)
+{
+    mSubmitCalls = 0;
+    if (mDraws.empty())
+        return;
+
+    mOrder.resize(mDraws.size());
+    for (size_t i = 0; i < mDraws.size(); ++i)
+        mOrder[i] = SortItem{ mDraws[i].key, static_cast<uint32_t>(i) };
+    RadixSort(mOrder, mSortScratch);
+
+    // The draw's index in the sorted queue is its baseInstance, which the drawId attribute turns into an SSBO index.
+    // This stands in for gl_DrawID, which needs GL 4.6 or ARB_shader_draw_parameters.
+    mCommands.resize(mOrder.size());
+    mDrawData.resize(mOrder.size());
+    for (size_t i = 0; i < mOrder.size(); ++i)
+    {
+        mCommands[i] = mDraws[mOrder[i].draw].command;
+        mCommands[i].baseInstance = static_cast<GLuint>(i);
+        mDrawData[i] = mDraws[mOrder[i].draw].data;
+    }
+
+    // Reserve binds buffers directly, so the cache must forget them when the buffers grow
+    if (mOrder.size() > mCapacity)
+    {
+        Reserve(mOrder.size());
+        state.Invalidate();
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mDrawDataBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mDrawData.size() * sizeof(DrawData), mDrawData.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, mDrawDataBuffer);
+
+    if (culling)
+    {
+        // The compute pass writes the commands; the CPU only provides them as queued along with their boxes
+        mDrawBounds.resize(mOrder.size());
+        for (size_t i = 0; i < mOrder.size(); ++i)
+        {
+            const Draw& draw = mDraws[mOrder[i].draw];
+            mDrawBounds[i].center = glm::vec4(draw.boundsCenter, 1.0f);
+            mDrawBounds[i].extent = glm::vec4(draw.boundsExtent, 0.0f);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSourceCommandBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mCommands.size() * sizeof(DrawElementsIndirectCommand), mCommands.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBoundsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mDrawBounds.size() * sizeof(GpuCuller::DrawBounds), mDrawBounds.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        const bool retest = culling->Cull(state, mOrder.size(), mBoundsBuffer, mSourceCommandBuffer, mCommandBuffer, mRetestBuffer);
+        state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+        IssueDraws(state);
+
+        // The first pass tested against the previous frame's depth. The draws it hid are tested again against the
+        // depth drawn so far this frame, and the ones still visible are drawn from their own command buffer.
+        if (retest)
+        {
+            culling->Retest(state, mOrder.size(), mBoundsBuffer, mSourceCommandBuffer, mRetestCommandBuffer, mRetestBuffer);
+            state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, mRetestCommandBuffer);
+            IssueDraws(state);
+        }
+    }
+    else
+    {
+        state.BindBuffer(GL_DRAW_INDIRECT_BUFFER, mCommandBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, mCommands.size() * sizeof(DrawElementsIndirectCommand), mCommands.data());
+        IssueDraws(state);
+    }
+}
+
+// One multi-draw per run of equal state over the commands in the bound indirect buffer
+//--------------------------------------------------------------------------------------
+void RenderQueue::IssueDraws(GLStateCache& state)
+{
+    size_t first = 0;
+    while (first < mOrder.size())
+    {
+        const uint64_t runState = mOrder[first].key >> STATE_SHIFT;
+        size_t last = first + 1;
+        while (last < mOrder.size() && (mOrder[last].key >> STATE_SHIFT) == runState)
+            ++last;
+
+        const Draw& draw = mDraws[mOrder[first].draw];
+        state.UseProgram(draw.program);
+        for (const TextureBinding& binding : mTextureSets[draw.textureSet])
+            state.BindTexture(binding.unit, binding.target, binding.texture);
+        state.BindVertexArray(draw.vao);
+
+        // The drawId attribute is VAO state: point the VAO at this queue's id buffer unless it already reads it
+        auto source = find_if(gDrawIdSources.begin(), gDrawIdSources.end(),
+            [&draw](const pair<GLuint, GLuint>& entry) { return entry.first == draw.vao; });
+        if (source == gDrawIdSources.end() || source->second != mDrawIdBuffer)
+        {
+            state.BindBuffer(GL_ARRAY_BUFFER, mDrawIdBuffer);
+            glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+            glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+            glEnableVertexAttribArray(DRAW_ID_LOCATION);
+            if (source == gDrawIdSources.end())
+                gDrawIdSources.push_back(make_pair(draw.vao, mDrawIdBuffer));
+            else
+                source->second = mDrawIdBuffer;
+        }
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES, draw.indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)),
+            static_cast<GLsizei>(last - first), 0);
+        ++mSubmitCalls;
+        first = last;
+    }
+}
@@ -0,0 +1,129 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Render queue: collects the frame's object draws for every program, radix-sorts them by a 64-bit state key and submits
+ * each run of draws sharing program, textures and geometry heap page with one glMultiDrawElementsIndirect. State changes
+ * go through a GLStateCache, so the cost of a frame follows the number of distinct states rather than of objects.
+ * Per-draw data lives in a shader storage buffer indexed by the draw's position in the sorted queue.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+#include "gl_state_cache.h"
+#include "gpu_culler.h"
+#include "mesh.h"
+#include "occlusion_culler.h"
+
+// Command layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Per-draw data; mirrors the std430 DrawData struct of the shaders
+struct DrawData
+{
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3]; // columns of a mat3, padded to vec4 as std430 lays them out; filled in by Add
+    glm::vec4 lightColor;   // rgb: color of the light the object is lit by (ignored by unlit programs)
+    glm::uvec4 material;    // x: texture array unit of the object's texture, y: its layer
+};
+
+class RenderQueue
+{
+public:
+    static const GLuint DRAW_ID_LOCATION = 8;   // instanced vertex attribute carrying the draw's index
+    static const GLuint DRAW_DATA_BINDING = 1;  // shader storage binding point of the per-draw data
+    static const int NO_TEXTURES = 0;           // texture set of draws that sample nothing
+
+    void Create();
+    void Destroy();
+
+    // Registers the textures a group of draws samples and returns the set's id for Add
+    int AddTextureSet(const std::vector<TextureBinding>& bindings);
+
+    void Clear() { mDraws.clear(); mCulled = 0; mOccluded = 0; }
+
+    // Draws of one state are ordered front to back from this position
+    void SetViewPosition(const glm::vec3& position) { mViewPosition = position; }
+
+    // Queues the whole mesh, or one index range of it
+    void Add(GLuint program, int textureSet, const GLMesh& mesh, const DrawData& data);
+    void Add(GLuint program, int textureSet, const GLMesh& mesh, const IndexRange& range, const DrawData& data);
+
+    // Drops the queued draws whose mesh bounds lie outside the frustum. With an occlusion culler (already begun for
+    // this frame's view), the surviving whole-mesh draws with occluder geometry are rasterized into it and the draws
+    // hidden behind them are dropped as well.
+    void Cull(const Frustum& frustum, OcclusionCuller* occlusion = nullptr);
+
+    // Sorts, uploads and issues the queued draws, leaving the last program and VAO bound. With a GPU culler (already
+    // begun for this frame's view), its compute pass decides which of the queued draws are drawn instead of Cull; the
+    // draws it hides behind the previous frame's depth get a second pass against the depth this frame has drawn.
+    void Submit(GLStateCache& state, GpuCuller* culling = nullptr);
+
+    size_t DrawCount() const { return mDraws.size(); }
+    size_t CulledCount() const { return mCulled; }   // draws removed by Cull since the last Clear
+    size_t OccludedCount() const { return mOccluded; } // the part of them removed by the occlusion test
+    size_t SubmitCalls() const { return mSubmitCalls; } // GL draw calls issued by the last Submit
+
+private:
+    struct Draw
+    {
+        uint64_t key;
+        GLuint program;
+        int textureSet;
+        GLuint vao;
+        GLenum indexType;
+        glm::vec3 boundsCenter;
+        glm::vec3 boundsExtent;
+        const OccluderGeometry* occluder;   // null unless the draw covers a whole mesh kept for occlusion
+        DrawElementsIndirectCommand command;
+        DrawData data;
+    };
+
+    struct SortItem
+    {
+        uint64_t key;
+        uint32_t draw;
+    };
+
+    bool MakeKey(GLuint program, int textureSet, const GLMesh& mesh, const DrawData& data, uint64_t& key);
+    void IssueDraws(GLStateCache& state);
+    void Reserve(size_t drawCount);
+
+    std::vector<Draw> mDraws;
+    std::vector<SortItem> mOrder;
+    std::vector<SortItem> mSortScratch;
+    BoxBatch mBounds;
+    std::vector<uint8_t> mVisible;
+    std::vector<DrawElementsIndirectCommand> mCommands;
+    std::vector<DrawData> mDrawData;
+    std::vector<GpuCuller::DrawBounds> mDrawBounds;
+    std::vector<std::vector<TextureBinding>> mTextureSets;
+    std::vector<GLuint> mProgramSlots;      // key slot of each program seen, in first-use order
+    std::vector<GLuint> mVertexArraySlots;  // same for VAOs
+    glm::vec3 mViewPosition = glm::vec3(0.0f);
+    GLuint mCommandBuffer = 0;
+    GLuint mDrawDataBuffer = 0;
+    GLuint mDrawIdBuffer = 0;   // 0, 1, 2, ... read once per instance starting at each command's baseInstance
+    GLuint mSourceCommandBuffer = 0;    // the commands as queued, which GPU culling copies into mCommandBuffer
+    GLuint mBoundsBuffer = 0;           // object-space boxes for GPU culling
+    GLuint mRetestCommandBuffer = 0;    // commands of the draws GPU culling recovers in its second pass
+    GLuint mRetestBuffer = 0;           // one flag per draw: hidden by the previous frame's depth, to be tested again
+    size_t mCapacity = 0;
+    size_t mSubmitCalls = 0;
+    size_t mCulled = 0;
+    size_t mOccluded = 0;
+    bool mKeyOverflowReported = false;  // the out-of-range draw message is printed once
+};
+
+#endif
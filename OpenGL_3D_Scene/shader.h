@@ -5,19 +5,29 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+
+// Typed handle to a uniform location, resolved once through Shader::uniform and set without any string lookups
+template <typename T>
+struct Uniform
+{
+    GLint location = -1;
+    bool valid() const { return location >= 0; }
+};
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly; defines (e.g. "#define NAME\n") are inserted after each #version line
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -40,8 +50,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            vertexCode = insertDefines(vShaderStream.str(), defines);
+            fragmentCode = insertDefines(fShaderStream.str(), defines);
         }
         catch (std::ifstream::failure& e)
         {
@@ -70,6 +80,39 @@ public:
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        // 3. build the uniform location table once from program introspection
+        cacheUniformLocations();
+    }
+    // compute program from a single source file
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath)
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        const char* cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+        cacheUniformLocations();
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -77,66 +120,144 @@ public:
     {
         glUseProgram(ID);
     }
+    // location of a uniform from the table built at link time, -1 when the program has no such active uniform
+    // ------------------------------------------------------------------------
+    GLint location(const std::string& name) const
+    {
+        auto it = uniformLocations.find(name);
+        return it != uniformLocations.end() ? it->second : -1;
+    }
+    // typed handle for the hot path: resolve once after linking, then pass to set()
+    // ------------------------------------------------------------------------
+    template <typename T>
+    Uniform<T> uniform(const std::string& name) const
+    {
+        Uniform<T> handle;
+        handle.location = location(name);
+        return handle;
+    }
+    // handle based setters: act on the program currently in use, no hashing or allocation
+    // ------------------------------------------------------------------------
+    static void set(Uniform<bool> u, bool value) { glUniform1i(u.location, (int)value); }
+    static void set(Uniform<int> u, int value) { glUniform1i(u.location, value); }
+    static void set(Uniform<float> u, float value) { glUniform1f(u.location, value); }
+    static void set(Uniform<glm::vec2> u, const glm::vec2& value) { glUniform2fv(u.location, 1, &value[0]); }
+    static void set(Uniform<glm::vec3> u, const glm::vec3& value) { glUniform3fv(u.location, 1, &value[0]); }
+    static void set(Uniform<glm::vec4> u, const glm::vec4& value) { glUniform4fv(u.location, 1, &value[0]); }
+    static void set(Uniform<glm::mat3> u, const glm::mat3& mat) { glUniformMatrix3fv(u.location, 1, GL_FALSE, &mat[0][0]); }
+    static void set(Uniform<glm::mat4> u, const glm::mat4& mat) { glUniformMatrix4fv(u.location, 1, GL_FALSE, &mat[0][0]); }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    std::unordered_map<std::string, GLint> uniformLocations;
+
+    // place the defines right after the #version directive, which must stay the first line
+    // ------------------------------------------------------------------------
+    static std::string insertDefines(const std::string& code, const std::string& defines)
+    {
+        if (defines.empty())
+            return code;
+        size_t lineEnd = code.find('\n');
+        if (lineEnd == std::string::npos)
+            return code + "\n" + defines;
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+    }
+
+    // query every active uniform of the linked program; arrays are stored under "name" and "name[0]"
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        GLint count = 0;
+        GLint maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+            std::string uniformName(name.c_str(), length);
+
+            // uniforms inside blocks have no location
+            GLint loc = glGetUniformLocation(ID, uniformName.c_str());
+            if (loc < 0)
+                continue;
+
+            uniformLocations[uniformName] = loc;
+            size_t bracket = uniformName.find("[0]");
+            if (bracket != std::string::npos && bracket + 3 == uniformName.size())
+            {
+                std::string baseName = uniformName.substr(0, bracket);
+                uniformLocations[baseName] = loc;
+                for (GLint element = 1; element < size; ++element)
+                {
+                    std::string elementName = baseName + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            }
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(unsigned int shader, std::string type)
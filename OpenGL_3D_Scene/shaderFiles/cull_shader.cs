@@ -0,0 +1,158 @@
+#version 440 core
+layout(local_size_x = 64) in;
+
+// One invocation per queued draw, in two passes. The first tests the draw's bounds against the view frustum and the
+// Hi-Z pyramid of the previous frame and writes its command with one instance when it survives and none when it does
+// not; the draws only the pyramid rejected are flagged. The second runs once the survivors are drawn and the pyramid
+// holds this frame's depth: it writes one instance for the flagged draws that pyramid does not hide and none for the rest.
+
+// Per-draw data written by the render queue (binding point 1)
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix; // object to world space for normals, computed once per draw on the CPU
+    vec4 lightColor;
+    uvec4 material;
+};
+layout(std430, binding = 1) readonly buffer DrawBlock
+{
+    DrawData draws[];
+};
+
+// Box around the draw's mesh, in the space the model matrix maps from (binding point 3)
+struct DrawBounds
+{
+    vec4 center;
+    vec4 extent;
+};
+layout(std430, binding = 3) readonly buffer BoundsBlock
+{
+    DrawBounds bounds[];
+};
+
+// Mirrors DrawElementsIndirectCommand
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+layout(std430, binding = 4) readonly buffer SourceCommandBlock
+{
+    DrawCommand sourceCommands[];
+};
+layout(std430, binding = 5) writeonly buffer CommandBlock
+{
+    DrawCommand commands[];
+};
+
+// Statistics for the benchmark (binding point 6)
+layout(std430, binding = 6) buffer CountBlock
+{
+    uint visibleCount;
+    uint occludedCount;
+};
+
+// Set by the first pass for the draws to test again in the second (binding point 7)
+layout(std430, binding = 7) buffer RetestBlock
+{
+    uint retest[];
+};
+
+layout(binding = 16) uniform sampler2D hiZ; // farthest depth per texel, level 0 at the framebuffer's size
+
+uniform int drawCount;
+uniform vec4 frustumPlanes[6];   // xyz: normal pointing into the frustum, w: offset
+uniform bool hiZValid;           // false until a frame's depth has been captured
+uniform bool retestPass;         // second pass: only the flagged draws, against this frame's pyramid
+uniform mat4 hiZViewProjection;  // the view-projection the pyramid was rendered with
+uniform ivec2 hiZSize;
+uniform int hiZLevels;
+
+const float DEPTH_BIAS = 1e-4f;
+
+bool InsideFrustum(vec3 center, vec3 extent)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 plane = frustumPlanes[i];
+        if (dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Hidden when the box's nearest depth lies behind the farthest depth of every pixel its rectangle covers
+bool OccludedByHiZ(vec3 center, vec3 extent)
+{
+    vec2 lower = vec2(1.0f);
+    vec2 upper = vec2(0.0f);
+    float nearest = 1.0f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        vec3 side = vec3((corner & 1) != 0 ? 1.0f : -1.0f, (corner & 2) != 0 ? 1.0f : -1.0f, (corner & 4) != 0 ? 1.0f : -1.0f);
+        vec4 clip = hiZViewProjection * vec4(center + side * extent, 1.0f);
+        if (clip.z + clip.w <= 0.0f)
+            return false; // reaches the near plane of the pyramid's view
+        vec3 ndc = clip.xyz / clip.w;
+        lower = min(lower, ndc.xy * 0.5f + 0.5f);
+        upper = max(upper, ndc.xy * 0.5f + 0.5f);
+        nearest = min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+
+    // Parts outside the pyramid's view have no depth to test against
+    if (any(lessThan(lower, vec2(0.0f))) || any(greaterThan(upper, vec2(1.0f))))
+        return false;
+
+    // Climb to the level where the rectangle spans at most eight texels per axis. The usual 2x2 footprint tests an
+    // area up to four times the rectangle's size and misses objects hidden just behind an occluder's silhouette.
+    ivec2 minPixel = min(ivec2(lower * vec2(hiZSize)), hiZSize - 1);
+    ivec2 maxPixel = min(ivec2(upper * vec2(hiZSize)), hiZSize - 1);
+    int level = 0;
+    while (level < hiZLevels - 1 && any(greaterThan((maxPixel >> level) - (minPixel >> level), ivec2(7))))
+        ++level;
+
+    ivec2 levelLast = max(hiZSize >> level, ivec2(1)) - 1;
+    ivec2 minTexel = min(minPixel >> level, levelLast);
+    ivec2 maxTexel = min(maxPixel >> level, levelLast);
+    for (int y = minTexel.y; y <= maxTexel.y; ++y)
+        for (int x = minTexel.x; x <= maxTexel.x; ++x)
+            if (texelFetch(hiZ, ivec2(x, y), level).r + DEPTH_BIAS >= nearest)
+                return false;
+    return true;
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= uint(drawCount))
+        return;
+
+    // Arvo: world-space box of the draw's object-space box
+    mat4 model = draws[i].model;
+    vec3 center = vec3(model * vec4(bounds[i].center.xyz, 1.0f));
+    vec3 extent = mat3(abs(model[0].xyz), abs(model[1].xyz), abs(model[2].xyz)) * bounds[i].extent.xyz;
+
+    bool visible;
+    if (retestPass)
+    {
+        visible = retest[i] != 0u && !OccludedByHiZ(center, extent);
+        if (retest[i] != 0u && !visible)
+            atomicAdd(occludedCount, 1u);
+    }
+    else
+    {
+        visible = InsideFrustum(center, extent);
+        bool hidden = visible && hiZValid && OccludedByHiZ(center, extent);
+        retest[i] = hidden ? 1u : 0u;
+        visible = visible && !hidden;
+    }
+    if (visible)
+        atomicAdd(visibleCount, 1u);
+
+    DrawCommand command = sourceCommands[i];
+    command.instanceCount = visible ? 1u : 0u;
+    commands[i] = command;
+}
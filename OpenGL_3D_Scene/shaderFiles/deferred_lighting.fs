@@ -0,0 +1,203 @@
+#version 440 core
+
+// Lights one pixel of the G-buffer with the same model as lighting_shader.fs: the key light at lightPos tinted by the
+// draw's light color, plus the shadowed directional light and the point lights of the pixel's cluster. Unlit surfaces
+// pass their albedo through.
+
+out vec4 fragmentColor;
+
+layout(binding = 8) uniform sampler2D gAlbedo;   // rgb: albedo, a: 1 for lit surfaces
+layout(binding = 9) uniform sampler2D gNormal;   // octahedral world-space normal
+layout(binding = 10) uniform usampler2D gDrawId; // index of the surface's per-draw data
+layout(binding = 11) uniform sampler2D gDepth;
+
+uniform vec3 lightPos;
+uniform mat4 inverseViewProjection;
+
+// Per-draw data written by the render queue (binding point 1)
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec4 lightColor;
+    uvec4 material;
+};
+layout(std430, binding = 1) readonly buffer DrawBlock
+{
+    DrawData draws[];
+};
+
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
+
+// Cluster grid of the clustered point lights (binding point 1)
+layout(std140, binding = 1) uniform ClusterBlock
+{
+    uvec4 clusterGrid;   // xyz: cluster counts, w: number of lights
+    vec4 clusterParams;  // xy: pixels per tile, z and w: scale and bias mapping log(view depth) to a slice
+};
+
+// Point lights and the per-cluster lists into them (binding points 7, 8 and 9)
+struct PointLight
+{
+    vec4 positionRadius; // xyz: world-space position, w: distance at which the light fades out completely
+    vec4 color;          // rgb: color scaled by intensity
+};
+layout(std430, binding = 7) readonly buffer LightBlock
+{
+    PointLight lights[];
+};
+struct ClusterRange
+{
+    uint offset;
+    uint count;
+};
+layout(std430, binding = 8) readonly buffer ClusterRangeBlock
+{
+    ClusterRange clusterRanges[];
+};
+layout(std430, binding = 9) readonly buffer LightIndexBlock
+{
+    uint lightIndices[];
+};
+
+// Directional light and the shadow maps (binding point 2, texture units 12 and 13)
+layout(std140, binding = 2) uniform ShadowBlock
+{
+    mat4 cascadeViewProjection[3];
+    vec4 cascadeSplits;      // xyz: view depth at which each cascade ends
+    vec4 cascadeTexelSizes;  // xyz: world-space size of a texel of each cascade
+    vec4 directionalLight;   // xyz: direction the light travels, w: 1 when the cascades are valid
+    vec4 directionalColor;
+    uvec4 shadowCounts;      // x: point lights, from the first, with a cube shadow map
+};
+layout(binding = 12) uniform sampler2DArrayShadow shadowCascades;
+layout(binding = 13) uniform sampler2DArrayShadow shadowCubes; // six layers, one per cube face, for each light
+
+// Fraction of the directional light reaching a position: 1 beyond the last cascade or without shadow maps
+float directionalShadow(vec3 position, vec3 norm)
+{
+    if (directionalLight.w == 0.0f)
+        return 1.0f;
+    float depth = -(view * vec4(position, 1.0f)).z;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (depth > cascadeSplits[i])
+            continue;
+        // Moving the lookup about a texel along the normal keeps surfaces from shadowing themselves
+        vec3 offsetPosition = position + norm * (1.5f * cascadeTexelSizes[i]);
+        vec3 coord = (cascadeViewProjection[i] * vec4(offsetPosition, 1.0f)).xyz * 0.5f + 0.5f;
+        return texture(shadowCascades, vec4(coord.xy, float(i), coord.z - 0.0005f));
+    }
+    return 1.0f;
+}
+
+// Cube face a direction from a point light falls on, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, and the coordinates
+// on that face as ShadowRenderer renders it: x and y are the texture coordinates, z the face
+vec3 cubeFaceCoord(vec3 v)
+{
+    vec3 a = abs(v);
+    if (a.x >= a.y && a.x >= a.z)
+        return vec3(vec2(v.x > 0.0f ? -v.z : v.z, -v.y) / a.x * 0.5f + 0.5f, v.x > 0.0f ? 0.0f : 1.0f);
+    if (a.y >= a.z)
+        return vec3(vec2(v.x, v.y > 0.0f ? v.z : -v.z) / a.y * 0.5f + 0.5f, v.y > 0.0f ? 2.0f : 3.0f);
+    return vec3(vec2(v.z > 0.0f ? v.x : -v.x, -v.y) / a.z * 0.5f + 0.5f, v.z > 0.0f ? 4.0f : 5.0f);
+}
+
+// Fraction of a point light reaching a position; the cube maps store the distance to the light over its radius
+float pointShadow(uint light, vec3 position, vec3 norm)
+{
+    if (light >= shadowCounts.x)
+        return 1.0f;
+    vec4 positionRadius = lights[light].positionRadius;
+    vec3 fromLight = position + norm * 0.03f - positionRadius.xyz;
+    vec3 coord = cubeFaceCoord(fromLight);
+    return texture(shadowCubes, vec4(coord.xy, float(light * 6u) + coord.z, length(fromLight) / positionRadius.w - 0.003f));
+}
+
+// Diffuse and specular light of the directional light
+vec3 directionalLighting(vec3 position, vec3 norm, vec3 viewDir, float specularIntensity, float highlightSize)
+{
+    float impact = max(dot(norm, -directionalLight.xyz), 0.0f);
+    if (impact <= 0.0f)
+        return vec3(0.0f);
+    float specularComponent = pow(max(dot(viewDir, reflect(directionalLight.xyz, norm)), 0.0f), highlightSize);
+    return (impact + specularIntensity * specularComponent) * directionalColor.rgb * directionalShadow(position, norm);
+}
+
+vec3 decodeNormal(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0f)
+        normal.xy = (1.0f - abs(normal.yx)) * vec2(normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f);
+    return normalize(normal);
+}
+
+// The cluster of a world-space position at this pixel
+uint findCluster(vec3 position)
+{
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterParams.xy), clusterGrid.xy - 1u);
+    float depth = max(-(view * vec4(position, 1.0f)).z, 1e-4f);
+    uint slice = uint(clamp(log(depth) * clusterParams.z + clusterParams.w, 0.0f, float(clusterGrid.z - 1u)));
+    return tile.x + clusterGrid.x * (tile.y + clusterGrid.y * slice);
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth >= 1.0f)
+        discard; // nothing was drawn here; the target keeps its clear color
+    gl_FragDepth = depth;
+
+    vec4 albedo = texelFetch(gAlbedo, pixel, 0);
+    if (albedo.a == 0.0f)
+    {
+        fragmentColor = vec4(albedo.rgb, 1.0f);
+        return;
+    }
+
+    // World-space position from the pixel's depth
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0f - 1.0f;
+    vec4 world = inverseViewProjection * vec4(ndc, depth * 2.0f - 1.0f, 1.0f);
+    vec3 position = world.xyz / world.w;
+
+    vec3 norm = decodeNormal(texelFetch(gNormal, pixel, 0).xy);
+    vec3 lightColor = draws[texelFetch(gDrawId, pixel, 0).r].lightColor.rgb;
+    vec3 viewDir = normalize(viewPosition.xyz - position);
+    float specularIntensity = 0.8f;
+    float highlightSize = 16.0f;
+
+    // Key light: ambient, diffuse and specular
+    vec3 lightDirection = normalize(lightPos - position);
+    float impact = max(dot(norm, lightDirection), 0.0f);
+    float specularComponent = pow(max(dot(viewDir, reflect(-lightDirection, norm)), 0.0f), highlightSize);
+    vec3 shading = (0.8f + impact + specularIntensity * specularComponent) * lightColor;
+
+    // Directional light, then the point lights of the pixel's cluster
+    shading += directionalLighting(position, norm, viewDir, specularIntensity, highlightSize);
+
+    ClusterRange range = clusterRanges[findCluster(position)];
+    for (uint i = 0u; i < range.count; ++i)
+    {
+        uint index = lightIndices[range.offset + i];
+        PointLight light = lights[index];
+        vec3 toLight = light.positionRadius.xyz - position;
+        float distance = length(toLight);
+        float fade = clamp(1.0f - (distance * distance) / (light.positionRadius.w * light.positionRadius.w), 0.0f, 1.0f);
+        if (fade <= 0.0f)
+            continue;
+        vec3 pointDirection = toLight / distance;
+        float pointImpact = max(dot(norm, pointDirection), 0.0f);
+        float pointSpecular = pow(max(dot(viewDir, reflect(-pointDirection, norm)), 0.0f), highlightSize);
+        shading += fade * fade * (pointImpact + specularIntensity * pointSpecular) * light.color.rgb
+            * pointShadow(index, position, norm);
+    }
+
+    fragmentColor = vec4(shading * albedo.rgb, 1.0f);
+}
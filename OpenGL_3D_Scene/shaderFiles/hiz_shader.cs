@@ -0,0 +1,39 @@
+#version 440 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+// One level of the Hi-Z pyramid: either a copy of the depth buffer (level 0) or the farthest depth of the texels
+// below it. The last texel of a row or column also takes the leftover texel of an odd sized level, so every texel
+// covers all of the pixels it stands for.
+layout(binding = 16) uniform sampler2D depthTexture; // the captured depth buffer, read when fromDepth is set
+layout(r32f, binding = 0) readonly uniform image2D sourceLevel;
+layout(r32f, binding = 1) writeonly uniform image2D targetLevel;
+
+uniform bool fromDepth;
+
+void main()
+{
+    ivec2 target = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 targetSize = imageSize(targetLevel);
+    if (any(greaterThanEqual(target, targetSize)))
+        return;
+
+    if (fromDepth)
+    {
+        imageStore(targetLevel, target, vec4(texelFetch(depthTexture, target, 0).r));
+        return;
+    }
+
+    ivec2 sourceSize = imageSize(sourceLevel);
+    ivec2 first = target * 2;
+    ivec2 last = min(first + 1, sourceSize - 1);
+    if (target.x == targetSize.x - 1)
+        last.x = sourceSize.x - 1;
+    if (target.y == targetSize.y - 1)
+        last.y = sourceSize.y - 1;
+
+    float farthest = 0.0f;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, imageLoad(sourceLevel, ivec2(x, y)).r);
+    imageStore(targetLevel, target, vec4(farthest));
+}
@@ -1,7 +1,9 @@
 #version 440 core
+in vec4 lampColor; // For incoming lamp color from the instance data
+
 out vec4 fragmentColor; // For outgoing lamp color (smaller cube) to the GPU
 
 void main()
 {
-    fragmentColor = vec4(1.0f); // Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
-}
\ No newline at end of file
+    fragmentColor = lampColor; // Each lamp instance carries its own color (white for the ceiling lights)
+}
@@ -1,12 +1,20 @@
 #version 440 core
 layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 3) in mat4 instanceModel; // VAP positions 3-6: per-instance model matrix
+layout(location = 7) in vec4 instanceColor; // VAP position 7: per-instance lamp color
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+out vec4 lampColor; // For outgoing lamp color to the fragment shader
+
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    gl_Position = projection * view * instanceModel * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    lampColor = instanceColor;
 }
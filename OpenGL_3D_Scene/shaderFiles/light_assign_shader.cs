@@ -0,0 +1,105 @@
+#version 440 core
+layout(local_size_x = 64) in;
+
+// One invocation per cluster: tests every light's sphere against the cluster's view-space box and writes the lights
+// that reach it into the cluster's fixed slot of the index list. The workgroup moves the lights to view space
+// together, one batch at a time through shared memory, so each light is transformed once per group.
+
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
+
+// Cluster grid (binding point 1)
+layout(std140, binding = 1) uniform ClusterBlock
+{
+    uvec4 clusterGrid;   // xyz: cluster counts, w: number of lights
+    vec4 clusterParams;  // xy: pixels per tile, z and w: scale and bias mapping log(view depth) to a slice
+};
+
+struct PointLight
+{
+    vec4 positionRadius; // xyz: world-space position, w: distance at which the light fades out completely
+    vec4 color;
+};
+layout(std430, binding = 7) readonly buffer LightBlock
+{
+    PointLight lights[];
+};
+
+struct ClusterRange
+{
+    uint offset;
+    uint count;
+};
+layout(std430, binding = 8) writeonly buffer ClusterRangeBlock
+{
+    ClusterRange ranges[];
+};
+layout(std430, binding = 9) writeonly buffer LightIndexBlock
+{
+    uint lightIndices[];
+};
+
+struct ClusterBounds
+{
+    vec4 lower;
+    vec4 upper;
+};
+layout(std430, binding = 10) readonly buffer ClusterBoundsBlock
+{
+    ClusterBounds bounds[];
+};
+
+const uint MAX_LIGHTS_PER_CLUSTER = 64u; // ClusteredLighting::MAX_LIGHTS_PER_CLUSTER
+const uint BATCH_SIZE = 64u;             // local_size_x
+
+shared vec4 batchLights[BATCH_SIZE]; // xyz: view-space position, w: radius
+
+void main()
+{
+    uint cluster = gl_GlobalInvocationID.x;
+    uint clusterCount = clusterGrid.x * clusterGrid.y * clusterGrid.z;
+    bool inGrid = cluster < clusterCount;
+
+    vec3 lower = vec3(0.0f);
+    vec3 upper = vec3(0.0f);
+    if (inGrid)
+    {
+        lower = bounds[cluster].lower.xyz;
+        upper = bounds[cluster].upper.xyz;
+    }
+
+    uint count = 0u;
+    uint lightCount = clusterGrid.w;
+    for (uint first = 0u; first < lightCount; first += BATCH_SIZE)
+    {
+        // Every invocation, in the grid or not, loads one light and reaches both barriers
+        uint light = first + gl_LocalInvocationID.x;
+        if (light < lightCount)
+        {
+            vec4 sphere = lights[light].positionRadius;
+            batchLights[gl_LocalInvocationID.x] = vec4((view * vec4(sphere.xyz, 1.0f)).xyz, sphere.w);
+        }
+        barrier();
+
+        uint batchCount = min(BATCH_SIZE, lightCount - first);
+        for (uint i = 0u; inGrid && i < batchCount; ++i)
+        {
+            vec4 sphere = batchLights[i];
+            vec3 outside = max(max(lower - sphere.xyz, sphere.xyz - upper), vec3(0.0f));
+            if (dot(outside, outside) <= sphere.w * sphere.w && count < MAX_LIGHTS_PER_CLUSTER)
+            {
+                lightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + count] = first + i;
+                ++count;
+            }
+        }
+        barrier();
+    }
+
+    if (inGrid)
+        ranges[cluster] = ClusterRange(cluster * MAX_LIGHTS_PER_CLUSTER, count);
+}
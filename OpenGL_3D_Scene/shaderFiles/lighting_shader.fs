@@ -1,21 +1,203 @@
 #version 440 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#extension GL_NV_gpu_shader5 : require // the handle index varies across the book's faces within one draw
+#endif
 in vec3 vertexNormal; // For incoming normals
 in vec3 vertexFragmentPos; // For incoming fragment position
 in vec2 vertexTextureCoordinate;
+flat in vec3 vertexLightColor; // Per-draw light color
+flat in uint vertexTextureIndex; // Per-draw texture array unit
+flat in uint vertexTextureLayer; // Layer in that array, or bindless handle index; constant across each face
+flat in uint vertexDrawId;
 
+#ifdef GBUFFER
+// Deferred path: the surface is stored for the lighting pass instead of shaded here
+layout(location = 0) out vec4 gAlbedo;  // rgb: albedo, a: 1 marks a lit surface
+layout(location = 1) out vec2 gNormal;  // octahedral world-space normal
+layout(location = 2) out uint gDrawId;  // selects the draw's light color in the lighting pass
+#else
 out vec4 fragmentColor; // For outgoing cube color to the GPU
+#endif
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 lightColor;
+// Uniform / Global variables for light position and texture scale
 uniform vec3 lightPos;
-uniform vec3 viewPosition;
-uniform sampler2D uTexture; // Useful when working with multiple textures
+#ifdef BINDLESS_TEXTURES
+// Resident handle of every scene texture (binding point 2), indexed by the layer
+layout(std430, binding = 2) readonly buffer TextureHandleBlock
+{
+    uvec2 textureHandles[];
+};
+#else
+uniform sampler2DArray uTextures[8]; // Every scene texture array, one per unit; the index is constant across each draw
+#endif
 uniform vec2 uvScale;
 
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
+
+// Cluster grid of the clustered point lights (binding point 1)
+layout(std140, binding = 1) uniform ClusterBlock
+{
+    uvec4 clusterGrid;   // xyz: cluster counts, w: number of lights
+    vec4 clusterParams;  // xy: pixels per tile, z and w: scale and bias mapping log(view depth) to a slice
+};
+
+// Point lights and the per-cluster lists into them (binding points 7, 8 and 9)
+struct PointLight
+{
+    vec4 positionRadius; // xyz: world-space position, w: distance at which the light fades out completely
+    vec4 color;          // rgb: color scaled by intensity
+};
+layout(std430, binding = 7) readonly buffer LightBlock
+{
+    PointLight lights[];
+};
+struct ClusterRange
+{
+    uint offset;
+    uint count;
+};
+layout(std430, binding = 8) readonly buffer ClusterRangeBlock
+{
+    ClusterRange clusterRanges[];
+};
+layout(std430, binding = 9) readonly buffer LightIndexBlock
+{
+    uint lightIndices[];
+};
+
+// Directional light and the shadow maps (binding point 2, texture units 12 and 13)
+layout(std140, binding = 2) uniform ShadowBlock
+{
+    mat4 cascadeViewProjection[3];
+    vec4 cascadeSplits;      // xyz: view depth at which each cascade ends
+    vec4 cascadeTexelSizes;  // xyz: world-space size of a texel of each cascade
+    vec4 directionalLight;   // xyz: direction the light travels, w: 1 when the cascades are valid
+    vec4 directionalColor;
+    uvec4 shadowCounts;      // x: point lights, from the first, with a cube shadow map
+};
+layout(binding = 12) uniform sampler2DArrayShadow shadowCascades;
+layout(binding = 13) uniform sampler2DArrayShadow shadowCubes; // six layers, one per cube face, for each light
+
+// Fraction of the directional light reaching a position: 1 beyond the last cascade or without shadow maps
+float directionalShadow(vec3 position, vec3 norm)
+{
+    if (directionalLight.w == 0.0f)
+        return 1.0f;
+    float depth = -(view * vec4(position, 1.0f)).z;
+    for (int i = 0; i < 3; ++i)
+    {
+        if (depth > cascadeSplits[i])
+            continue;
+        // Moving the lookup about a texel along the normal keeps surfaces from shadowing themselves
+        vec3 offsetPosition = position + norm * (1.5f * cascadeTexelSizes[i]);
+        vec3 coord = (cascadeViewProjection[i] * vec4(offsetPosition, 1.0f)).xyz * 0.5f + 0.5f;
+        return texture(shadowCascades, vec4(coord.xy, float(i), coord.z - 0.0005f));
+    }
+    return 1.0f;
+}
+
+// Cube face a direction from a point light falls on, in GL_TEXTURE_CUBE_MAP_POSITIVE_X order, and the coordinates
+// on that face as ShadowRenderer renders it: x and y are the texture coordinates, z the face
+vec3 cubeFaceCoord(vec3 v)
+{
+    vec3 a = abs(v);
+    if (a.x >= a.y && a.x >= a.z)
+        return vec3(vec2(v.x > 0.0f ? -v.z : v.z, -v.y) / a.x * 0.5f + 0.5f, v.x > 0.0f ? 0.0f : 1.0f);
+    if (a.y >= a.z)
+        return vec3(vec2(v.x, v.y > 0.0f ? v.z : -v.z) / a.y * 0.5f + 0.5f, v.y > 0.0f ? 2.0f : 3.0f);
+    return vec3(vec2(v.z > 0.0f ? v.x : -v.x, -v.y) / a.z * 0.5f + 0.5f, v.z > 0.0f ? 4.0f : 5.0f);
+}
+
+// Fraction of a point light reaching a position; the cube maps store the distance to the light over its radius
+float pointShadow(uint light, vec3 position, vec3 norm)
+{
+    if (light >= shadowCounts.x)
+        return 1.0f;
+    vec4 positionRadius = lights[light].positionRadius;
+    vec3 fromLight = position + norm * 0.03f - positionRadius.xyz;
+    vec3 coord = cubeFaceCoord(fromLight);
+    return texture(shadowCubes, vec4(coord.xy, float(light * 6u) + coord.z, length(fromLight) / positionRadius.w - 0.003f));
+}
+
+// Diffuse and specular light of the directional light
+vec3 directionalLighting(vec3 position, vec3 norm, vec3 viewDir, float specularIntensity, float highlightSize)
+{
+    float impact = max(dot(norm, -directionalLight.xyz), 0.0f);
+    if (impact <= 0.0f)
+        return vec3(0.0f);
+    float specularComponent = pow(max(dot(viewDir, reflect(directionalLight.xyz, norm)), 0.0f), highlightSize);
+    return (impact + specularIntensity * specularComponent) * directionalColor.rgb * directionalShadow(position, norm);
+}
+
+// The cluster this fragment falls in: its screen tile and the logarithmic slice of its view depth
+uint findCluster()
+{
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / clusterParams.xy), clusterGrid.xy - 1u);
+    float depth = max(-(view * vec4(vertexFragmentPos, 1.0f)).z, 1e-4f);
+    uint slice = uint(clamp(log(depth) * clusterParams.z + clusterParams.w, 0.0f, float(clusterGrid.z - 1u)));
+    return tile.x + clusterGrid.x * (tile.y + clusterGrid.y * slice);
+}
+
+// Diffuse and specular light of the point lights reaching this fragment's cluster, shadowed where they have a cube map
+vec3 clusterLighting(vec3 norm, vec3 viewDir, float specularIntensity, float highlightSize)
+{
+    vec3 result = vec3(0.0f);
+    ClusterRange range = clusterRanges[findCluster()];
+    for (uint i = 0u; i < range.count; ++i)
+    {
+        uint index = lightIndices[range.offset + i];
+        PointLight light = lights[index];
+        vec3 toLight = light.positionRadius.xyz - vertexFragmentPos;
+        float distance = length(toLight);
+        float fade = clamp(1.0f - (distance * distance) / (light.positionRadius.w * light.positionRadius.w), 0.0f, 1.0f);
+        if (fade <= 0.0f)
+            continue;
+        vec3 lightDirection = toLight / distance;
+        float impact = max(dot(norm, lightDirection), 0.0f);
+        float specularComponent = pow(max(dot(viewDir, reflect(-lightDirection, norm)), 0.0f), highlightSize);
+        result += fade * fade * (impact + specularIntensity * specularComponent) * light.color.rgb
+            * pointShadow(index, vertexFragmentPos, norm);
+    }
+    return result;
+}
+
+vec4 sampleSceneTexture(vec2 uv)
+{
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(textureHandles[vertexTextureLayer]), uv);
+#else
+    return texture(uTextures[vertexTextureIndex], vec3(uv, vertexTextureLayer));
+#endif
+}
+
+#ifdef GBUFFER
+// Octahedral mapping: the unit sphere folded onto a square, so two components hold a normal with even precision
+vec2 encodeNormal(vec3 normal)
+{
+    normal /= abs(normal.x) + abs(normal.y) + abs(normal.z);
+    if (normal.z < 0.0f)
+        normal.xy = (1.0f - abs(normal.yx)) * vec2(normal.x >= 0.0f ? 1.0f : -1.0f, normal.y >= 0.0f ? 1.0f : -1.0f);
+    return normal.xy;
+}
+
+void main()
+{
+    gAlbedo = vec4(sampleSceneTexture(vertexTextureCoordinate * uvScale).rgb, 1.0f);
+    gNormal = encodeNormal(normalize(vertexNormal));
+    gDrawId = vertexDrawId;
+}
+#else
 void main()
 {
     /*Phong lighting model calculations to generate ambient, diffuse, and specular components*/
+    vec3 lightColor = vertexLightColor;
 
     //Calculate Ambient lighting*/
     float ambientStrength = 0.8f; // Set ambient or global lighting strength
@@ -30,17 +212,20 @@ void main()
     //Calculate Specular lighting*/
     float specularIntensity = 0.8f; // Set specular light strength
     float highlightSize = 16.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+    vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos); // Calculate view direction
     vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
     //Calculate specular component
     float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
     vec3 specular = specularIntensity * specularComponent * lightColor;
 
     // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec4 textureColor = sampleSceneTexture(vertexTextureCoordinate * uvScale);
 
-    // Calculate phong result
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+    // Calculate phong result, adding the directional light and the point lights of the fragment's cluster
+    vec3 sun = directionalLighting(vertexFragmentPos, norm, viewDir, specularIntensity, highlightSize);
+    vec3 points = clusterLighting(norm, viewDir, specularIntensity, highlightSize);
+    vec3 phong = (ambient + diffuse + specular + sun + points) * textureColor.xyz;
 
     fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -2,22 +2,50 @@
 layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 layout(location = 1) in vec3 normal; // VAP position 1 for normals
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 8) in uint drawId; // index of the draw in the multi-draw, advanced once per draw through baseInstance
+layout(location = 9) in float layerOffset; // texture array layer relative to the draw's base layer; 0 when the mesh has none
 
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
+flat out vec3 vertexLightColor;
+flat out uint vertexTextureIndex;
+flat out uint vertexTextureLayer;
+flat out uint vertexDrawId; // read by the G-buffer variant of the fragment shader
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-draw data written by the draw list; drawId selects this draw's entry (binding point 1)
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix; // object to world space for normals, computed once per draw on the CPU
+    vec4 lightColor;
+    uvec4 material; // x: texture array unit, y: base layer
+};
+layout(std430, binding = 1) readonly buffer DrawBlock
+{
+    DrawData draws[];
+};
+
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
 
 void main()
 {
+    mat4 model = draws[drawId].model;
+
     gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 
     vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
+    vertexNormal = draws[drawId].normalMatrix * normal; // normal vectors in world space; the fragment shader normalizes them
     vertexTextureCoordinate = textureCoordinate;
+    vertexLightColor = draws[drawId].lightColor.rgb;
+    vertexTextureIndex = draws[drawId].material.x;
+    vertexTextureLayer = draws[drawId].material.y + uint(layerOffset);
+    vertexDrawId = drawId;
 }
\ No newline at end of file
@@ -0,0 +1,16 @@
+#version 440 core
+
+// Depth of a shadow caster as seen from a light; nothing else is written
+
+in vec3 vertexWorldPos;
+
+uniform vec4 lightPositionRange; // xyz: point light position, w: its radius; w is 0 for the directional light
+
+void main()
+{
+    // Cube maps hold the linear distance to the point light over its radius, which is what the lighting compares
+    if (lightPositionRange.w > 0.0f)
+        gl_FragDepth = distance(vertexWorldPos, lightPositionRange.xyz) / lightPositionRange.w;
+    else
+        gl_FragDepth = gl_FragCoord.z;
+}
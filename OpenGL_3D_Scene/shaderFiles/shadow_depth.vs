@@ -0,0 +1,27 @@
+#version 440 core
+layout(location = 0) in vec3 position;
+layout(location = 8) in uint drawId; // index of the draw in the multi-draw, advanced once per draw through baseInstance
+
+out vec3 vertexWorldPos;
+
+// Per-draw data written by the render queue (binding point 1)
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec4 lightColor;
+    uvec4 material;
+};
+layout(std430, binding = 1) readonly buffer DrawBlock
+{
+    DrawData draws[];
+};
+
+uniform mat4 lightViewProjection; // the cascade's or cube face's view and projection
+
+void main()
+{
+    vec4 world = draws[drawId].model * vec4(position, 1.0f);
+    vertexWorldPos = world.xyz;
+    gl_Position = lightViewProjection * world;
+}
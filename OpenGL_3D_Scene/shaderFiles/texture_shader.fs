@@ -1,12 +1,48 @@
 #version 440 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#extension GL_NV_gpu_shader5 : require // the handle index varies across the book's faces within one draw
+#endif
 in vec2 vertexTextureCoordinate;
+flat in uint vertexTextureIndex; // Per-draw texture array unit
+flat in uint vertexTextureLayer; // Layer in that array, or bindless handle index; constant across each face
 
+#ifdef GBUFFER
+// Deferred path: unlit surfaces are stored with a zero shading flag so the lighting pass passes their color through
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec2 gNormal;
+layout(location = 2) out uint gDrawId;
+#else
 out vec4 fragmentColor;
+#endif
 
-uniform sampler2D uTexture;
+#ifdef BINDLESS_TEXTURES
+// Resident handle of every scene texture (binding point 2), indexed by the layer
+layout(std430, binding = 2) readonly buffer TextureHandleBlock
+{
+    uvec2 textureHandles[];
+};
+#else
+uniform sampler2DArray uTextures[8]; // Every scene texture array, one per unit; the index is constant across each draw
+#endif
 uniform vec2 uvScale;
 
+vec4 sampleSceneTexture(vec2 uv)
+{
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(textureHandles[vertexTextureLayer]), uv);
+#else
+    return texture(uTextures[vertexTextureIndex], vec3(uv, vertexTextureLayer));
+#endif
+}
+
 void main()
 {
-    fragmentColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+#ifdef GBUFFER
+    gAlbedo = vec4(sampleSceneTexture(vertexTextureCoordinate * uvScale).rgb, 0.0f);
+    gNormal = vec2(0.0f);
+    gDrawId = 0u;
+#else
+    fragmentColor = sampleSceneTexture(vertexTextureCoordinate * uvScale);
+#endif
 }
\ No newline at end of file
@@ -1,18 +1,39 @@
 #version 440 core
 layout(location = 0) in vec3 position;
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 8) in uint drawId; // index of the draw in the multi-draw, advanced once per draw through baseInstance
+layout(location = 9) in float layerOffset; // texture array layer relative to the draw's base layer; 0 when the mesh has none
 
 out vec2 vertexTextureCoordinate;
+flat out uint vertexTextureIndex;
+flat out uint vertexTextureLayer;
 
+// Per-draw data written by the draw list; drawId selects this draw's entry (binding point 1)
+struct DrawData
+{
+    mat4 model;
+    mat3 normalMatrix; // object to world space for normals, computed once per draw on the CPU
+    vec4 lightColor;
+    uvec4 material; // x: texture array unit, y: base layer
+};
+layout(std430, binding = 1) readonly buffer DrawBlock
+{
+    DrawData draws[];
+};
 
-//Global variables for the transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame camera data shared by all shader programs (binding point 0)
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPosition; // xyz: camera position in world space
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+    gl_Position = projection * view * draws[drawId].model * vec4(position, 1.0f); // transforms vertices to clip coordinates
     vertexTextureCoordinate = textureCoordinate;
+    vertexTextureIndex = draws[drawId].material.x;
+    vertexTextureLayer = draws[drawId].material.y + uint(layerOffset);
 }
 
@@ -0,0 +1,318 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Shadow renderer
+// Description: Cascade fitting, the cached static shadow maps and the per-frame composite of dynamic casters.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // min, max
+#include <cmath>            // ceil, floor, abs, pow
+
+#include "shadow_renderer.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const float SHADOW_DISTANCE = 20.0f;    // view depth the cascades reach; the directional light is unshadowed beyond
+    const float SPLIT_LAMBDA = 0.7f;        // blend of logarithmic (1) and uniform (0) cascade splits
+    const float GUARD_BAND = 1.25f;         // a refitted cascade covers this much more than its frustum slice
+    const float CASTER_DEPTH = 20.0f;       // distance toward the light at which casters outside the slice still count
+    const float CUBE_NEAR = 0.05f;
+
+    // Look direction and up vector of each cube face, in the order of GL_TEXTURE_CUBE_MAP_POSITIVE_X onward; the
+    // shaders' cubeFaceCoord maps a direction to the same face and texel
+    const glm::vec3 CUBE_FACES[6][2] =
+    {
+        { glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+        { glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+        { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) },
+        { glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f) },
+        { glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+        { glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f) },
+    };
+}
+
+
+bool ShadowRenderer::Create(bool shadows)
+{
+    mEnabled = shadows;
+    mBlock = ShadowBlock();
+    mShadowBuffer.create(SHADOW_BLOCK_BINDING);
+    mShadowBuffer.update(mBlock);
+    if (!mEnabled)
+    {
+        cout << "INFO: Shadows off" << endl;
+        return true;
+    }
+
+    Shader depthShader("shaderFiles/shadow_depth.vs", "shaderFiles/shadow_depth.fs");
+    GLint linked = GL_FALSE;
+    glGetProgramiv(depthShader.ID, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        cout << "Shadow depth program failed to build" << endl;
+        glDeleteProgram(depthShader.ID);
+        mShadowBuffer.destroy();
+        return false;
+    }
+    mDepthProgram = depthShader.ID;
+    mLightViewProjection = depthShader.uniform<glm::mat4>("lightViewProjection");
+    mLightPositionRange = depthShader.uniform<glm::vec4>("lightPositionRange");
+
+    mCascadeCache = CreateDepthArray(GL_TEXTURE_2D_ARRAY, CASCADE_SIZE, CASCADE_COUNT);
+    mCubeCache = CreateDepthArray(GL_TEXTURE_2D_ARRAY, CUBE_SIZE, MAX_POINT_SHADOWS * 6);
+
+    // Depth only: the layer is attached per pass
+    GLint targetFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+    glGenFramebuffers(1, &mFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+
+    mStaticCasters.Create();
+    mDynamicCasters.Create();
+    mStaticDirty = true;
+
+    // 3 bytes of depth per texel, padded to 4
+    const size_t bytes = (static_cast<size_t>(CASCADE_SIZE) * CASCADE_SIZE * CASCADE_COUNT
+        + static_cast<size_t>(CUBE_SIZE) * CUBE_SIZE * MAX_POINT_SHADOWS * 6) * 4;
+    cout << "INFO: Shadow maps " << CASCADE_COUNT << " cascades of " << CASCADE_SIZE << "x" << CASCADE_SIZE << ", "
+        << MAX_POINT_SHADOWS << " cube maps of " << CUBE_SIZE << "x" << CUBE_SIZE << ", " << bytes / (1024 * 1024) << " MB cached" << endl;
+    return true;
+}
+
+void ShadowRenderer::Destroy()
+{
+    mShadowBuffer.destroy();
+    glDeleteProgram(mDepthProgram);
+    glDeleteFramebuffers(1, &mFramebuffer);
+    glDeleteTextures(1, &mCascadeCache);
+    glDeleteTextures(1, &mCubeCache);
+    glDeleteTextures(1, &mCascadeFrame);
+    glDeleteTextures(1, &mCubeFrame);
+    mStaticCasters.Destroy();
+    mDynamicCasters.Destroy();
+    mDepthProgram = mFramebuffer = mCascadeCache = mCubeCache = mCascadeFrame = mCubeFrame = 0;
+    mCachedLightCount = 0;
+    for (Cascade& cascade : mCascades)
+        cascade.valid = false;
+    mEnabled = false;
+}
+
+void ShadowRenderer::InvalidateStatic()
+{
+    mStaticDirty = true;
+}
+
+void ShadowRenderer::SetDirectionalLight(const glm::vec3& direction, const glm::vec3& color)
+{
+    mLightDirection = glm::normalize(direction);
+    const glm::vec3 up = abs(mLightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    mLightView = glm::lookAt(glm::vec3(0.0f), mLightDirection, up);
+    mBlock.lightDirection = glm::vec4(mLightDirection, 0.0f);
+    mBlock.lightColor = glm::vec4(color, 0.0f);
+    for (Cascade& cascade : mCascades)
+        cascade.valid = false;
+    mShadowBuffer.update(mBlock); // with shadows off Update never uploads it
+}
+
+// Depth texture compared in the shaders: LINEAR filtering gives 2x2 percentage-closer filtering in hardware
+//-----------------------------------------------------------------------------------------------------------
+GLuint ShadowRenderer::CreateDepthArray(GLenum target, int size, int layers)
+{
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(target, texture);
+    glTexStorage3D(target, 1, GL_DEPTH_COMPONENT24, size, size, layers);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(target, 0);
+    return texture;
+}
+
+// Keeps the cascade's light-space box while the bounding sphere of its frustum slice stays inside it; otherwise
+// recenters it on the sphere, snapped to whole texels, and reports that the cascade must be redrawn
+//----------------------------------------------------------------------------------------------------------------
+bool ShadowRenderer::FitCascade(int index, const glm::vec3 corners[8])
+{
+    glm::vec3 center(0.0f);
+    for (int corner = 0; corner < 8; ++corner)
+        center += corners[corner];
+    center /= 8.0f;
+
+    float radius = 0.0f;
+    for (int corner = 0; corner < 8; ++corner)
+        radius = max(radius, glm::length(corners[corner] - center));
+    radius = ceil(radius * 16.0f) / 16.0f; // the slice's shape does not change with the camera, only float noise does
+
+    const glm::vec3 lightCenter = glm::vec3(mLightView * glm::vec4(center, 1.0f));
+    Cascade& cascade = mCascades[index];
+    if (cascade.valid && radius >= 0.5f * cascade.halfSize)
+    {
+        const glm::vec3 offset = lightCenter - cascade.center;
+        if (max(abs(offset.x), max(abs(offset.y), abs(offset.z))) + radius <= cascade.halfSize)
+            return false;
+    }
+
+    cascade.halfSize = radius * GUARD_BAND;
+    const float texel = 2.0f * cascade.halfSize / CASCADE_SIZE;
+    cascade.center = glm::vec3(floor(lightCenter.x / texel) * texel, floor(lightCenter.y / texel) * texel, lightCenter.z);
+    cascade.valid = true;
+
+    // The light looks down -z, so the depth range starts CASTER_DEPTH closer to the light than the box
+    const float depth = -cascade.center.z;
+    const glm::mat4 projection = glm::ortho(cascade.center.x - cascade.halfSize, cascade.center.x + cascade.halfSize,
+        cascade.center.y - cascade.halfSize, cascade.center.y + cascade.halfSize,
+        depth - cascade.halfSize - CASTER_DEPTH, depth + cascade.halfSize);
+    cascade.viewProjection = projection * mLightView;
+    return true;
+}
+
+void ShadowRenderer::RenderPass(GLStateCache& state, RenderQueue& casters, GLuint texture, int layer, int size,
+    const glm::mat4& viewProjection, const glm::vec4& lightPositionRange, bool clear)
+{
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    glViewport(0, 0, size, size);
+    if (clear)
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+    // Every caster uses the depth program, so the queue's own UseProgram is skipped by the cache
+    state.UseProgram(mDepthProgram);
+    Shader::set(mLightViewProjection, viewProjection);
+    Shader::set(mLightPositionRange, lightPositionRange);
+    casters.Submit(state);
+
+    ++mRenderedPasses;
+    mDrawCalls += casters.SubmitCalls();
+}
+
+void ShadowRenderer::Update(GLStateCache& state, const glm::mat4& view, const glm::mat4& projection, const vector<PointLight>& lights)
+{
+    mRenderedPasses = mDrawCalls = 0;
+    if (!mEnabled)
+        return;
+
+    GLint viewport[4];
+    GLint targetFramebuffer = 0;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &targetFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+
+    // Corners of the view frustum in view space; a slice's corners lie on the lines joining them
+    const glm::mat4 inverseProjection = glm::inverse(projection);
+    const glm::mat4 inverseView = glm::inverse(view);
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        const float x = (corner & 1) ? 1.0f : -1.0f;
+        const float y = (corner >> 1) ? 1.0f : -1.0f;
+        const glm::vec4 nearPoint = inverseProjection * glm::vec4(x, y, -1.0f, 1.0f);
+        const glm::vec4 farPoint = inverseProjection * glm::vec4(x, y, 1.0f, 1.0f);
+        nearCorners[corner] = glm::vec3(nearPoint) / nearPoint.w;
+        farCorners[corner] = glm::vec3(farPoint) / farPoint.w;
+    }
+    const float nearDepth = -nearCorners[0].z;
+    const float farDepth = -farCorners[0].z;
+    const float shadowDepth = min(farDepth, SHADOW_DISTANCE);
+
+    float splits[CASCADE_COUNT + 1];
+    for (int split = 0; split <= CASCADE_COUNT; ++split)
+    {
+        const float fraction = static_cast<float>(split) / CASCADE_COUNT;
+        const float logarithmic = nearDepth * pow(shadowDepth / nearDepth, fraction);
+        const float uniform = nearDepth + (shadowDepth - nearDepth) * fraction;
+        splits[split] = SPLIT_LAMBDA * logarithmic + (1.0f - SPLIT_LAMBDA) * uniform;
+    }
+
+    for (int index = 0; index < CASCADE_COUNT; ++index)
+    {
+        glm::vec3 corners[8];
+        for (int bound = 0; bound < 2; ++bound)
+        {
+            const float t = (splits[index + bound] - nearDepth) / (farDepth - nearDepth);
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                const glm::vec3 point = nearCorners[corner] + (farCorners[corner] - nearCorners[corner]) * t;
+                corners[bound * 4 + corner] = glm::vec3(inverseView * glm::vec4(point, 1.0f));
+            }
+        }
+
+        if (FitCascade(index, corners) || mStaticDirty)
+            RenderPass(state, mStaticCasters, mCascadeCache, index, CASCADE_SIZE, mCascades[index].viewProjection, glm::vec4(0.0f), true);
+        mBlock.cascadeViewProjection[index] = mCascades[index].viewProjection;
+        mBlock.cascadeSplits[index] = splits[index + 1];
+        mBlock.cascadeTexelSizes[index] = 2.0f * mCascades[index].halfSize / CASCADE_SIZE;
+    }
+
+    // A cube is redrawn only when its light moved or changed radius
+    const int lightCount = min(static_cast<int>(lights.size()), MAX_POINT_SHADOWS);
+    for (int light = 0; light < lightCount; ++light)
+    {
+        const glm::vec4& positionRange = lights[light].positionRadius;
+        if (!mStaticDirty && light < mCachedLightCount && mCachedLights[light] == positionRange)
+            continue;
+
+        const glm::vec3 position(positionRange);
+        const glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, CUBE_NEAR, positionRange.w);
+        for (int face = 0; face < 6; ++face)
+        {
+            const glm::mat4 faceView = glm::lookAt(position, position + CUBE_FACES[face][0], CUBE_FACES[face][1]);
+            RenderPass(state, mStaticCasters, mCubeCache, light * 6 + face, CUBE_SIZE, faceProjection * faceView, positionRange, true);
+        }
+        mCachedLights[light] = positionRange;
+    }
+    mCachedLightCount = lightCount;
+    mStaticDirty = false;
+
+    // Dynamic casters go over a copy of the cache, which stays untouched for the next frame
+    GLuint cascades = mCascadeCache;
+    GLuint cubes = mCubeCache;
+    if (mDynamicCasters.DrawCount() > 0)
+    {
+        if (!mCascadeFrame)
+        {
+            mCascadeFrame = CreateDepthArray(GL_TEXTURE_2D_ARRAY, CASCADE_SIZE, CASCADE_COUNT);
+            mCubeFrame = CreateDepthArray(GL_TEXTURE_2D_ARRAY, CUBE_SIZE, MAX_POINT_SHADOWS * 6);
+            state.Invalidate(); // CreateDepthArray binds textures directly
+        }
+        glCopyImageSubData(mCascadeCache, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mCascadeFrame, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            CASCADE_SIZE, CASCADE_SIZE, CASCADE_COUNT);
+        for (int index = 0; index < CASCADE_COUNT; ++index)
+            RenderPass(state, mDynamicCasters, mCascadeFrame, index, CASCADE_SIZE, mCascades[index].viewProjection, glm::vec4(0.0f), false);
+
+        if (lightCount > 0)
+        {
+            glCopyImageSubData(mCubeCache, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mCubeFrame, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                CUBE_SIZE, CUBE_SIZE, lightCount * 6);
+            for (int light = 0; light < lightCount; ++light)
+            {
+                const glm::vec4& positionRange = mCachedLights[light];
+                const glm::vec3 position(positionRange);
+                const glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, CUBE_NEAR, positionRange.w);
+                for (int face = 0; face < 6; ++face)
+                {
+                    const glm::mat4 faceView = glm::lookAt(position, position + CUBE_FACES[face][0], CUBE_FACES[face][1]);
+                    RenderPass(state, mDynamicCasters, mCubeFrame, light * 6 + face, CUBE_SIZE, faceProjection * faceView, positionRange, false);
+                }
+            }
+        }
+        cascades = mCascadeFrame;
+        cubes = mCubeFrame;
+    }
+    mDynamicCasters.Clear();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    mBlock.lightDirection.w = 1.0f;
+    mBlock.counts.x = static_cast<GLuint>(lightCount);
+    mShadowBuffer.update(mBlock);
+    state.BindTexture(CASCADE_UNIT, GL_TEXTURE_2D_ARRAY, cascades);
+    state.BindTexture(CUBE_UNIT, GL_TEXTURE_2D_ARRAY, cubes);
+}
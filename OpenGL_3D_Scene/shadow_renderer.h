@@ -0,0 +1,110 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Shadow maps: cascaded shadow maps for the directional light and a cube shadow map for each of the first point lights.
+ * Both are layers of 2D depth arrays, the cube faces six layers per light, so every lookup is a sampler2DArrayShadow one.
+ * Static casters are queued once and rendered into cached depth layers that are only redrawn when something they depend
+ * on changes: a cascade whose part of the view has left the area it covers, a light that moved, or InvalidateStatic.
+ * Dynamic casters are queued every frame and drawn over a copy of the cache, so a frame only pays for what moves.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef SHADOW_RENDERER_H
+#define SHADOW_RENDERER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+#include "clustered_lighting.h"
+#include "gl_state_cache.h"
+#include "render_queue.h"
+#include "shader.h"
+#include "uniform_buffer.h"
+
+class ShadowRenderer
+{
+public:
+    static const int CASCADE_COUNT = 3;
+    static const int CASCADE_SIZE = 1024;       // texels per side of each cascade
+    static const int MAX_POINT_SHADOWS = 8;     // point lights, from the front of the light list, that cast shadows
+    static const int CUBE_SIZE = 256;           // texels per side of each cube face
+    static const GLuint SHADOW_BLOCK_BINDING = 2;  // uniform block with the cascades and shadow counts
+    static const GLuint CASCADE_UNIT = 12;      // texture units of the cascade array and the cube face array
+    static const GLuint CUBE_UNIT = 13;
+
+    // With shadows off only the uniform block is kept, so the shaders light the scene unshadowed
+    bool Create(bool shadows);
+    void Destroy();
+
+    // Casters are queued with DepthProgram() and RenderQueue::NO_TEXTURES. Static casters stay queued until changed,
+    // which must be followed by InvalidateStatic; dynamic casters are cleared by every Update.
+    RenderQueue& StaticCasters() { return mStaticCasters; }
+    RenderQueue& DynamicCasters() { return mDynamicCasters; }
+    GLuint DepthProgram() const { return mDepthProgram; }
+    void InvalidateStatic();
+
+    // direction is the way the light travels
+    void SetDirectionalLight(const glm::vec3& direction, const glm::vec3& color);
+
+    // Brings the shadow maps up to date for this view and the lights that cast shadows (the first MAX_POINT_SHADOWS
+    // of lights) and binds them with the uniform block. Restores the framebuffer and viewport it found.
+    void Update(GLStateCache& state, const glm::mat4& view, const glm::mat4& projection, const std::vector<PointLight>& lights);
+
+    // Cascade and cube face passes drawn by the last Update, static refreshes and dynamic composites together
+    size_t RenderedPasses() const { return mRenderedPasses; }
+    size_t DrawCalls() const { return mDrawCalls; }
+
+private:
+    // std140 block read by the lighting shaders
+    struct ShadowBlock
+    {
+        glm::mat4 cascadeViewProjection[CASCADE_COUNT];
+        glm::vec4 cascadeSplits;        // xyz: view depth at which each cascade ends
+        glm::vec4 cascadeTexelSizes;    // xyz: world-space size of a texel of each cascade
+        glm::vec4 lightDirection;       // xyz: direction the directional light travels, w: 1 when its cascades are valid
+        glm::vec4 lightColor;           // rgb: color of the directional light
+        glm::uvec4 counts;              // x: point lights with a cube shadow map
+    };
+
+    // Light-space square a cascade covers; it only moves when the cascade's part of the view frustum leaves it
+    struct Cascade
+    {
+        glm::vec3 center = glm::vec3(0.0f);    // in the light's view space
+        float halfSize = 0.0f;
+        bool valid = false;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+    };
+
+    GLuint CreateDepthArray(GLenum target, int size, int layers);
+    bool FitCascade(int index, const glm::vec3 corners[8]);
+    void RenderPass(GLStateCache& state, RenderQueue& casters, GLuint texture, int layer, int size,
+        const glm::mat4& viewProjection, const glm::vec4& lightPositionRange, bool clear);
+
+    bool mEnabled = false;
+    UniformBuffer<ShadowBlock> mShadowBuffer;
+    ShadowBlock mBlock;
+    GLuint mDepthProgram = 0;
+    Uniform<glm::mat4> mLightViewProjection;
+    Uniform<glm::vec4> mLightPositionRange;
+    GLuint mFramebuffer = 0;
+
+    RenderQueue mStaticCasters;
+    RenderQueue mDynamicCasters;
+    bool mStaticDirty = true;
+
+    // Cached maps with the static casters, and the maps the dynamic casters are composited into
+    GLuint mCascadeCache = 0;
+    GLuint mCubeCache = 0;
+    GLuint mCascadeFrame = 0;
+    GLuint mCubeFrame = 0;
+
+    glm::vec3 mLightDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::mat4 mLightView = glm::mat4(1.0f);
+    Cascade mCascades[CASCADE_COUNT];
+    glm::vec4 mCachedLights[MAX_POINT_SHADOWS]; // position and radius each cube was rendered for; w 0 when empty
+    int mCachedLightCount = 0;
+
+    size_t mRenderedPasses = 0;
+    size_t mDrawCalls = 0;
+};
+
+#endif
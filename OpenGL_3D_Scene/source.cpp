@@ -6,6 +6,12 @@
 //----------------------------------------------------------------------------------------------------------------------------------------------
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstring>          // strcmp
+#include <chrono>           // steady_clock
+#include <vector>           // vector
+#include <algorithm>        // max
+#include <cstddef>          // offsetof
+#include <cmath>            // sin, cos
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #define STB_IMAGE_IMPLEMENTATION
@@ -18,6 +24,21 @@
 
 #include "camera.h" // Camera class
 #include "shader.h" // Shader class
+#include "headless.h" // Offscreen EGL backend
+#include "benchmark.h" // Scripted camera path and frame timing
+#include "uniform_buffer.h" // Per-frame uniform blocks
+#include "mesh.h" // Indexed mesh building
+#include "mesh_optimizer.h" // Vertex cache and overdraw ordering
+#include "geometry_heap.h" // Shared vertex and index buffers
+#include "gl_extensions.h" // Post-4.3 entry points
+#include "render_queue.h" // State-sorted multi-draw indirect submission
+#include "texture_array.h" // Texture array packing
+#include "thread_pool.h" // Worker threads for CPU frame work
+#include "occlusion_culler.h" // Software occlusion culling
+#include "gpu_culler.h" // Compute-shader culling
+#include "clustered_lighting.h" // Clustered point lights
+#include "deferred_renderer.h" // G-buffer and deferred lighting pass
+#include "shadow_renderer.h" // Cascaded and cube shadow maps
 
 using namespace std; // Standard namespace
 
@@ -30,34 +51,54 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
-    // Stores the GL data relative to a given mesh
-    struct GLMesh
-    {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbo;         // Handle for the vertex buffer object
-        GLuint nVertices;    // Number of indices of the mesh
-    };
-
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
-    // Initialize mesh objects
+    // Initialize mesh objects; their vertices and indices live in the shared geometry heap
+    GeometryHeap gGeometryHeap;
     GLMesh counterTopMesh;
     GLMesh laptopScreenMesh;
     GLMesh laptopBaseMesh;
     GLMesh bookMesh;
+    // Index ranges of the book's textured parts and the layer each one samples in the book's texture array
+    const IndexRange BOOK_PAGES = { 0, 18 };
+    const IndexRange BOOK_COVER = { 18, 12 };   // cover and bottom
+    const IndexRange BOOK_SIDE = { 30, 6 };
+    const GLuint BOOK_LAYER_PAGES = 0;  // layers follow the order the book textures are added to their group
+    const GLuint BOOK_LAYER_SIDE = 1;
+    const GLuint BOOK_LAYER_COVER = 2;
     GLMesh paperMesh;
 
-    // Initialize textures
-    GLuint textureIdGranite;
-    GLuint textureIdLaptopScreen;
-    GLuint textureIdLaptopKeyboard;
-    GLuint textureIdBookCover;
-    GLuint textureIdBookSide;
-    GLuint textureIdBookPages;
-    GLuint textureIdPaper;
+    // Light marker lamps: one cube mesh drawn once per frame with an instance per lamp
+    struct LampInstance
+    {
+        glm::mat4 model;    // instance attributes 3-6
+        glm::vec4 color;    // instance attribute 7
+    };
+    GLMesh lampMesh;
+    GLuint lampInstanceBuffer = 0;
+    size_t lampInstanceCapacity = 0; // number of instances the buffer can hold
+    vector<LampInstance> gLamps;
+    bool gLampsDirty = true; // instance buffer needs uploading
+
+    // Scene textures, packed into texture arrays. Each material is an array (bound to the unit of the same number) and a
+    // base layer; the book's parts add a per-vertex layer offset so the whole book is one draw.
+    TextureArraySet gTextures;
+    // Indices of the scene textures, in the order AddSceneTextures adds them
+    const int SCENE_TEXTURE_GRANITE = 0;
+    const int SCENE_TEXTURE_LAPTOP_SCREEN = 1;
+    const int SCENE_TEXTURE_LAPTOP_KEYBOARD = 2;
+    const int SCENE_TEXTURE_BOOK = 3;
+    const int SCENE_TEXTURE_PAPER = 6;
+
+    TextureLayer gGraniteTexture;
+    TextureLayer gLaptopScreenTexture;
+    TextureLayer gLaptopKeyboardTexture;
+    TextureLayer gBookTexture;
+    TextureLayer gPaperTexture;
 
     glm::vec2 gUVScale(5.0f, 5.0f);
+    glm::vec3 gKeyLightPosition(0.0f, 0.0f, 0.0f); // light every lit object is shaded by, tinted per draw
     GLint gTexWrapMode = GL_REPEAT;
 
     // Shader programs
@@ -65,6 +106,79 @@ namespace
     GLuint programIdLighting;
     GLuint programIdLamp;
 
+    // Object programs of the two shading paths; programIdLighting and programIdTexture point at the pair in use.
+    // The G-buffer pair is the same shaders built with GBUFFER defined.
+    struct ObjectPrograms
+    {
+        GLuint lighting = 0;
+        GLuint texture = 0;
+    };
+    ObjectPrograms gForwardPrograms;
+    ObjectPrograms gGBufferPrograms;
+
+    // Camera data written once per frame and shared by all programs through a std140 uniform block
+    const GLuint CAMERA_BLOCK_BINDING = 0;
+    struct CameraBlock
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 viewPosition; // vec3 padded to 16 bytes as std140 requires
+    };
+    UniformBuffer<CameraBlock> gCameraBuffer;
+
+    // Uniform handles, resolved once after the shader programs are linked. Per-object data goes through the render queue.
+    struct LightingUniforms
+    {
+        Uniform<glm::vec3> lightPos;
+        Uniform<glm::vec2> uvScale;
+    } gLightingUniforms;
+
+    struct TextureUniforms
+    {
+        Uniform<glm::vec2> uvScale;
+    } gTextureUniforms;
+
+    const int SHADER_TEXTURE_UNITS = 8; // size of the uTextures sampler array in the shaders
+
+    // Every object draw of the frame, sorted by state and submitted with multi-draw indirect through the state cache
+    RenderQueue gRenderQueue;
+    GLStateCache gStateCache;
+    int gSceneTextureSet = RenderQueue::NO_TEXTURES; // the scene's texture arrays, sampled by both object programs
+
+    // The laptop and the book are rasterized on the CPU so the draws they hide are never submitted; --no-occlusion-culling
+    // keeps frustum culling only
+    ThreadPool gThreadPool;
+    OcclusionCuller gOcclusionCuller(gThreadPool);
+    bool gOcclusionCulling = true;
+
+    // --gpu-culling moves frustum and occlusion culling into a compute pass; --compare-culling benchmarks the path
+    // once with each
+    GpuCuller gGpuCuller;
+    bool gGpuCulling = false;
+    bool gCompareCulling = false;
+
+    // Point lights shaded through the cluster grid: one per lamp, plus --lights N animated lights moving over the
+    // countertop. --gpu-light-assignment builds the cluster lists in a compute pass.
+    ClusteredLighting gLighting(gThreadPool);
+    vector<PointLight> gLampLights;
+    vector<PointLight> gFrameLights; // the lamps' lights followed by this frame's animated lights
+    int gAnimatedLightCount = 0;
+    bool gGpuLightAssignment = false;
+    float gLightTime = 0.0f; // simulated time driving the animated lights
+
+    // --deferred shades the objects in one full-screen pass over a G-buffer; --compare-shading benchmarks the path
+    // once forward and once deferred
+    DeferredRenderer gDeferred;
+    bool gDeferredShading = false;
+    bool gCompareShading = false;
+
+    // A directional light shadowed through cascades, and cube shadow maps for the lamps' lights. The objects are all
+    // static casters, rendered once into the cached maps; --no-shadows lights the scene unshadowed.
+    ShadowRenderer gShadows;
+    bool gShadowsEnabled = true;
+    const glm::vec3 gSunDirection(0.7f, -0.5f, 0.6f);
+    const glm::vec3 gSunColor(0.35f, 0.33f, 0.3f);
+
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 5.0f));
     float gLastX = WINDOW_WIDTH / 2.0f;
@@ -75,6 +189,43 @@ namespace
     // timing
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
+
+    // headless mode: render a fixed number of frames into an offscreen framebuffer
+    bool gHeadless = false;
+    int gFrameLimit = 1;
+    int gFrameCount = 0;
+    const char* gOutputImage = nullptr; // optional PPM dump of the last frame
+    bool gFrameLimitSet = false;
+
+    // benchmark mode: fixed time step, scripted camera, timing report
+    bool gBenchmarkMode = false;
+    int gBenchmarkWarmup = 30;
+    const char* gBenchmarkOutput = "benchmark.json";
+    const char* gCameraPathFile = nullptr;
+    Benchmark* gBenchmark = nullptr;
+
+    // storage format of the scene meshes' vertices; --float-vertices keeps full precision for comparison
+    VertexFormat gVertexFormat = VertexFormat::Quantized;
+
+    // sample the scene textures through bindless handles when the driver supports it; --no-bindless forces texture arrays
+    bool gAllowBindless = true;
+
+    // Textures stream in while the first frames render; headless and benchmark runs wait for them before the first frame
+    // so their output does not depend on load timing, unless --stream-textures asks to stream there too
+    bool gStreamTextures = false;
+
+    // --bake-textures writes every scene texture block-compressed into a KTX2 file next to its source and quits; later
+    // runs load those files unless --no-baked-textures asks to decode the sources
+    bool gBakeTextures = false;
+    BlockFormat gBakeFormat = BlockFormat::BC7;
+    bool gUseBakedTextures = true;
+
+    // filter the decoded and baked textures are scaled and mipped with on the CPU
+    MipFilter gMipFilter = MipFilter::Kaiser;
+
+    // Decoded textures are kept, mipped, in TextureCache so later runs map them instead of decoding; --no-texture-cache
+    // decodes every run and writes nothing
+    bool gTextureCache = true;
 }
 
 // User-defined Functions
@@ -90,37 +241,29 @@ void CreateLaptopScreen(GLMesh& mesh);
 void CreateLaptopBase(GLMesh& mesh);
 void CreateBook(GLMesh& mesh);
 void CreatePaper(GLMesh& mesh);
+void CreateLampMesh(GLMesh& mesh);
+void CreateLamps();
+void AddLamp(const glm::vec3& position, const glm::vec3& color);
+void UploadLampInstances();
+void RenderLamps();
+void UpdateLights();
+void SelectShadingPath(bool deferred);
 void DestroyMesh(GLMesh& mesh);
-bool CreateTexture(const char* filename, GLuint& textureId);
-void DestroyTexture(GLuint textureId);
-void RenderCountertop();
-void RenderLaptopScreen();
-void RenderLaptopBase();
-void RenderPaper();
-void RenderBook();
+void AddSceneTextures();
+bool LoadSceneTextures(bool bindless);
+void QueueCountertop(RenderQueue& queue, GLuint program, int textureSet);
+void QueueLaptopScreen(RenderQueue& queue, GLuint program, int textureSet);
+void QueueLaptopBase(RenderQueue& queue, GLuint program, int textureSet);
+void QueuePaper(RenderQueue& queue, GLuint program, int textureSet);
+void QueueBook(RenderQueue& queue, GLuint program, int textureSet);
 void RenderScene();
+glm::mat4 GetProjectionMatrix();
+glm::mat4 UpdateCameraBlock();
 void DestroyShaderProgram(GLuint programId);
-
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up. A function to flip
-//-------------------------------------------------------------------------------------------
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-    for (int j = 0; j < height / 2; ++j)
-    {
-        int index1 = j * width * channels;
-        int index2 = (height - 1 - j) * width * channels;
-
-        for (int i = width * channels; i > 0; --i)
-        {
-            unsigned char tmp = image[index1];
-            image[index1] = image[index2];
-            image[index2] = tmp;
-            ++index1;
-            ++index2;
-        }
-    }
-}
-
+bool ParseArguments(int argc, char* argv[]);
+bool ShouldClose();
+float GetTime();
+void PresentFrame();
 
 int main(int argc, char* argv[])
 {
@@ -129,6 +272,19 @@ int main(int argc, char* argv[])
     if (!Initialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
+    // Bake the scene textures and quit
+    //----------------------------------
+    if (gBakeTextures)
+    {
+        AddSceneTextures();
+        const bool baked = gTextures.Bake(gThreadPool, gBakeFormat, gMipFilter);
+        if (gHeadless)
+            DestroyHeadless();
+        else
+            glfwTerminate();
+        return baked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     // Initialize buffer data
     //-----------------------
     CreateCountertop(counterTopMesh);
@@ -136,122 +292,237 @@ int main(int argc, char* argv[])
     CreateLaptopBase(laptopBaseMesh);
     CreateBook(bookMesh);
     CreatePaper(paperMesh);
+    CreateLampMesh(lampMesh);
+    CreateLamps();
+    gGeometryHeap.Report();
 
-    // Build and compile the shader programs
+    // Build and compile the shader programs; the textured programs sample bindless handles when those are in use
     // -------------------------------------
-    Shader textureShader("shaderFiles/texture_shader.vs", "shaderfiles/texture_shader.fs");
-    Shader lightingShader("shaderFiles/lighting_shader.vs", "shaderfiles/lighting_shader.fs");
-    Shader lampShader("shaderFiles/lamp_shader.vs", "shaderfiles/lamp_shader.fs");
-
-    programIdTexture = textureShader.ID;
-    programIdLighting = lightingShader.ID;
+    const bool bindless = gAllowBindless && gGLExt.bindlessTexture;
+    const string textureDefines = bindless ? "#define BINDLESS_TEXTURES\n" : "";
+    Shader textureShader("shaderFiles/texture_shader.vs", "shaderFiles/texture_shader.fs", textureDefines);
+    Shader lightingShader("shaderFiles/lighting_shader.vs", "shaderFiles/lighting_shader.fs", textureDefines);
+    Shader lampShader("shaderFiles/lamp_shader.vs", "shaderFiles/lamp_shader.fs");
+
+    gForwardPrograms.texture = textureShader.ID;
+    gForwardPrograms.lighting = lightingShader.ID;
     programIdLamp = lampShader.ID;
 
-    // Load granite texture
-    //----------------------
-    const char* texFileName = "Textures/granite.jpg";
-    if (!CreateTexture(texFileName, textureIdGranite))
+    // Camera uniform block, bound to the binding point the shaders declare
+    // --------------------------------------------------------------------
+    gCameraBuffer.create(CAMERA_BLOCK_BINDING);
+
+    // Resolve the uniform handles used every frame
+    // --------------------------------------------
+    gLightingUniforms.lightPos = lightingShader.uniform<glm::vec3>("lightPos");
+    gLightingUniforms.uvScale = lightingShader.uniform<glm::vec2>("uvScale");
+
+    gTextureUniforms.uvScale = textureShader.uniform<glm::vec2>("uvScale");
+
+    // Render queue for the object programs, and the compute culling pass when it is asked for
+    // ------------------------------------
+    gRenderQueue.Create();
+    if ((gGpuCulling || gCompareCulling) && !gGpuCuller.Create())
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        cout << "GPU culling unavailable, culling on the CPU" << endl;
+        gGpuCulling = gCompareCulling = false;
     }
-
-    // Load laptop screen texture
-    //---------------------------
-    texFileName = "Textures/laptop_screen.jpg";
-    if (!CreateTexture(texFileName, textureIdLaptopScreen))
+    if (!gLighting.Create(gGpuLightAssignment))
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        cout << "GPU light assignment unavailable, assigning lights on the CPU" << endl;
+        gLighting.Create(false);
     }
 
-    // Load laptop keyboard
-    //----------------------
-    texFileName = "Textures/laptop_keyboard.jpg";
-    if (!CreateTexture(texFileName, textureIdLaptopKeyboard))
-    {
-        cout << "Failed to load texture " << texFileName << endl;
+    // Load the scene textures into texture arrays
+    //---------------------------------------------
+    if (!LoadSceneTextures(bindless))
         return EXIT_FAILURE;
-    }
 
-    // Load book cover
-    //----------------
-    texFileName = "Textures/book_cover.jpg";
-    if (!CreateTexture(texFileName, textureIdBookCover))
+    // Point the shaders' sampler array at the texture units; bindless programs read handles instead
+    //-------------------------------------------------------
+    GLint textureUnits[SHADER_TEXTURE_UNITS];
+    for (int unit = 0; unit < SHADER_TEXTURE_UNITS; ++unit)
+        textureUnits[unit] = unit;
+    if (!gTextures.Bindless())
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        glUseProgram(gForwardPrograms.lighting);
+        glUniform1iv(lightingShader.location("uTextures[0]"), SHADER_TEXTURE_UNITS, textureUnits);
+        glUseProgram(gForwardPrograms.texture);
+        glUniform1iv(textureShader.location("uTextures[0]"), SHADER_TEXTURE_UNITS, textureUnits);
     }
-
-    // Load book pages
-    //----------------
-    texFileName = "Textures/book_pages.jpg";
-    if (!CreateTexture(texFileName, textureIdBookPages))
+    gSceneTextureSet = gRenderQueue.AddTextureSet(gTextures.Bindings(0));
+
+    // The remaining program uniforms hold for the whole run, so they are set once instead of every frame
+    //----------------------------------------------------------------------------------------------------
+    glUseProgram(gForwardPrograms.lighting);
+    Shader::set(gLightingUniforms.lightPos, gKeyLightPosition);
+    Shader::set(gLightingUniforms.uvScale, gUVScale);
+    glUseProgram(gForwardPrograms.texture);
+    Shader::set(gTextureUniforms.uvScale, gUVScale);
+
+    // The deferred path's G-buffer programs and lighting pass, built only when the path can be used
+    //------------------------------------------------------------------------------------------------
+    if ((gDeferredShading || gCompareShading) && gDeferred.Create(gKeyLightPosition))
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        const string gBufferDefines = textureDefines + "#define GBUFFER\n";
+        Shader gBufferTextureShader("shaderFiles/texture_shader.vs", "shaderFiles/texture_shader.fs", gBufferDefines);
+        Shader gBufferLightingShader("shaderFiles/lighting_shader.vs", "shaderFiles/lighting_shader.fs", gBufferDefines);
+        gGBufferPrograms.texture = gBufferTextureShader.ID;
+        gGBufferPrograms.lighting = gBufferLightingShader.ID;
+        for (Shader* shader : { &gBufferTextureShader, &gBufferLightingShader })
+        {
+            glUseProgram(shader->ID);
+            Shader::set(shader->uniform<glm::vec2>("uvScale"), gUVScale);
+            if (!gTextures.Bindless())
+                glUniform1iv(shader->location("uTextures[0]"), SHADER_TEXTURE_UNITS, textureUnits);
+        }
     }
+    else if (gDeferredShading || gCompareShading)
+    {
+        cout << "Deferred shading unavailable, shading forward" << endl;
+        gDeferredShading = gCompareShading = false;
+    }
+    SelectShadingPath(gDeferredShading);
 
-    // Load book side
-    //----------------
-    texFileName = "Textures/book_side.jpg";
-    if (!CreateTexture(texFileName, textureIdBookSide))
+    // Shadow maps, with the objects queued once as static casters
+    //--------------------------------------------------------------
+    if (!gShadows.Create(gShadowsEnabled))
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        cout << "Shadow maps unavailable, lighting without shadows" << endl;
+        gShadows.Create(false);
     }
-    // Load book side
-    //---------------
-    texFileName = "Textures/paper.jpg";
-    if (!CreateTexture(texFileName, textureIdPaper))
+    gShadows.SetDirectionalLight(gSunDirection, gSunColor);
+    if (gShadowsEnabled)
     {
-        cout << "Failed to load texture " << texFileName << endl;
-        return EXIT_FAILURE;
+        RenderQueue& casters = gShadows.StaticCasters();
+        QueueCountertop(casters, gShadows.DepthProgram(), RenderQueue::NO_TEXTURES);
+        QueueLaptopScreen(casters, gShadows.DepthProgram(), RenderQueue::NO_TEXTURES);
+        QueueLaptopBase(casters, gShadows.DepthProgram(), RenderQueue::NO_TEXTURES);
+        QueueBook(casters, gShadows.DepthProgram(), RenderQueue::NO_TEXTURES);
+        QueuePaper(casters, gShadows.DepthProgram(), RenderQueue::NO_TEXTURES);
     }
 
-    // Set textures for lighting shader
-    //---------------------------------
-    glUseProgram(programIdLighting);
-    // Set the first texure as granite
-    glUniform1i(glGetUniformLocation(programIdLighting, "textureGranite"), 0);
-    // Set the second texture as paper
-    glUniform1i(glGetUniformLocation(programIdLighting, "texturePaper"), 1);
-
-    // Set textures for texture shader
-    //--------------------------------
-    glUseProgram(programIdTexture);
-    // Set the first texture as screen
-    glUniform1i(glGetUniformLocation(programIdTexture, "textureLaptopScreen"), 0);
-    // Set the second texture as keyboard
-    glUniform1i(glGetUniformLocation(programIdTexture, "textureLaptopKeyboard"), 1);
-    // Set the third texture to book cover
-    glUniform1i(glGetUniformLocation(programIdTexture, "textureBookCover"), 2);
-    // Set the fourth texture to book pages
-    glUniform1i(glGetUniformLocation(programIdTexture, "textureBookPages"), 3);
-    // Set the fifth texture to book side
-    glUniform1i(glGetUniformLocation(programIdTexture, "textureBookSide"), 4);
+    // Benchmark: replay the camera path with a fixed time step
+    //--------------------------------------------------------
+    if (gBenchmarkMode)
+    {
+        CameraPath path = CameraPath::Default();
+        if (gCameraPathFile != nullptr && !path.LoadFromFile(gCameraPathFile))
+            return EXIT_FAILURE;
+
+        gBenchmark = new Benchmark(path, gBenchmarkWarmup, gFrameLimit);
+        if (gCompareCulling)
+            gGpuCulling = false; // the CPU run goes first
+        if (gCompareShading)
+            SelectShadingPath(false); // and so does the forward run
+        gBenchmark->BeginRun(gCompareCulling ? "cpu_culling" : gCompareShading ? "forward" : "default");
+    }
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    while (!ShouldClose())
     {
         // per-frame timing
         // --------------------
-        float currentFrame = glfwGetTime();
+        float currentFrame = GetTime();
         gDeltaTime = currentFrame - gLastFrame;
         gLastFrame = currentFrame;
 
         // input
         // -----
-        ProcessInput(gWindow);
+        if (!gHeadless)
+            ProcessInput(gWindow);
+
+        if (gBenchmark)
+        {
+            gDeltaTime = Benchmark::DELTA_TIME;
+            gBenchmark->ApplyCamera(gCamera);
+            gBenchmark->BeginFrame();
+        }
+
+        // Move the next slice of decoded texture pixels to the GPU; a no-op once every texture is resident
+        //---------------------------------------------------------------------------------------------------
+        gTextures.Stream();
 
         // Render this frame
         //-------------------
         RenderScene();
 
+        if (gBenchmark)
+        {
+            gBenchmark->EndSubmit();
+
+            // GPU culling keeps every draw queued; its totals are read back after the submit time was taken
+            const size_t queued = gRenderQueue.DrawCount() + gRenderQueue.CulledCount();
+            const size_t drawn = gGpuCulling ? gGpuCuller.VisibleCount() : gRenderQueue.DrawCount();
+            gBenchmark->SetCounter("gpu_culling", gGpuCulling ? 1.0 : 0.0);
+            gBenchmark->SetCounter("deferred", gDeferredShading ? 1.0 : 0.0);
+            gBenchmark->SetCounter("objects", (double)(queued + gLamps.size()));
+            gBenchmark->SetCounter("drawn", (double)drawn);
+            gBenchmark->SetCounter("culled", (double)(queued - drawn));
+            gBenchmark->SetCounter("occluded", (double)(gGpuCulling ? gGpuCuller.OccludedCount() : gRenderQueue.OccludedCount()));
+            gBenchmark->SetCounter("occluder_triangles", (double)(gGpuCulling ? 0 : gOcclusionCuller.TriangleCount()));
+            gBenchmark->SetCounter("draw_calls", (double)(gRenderQueue.SubmitCalls() + (gLamps.empty() ? 0 : 1)));
+            gBenchmark->SetCounter("state_changes", (double)gStateCache.GetCounters().issued);
+            gBenchmark->SetCounter("state_changes_skipped", (double)gStateCache.GetCounters().skipped);
+            gBenchmark->SetCounter("lights", (double)gFrameLights.size());
+            gBenchmark->SetCounter("shadow_passes", (double)gShadows.RenderedPasses());
+            gBenchmark->SetCounter("shadow_draw_calls", (double)gShadows.DrawCalls());
+            gBenchmark->SetCounter("texture_stream_bytes", (double)gTextures.StreamedBytes());
+            gBenchmark->SetCounter("textures_pending", (double)gTextures.PendingCount());
+            if (!gLighting.GpuAssignment())
+            {
+                gBenchmark->SetCounter("light_indices", (double)gLighting.AssignedCount());
+                gBenchmark->SetCounter("max_cluster_lights", (double)gLighting.MaxClusterLights());
+                gBenchmark->SetCounter("dropped_lights", (double)gLighting.DroppedCount());
+            }
+        }
+
+        // Present the frame: swap the window buffers, or finish the offscreen frame in headless mode
+        PresentFrame();
+
+        if (gBenchmark)
+        {
+            gBenchmark->EndFrame();
+
+            // --compare-culling: replay the path with GPU culling once the CPU run is done
+            if (gCompareCulling && !gGpuCulling && gBenchmark->RunFinished())
+            {
+                gGpuCulling = true;
+                gBenchmark->BeginRun("gpu_culling");
+            }
+
+            // --compare-shading: then the same path and lights through the G-buffer
+            if (gCompareShading && !gDeferredShading && gBenchmark->RunFinished())
+            {
+                SelectShadingPath(true);
+                gBenchmark->BeginRun("deferred");
+            }
+        }
+
         // Poll events
         //------------
-        glfwPollEvents();
+        if (!gHeadless)
+            glfwPollEvents();
+    }
+
+    // Write the benchmark report
+    //---------------------------
+    if (gBenchmark)
+    {
+        gBenchmark->WriteReport(gBenchmarkOutput, (const char*)glGetString(GL_RENDERER), WINDOW_WIDTH, WINDOW_HEIGHT);
+        delete gBenchmark;
+        gBenchmark = nullptr;
+    }
+
+    // Save the last offscreen frame when requested
+    //---------------------------------------------
+    if (gHeadless && gOutputImage != nullptr)
+    {
+        if (SaveHeadlessFrame(gOutputImage))
+            cout << "INFO: Wrote " << gFrameCount << " frame(s), last frame saved to " << gOutputImage << endl;
+        else
+            cout << "Failed to save frame to " << gOutputImage << endl;
     }
 
     // Release mesh data
@@ -260,31 +531,51 @@ int main(int argc, char* argv[])
     DestroyMesh(laptopScreenMesh);
     DestroyMesh(laptopBaseMesh);
     DestroyMesh(bookMesh);
+    DestroyMesh(paperMesh);
+    DestroyMesh(lampMesh);
+    glDeleteBuffers(1, &lampInstanceBuffer);
+    gGeometryHeap.Destroy();
 
     // Release texture data
     //----------------------
-    DestroyTexture(textureIdGranite);
-    DestroyTexture(textureIdLaptopScreen);
-    DestroyTexture(textureIdLaptopKeyboard);
-    DestroyTexture(textureIdBookCover);
-    DestroyTexture(textureIdBookPages);
-    DestroyTexture(textureIdBookSide);
-    DestroyTexture(textureIdPaper);
+    gTextures.Destroy();
 
     // Release shader programs
     //-------------------------
-    DestroyShaderProgram(programIdTexture);
-    DestroyShaderProgram(programIdLighting);
+    DestroyShaderProgram(gForwardPrograms.texture);
+    DestroyShaderProgram(gForwardPrograms.lighting);
+    DestroyShaderProgram(gGBufferPrograms.texture);
+    DestroyShaderProgram(gGBufferPrograms.lighting);
     DestroyShaderProgram(programIdLamp);
+    gCameraBuffer.destroy();
+    gRenderQueue.Destroy();
+    gGpuCuller.Destroy();
+    gLighting.Destroy();
+    gDeferred.Destroy();
+    gShadows.Destroy();
+
+    if (gHeadless)
+        DestroyHeadless();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
 
 
-// Initialize GLFW, GLEW, and create a window
-//--------------------------------------------
+// Initialize GLFW, GLEW, and create a window. With --headless an offscreen EGL context is created instead.
+//-----------------------------------------------------------------------------------------------------------
 bool Initialize(int argc, char* argv[], GLFWwindow** window)
 {
+    if (!ParseArguments(argc, argv))
+        return false;
+
+    // Headless: surfaceless EGL context rendering into an offscreen framebuffer
+    // -------------------------------------------------------------------------
+    if (gHeadless)
+    {
+        *window = nullptr;
+        return InitializeHeadless(WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+
     // GLFW: initialize and configure
     // ------------------------------
     glfwInit();
@@ -320,16 +611,153 @@ bool Initialize(int argc, char* argv[], GLFWwindow** window)
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        return false;
     }
+    LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
 
     // Displays GPU OpenGL version
     //------------------------------
     cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
+    // Benchmarks measure throughput, so do not wait for vertical sync
+    if (gBenchmarkMode)
+        glfwSwapInterval(0);
+
     return true;
 }
 
+// Parse command line options
+//----------------------------
+bool ParseArguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            gHeadless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            gFrameLimit = atoi(argv[++i]);
+            gFrameLimitSet = true;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            gOutputImage = argv[++i];
+        else if (strcmp(argv[i], "--benchmark") == 0)
+            gBenchmarkMode = true;
+        else if (strcmp(argv[i], "--benchmark-out") == 0 && i + 1 < argc)
+            gBenchmarkOutput = argv[++i];
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            gBenchmarkWarmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc)
+            gCameraPathFile = argv[++i];
+        else if (strcmp(argv[i], "--float-vertices") == 0)
+            gVertexFormat = VertexFormat::Float;
+        else if (strcmp(argv[i], "--no-bindless") == 0)
+            gAllowBindless = false;
+        else if (strcmp(argv[i], "--no-occlusion-culling") == 0)
+            gOcclusionCulling = false;
+        else if (strcmp(argv[i], "--gpu-culling") == 0)
+            gGpuCulling = true;
+        else if (strcmp(argv[i], "--compare-culling") == 0)
+            gCompareCulling = true;
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            gAnimatedLightCount = max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--gpu-light-assignment") == 0)
+            gGpuLightAssignment = true;
+        else if (strcmp(argv[i], "--deferred") == 0)
+            gDeferredShading = true;
+        else if (strcmp(argv[i], "--compare-shading") == 0)
+            gCompareShading = true;
+        else if (strcmp(argv[i], "--no-shadows") == 0)
+            gShadowsEnabled = false;
+        else if (strcmp(argv[i], "--stream-textures") == 0)
+            gStreamTextures = true;
+        else if (strcmp(argv[i], "--bake-textures") == 0)
+            gBakeTextures = true;
+        else if (strcmp(argv[i], "--bake-format") == 0 && i + 1 < argc && strcmp(argv[i + 1], "bc1") == 0)
+        {
+            gBakeFormat = BlockFormat::BC1;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--bake-format") == 0 && i + 1 < argc && strcmp(argv[i + 1], "bc7") == 0)
+        {
+            gBakeFormat = BlockFormat::BC7;
+            ++i;
+        }
+        else if (strcmp(argv[i], "--no-baked-textures") == 0)
+            gUseBakedTextures = false;
+        else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc && ParseMipFilter(argv[i + 1], gMipFilter))
+            ++i;
+        else if (strcmp(argv[i], "--no-texture-cache") == 0)
+            gTextureCache = false;
+        else
+        {
+            cout << "Unknown option " << argv[i] << endl;
+            cout << "Usage: " << argv[0] << " [--headless] [--frames N] [--output frame.ppm]"
+                << " [--benchmark] [--benchmark-out report.json] [--warmup N] [--camera-path path.txt] [--float-vertices] [--no-bindless]"
+                << " [--no-occlusion-culling] [--gpu-culling] [--compare-culling] [--lights N] [--gpu-light-assignment]"
+                << " [--deferred] [--compare-shading] [--no-shadows] [--stream-textures] [--bake-textures] [--bake-format bc1|bc7]"
+                << " [--no-baked-textures] [--mip-filter box|kaiser|lanczos] [--no-texture-cache]" << endl;
+            return false;
+        }
+    }
+
+    // Each comparison replays the path twice, switching one setting between the runs
+    if (gCompareCulling && gCompareShading)
+    {
+        cout << "--compare-culling and --compare-shading cannot be combined" << endl;
+        return false;
+    }
+
+    // Benchmarks default to ten seconds of simulated time
+    if (gBenchmarkMode && !gFrameLimitSet)
+        gFrameLimit = 600;
+    if (gFrameLimit < 1)
+        gFrameLimit = 1;
+    if (gBenchmarkWarmup < 0)
+        gBenchmarkWarmup = 0;
+
+    return true;
+}
+
+// The render loop ends when the window is closed, after the benchmark, or after the requested number of headless frames
+//----------------------------------------------------------------------------------------------------------------------
+bool ShouldClose()
+{
+    if (gBenchmark && gBenchmark->RunFinished())
+        return true;
+
+    if (gBenchmark && gHeadless)
+        return false;
+
+    if (gHeadless)
+        return gFrameCount >= gFrameLimit;
+
+    return glfwWindowShouldClose(gWindow);
+}
+
+// Seconds since the first call; GLFW's timer is unavailable without a window
+//----------------------------------------------------------------------------
+float GetTime()
+{
+    if (!gHeadless)
+        return glfwGetTime();
+
+    static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    return chrono::duration<float>(chrono::steady_clock::now() - start).count();
+}
+
+// Present the finished frame: swap the window buffers, or finish the offscreen frame
+//-----------------------------------------------------------------------------------
+void PresentFrame()
+{
+    if (gHeadless)
+        glFinish();
+    else
+        glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+
+    ++gFrameCount;
+}
+
 // Process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 //----------------------------------------------------------------------------------------------------------
 void ProcessInput(GLFWwindow* window)
@@ -480,38 +908,19 @@ void CreateCountertop(GLMesh& mesh)
         -0.5f, -0.5f, -1.0f,  0.0f, -1.0f, 0.0f, 0.0f, 0.0f
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    // Generate vao
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    // Create normal pointers
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    // Create texture pointers
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Positions, normals and texture coordinates
+    VertexLayout layout = VertexLayout::Create(gVertexFormat, true, true);
+
+    // Weld the shared vertices of the triangle soup, reorder them for the GPU and upload them with an index buffer
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * layout.SourceFloatsPerVertex());
+    IndexedMesh indexed = WeldVertices(verts, soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "countertop");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "countertop");
 }
 
-// Render countertop
-//------------------
-void RenderCountertop()
+// Queue the countertop draw
+//--------------------------
+void QueueCountertop(RenderQueue& queue, GLuint program, int textureSet)
 {
     // 1. Scales the object 
     glm::mat4 scale = glm::scale(glm::vec3(9.0f, 0.2f, 10.0f));
@@ -522,112 +931,12 @@ void RenderCountertop()
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection or orthographic projection based on input given
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(programIdLighting);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programIdLighting, "model");
-    GLint viewLoc = glGetUniformLocation(programIdLighting, "view");
-    GLint projLoc = glGetUniformLocation(programIdLighting, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Reference matrix uniforms from the Shader program for the cube color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(programIdLighting, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(programIdLighting, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(programIdLighting, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(programIdLighting, "viewPosition");
-
-    // Pass color, light, and camera data to the Shader program's corresponding uniforms
-    glUniform3f(objectColorLoc, 0.0f, 0.0f, 0.0f);
-    glUniform3f(lightColorLoc, 1.0f, 1.0f, 1.0f);
-    glUniform3f(lightPositionLoc, 0.0f, 0.0f, 0.0f);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    GLint UVScaleLoc = glGetUniformLocation(programIdLighting, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(counterTopMesh.vao);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdGranite);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, counterTopMesh.nVertices);
-
-    // Draw lamps
-    glUseProgram(programIdLamp);
-
-    // Position light 1
-    // -----------------
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(glm::vec3(-2.0f, 2.5f, -2.0f)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(programIdLamp, "model");
-    viewLoc = glGetUniformLocation(programIdLamp, "view");
-    projLoc = glGetUniformLocation(programIdLamp, "projection");
-
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glDrawArrays(GL_TRIANGLES, 0, counterTopMesh.nVertices);
-
-    //position light 2
-    //------------------
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(glm::vec3(2.0f, 2.5f, -2.0f)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(programIdLamp, "model");
-    viewLoc = glGetUniformLocation(programIdLamp, "view");
-    projLoc = glGetUniformLocation(programIdLamp, "projection");
-
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glDrawArrays(GL_TRIANGLES, 0, counterTopMesh.nVertices);
-
-    // Position light 3
-    // -----------------
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(glm::vec3(0.0f, 2.5f, -2.0f)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(programIdLamp, "model");
-    viewLoc = glGetUniformLocation(programIdLamp, "view");
-    projLoc = glGetUniformLocation(programIdLamp, "projection");
-
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glDrawArrays(GL_TRIANGLES, 0, counterTopMesh.nVertices);
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    // Lit by white light, textured with granite
+    DrawData draw;
+    draw.model = model * counterTopMesh.dequantize;
+    draw.lightColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    draw.material = glm::uvec4(gGraniteTexture.array, gGraniteTexture.layer, 0, 0);
+    queue.Add(program, textureSet, counterTopMesh, draw);
 }
 
 // Create the laptop screen
@@ -679,36 +988,23 @@ void CreateLaptopScreen(GLMesh& mesh)
         -0.5f, -0.5f, -1.0f,  0.0f, 0.0f
     };
 
-
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerUV));
-
-    // Create VAO
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    // Create texture pointers
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(2);
+    // Positions and texture coordinates, plus a layer offset of 0 so the layout matches the book's and the unlit
+    // textured meshes share one heap page and one multi-draw
+    VertexLayout layout = VertexLayout::Create(gVertexFormat, false, true, true);
+
+    // Weld the shared vertices of the triangle soup, reorder them for the GPU and upload them with an index buffer
+    const int soupFloatsPerVertex = layout.SourceFloatsPerVertex() - 1;
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * soupFloatsPerVertex);
+    vector<float> tagged = AppendVertexLayer(verts, soupVertices, soupFloatsPerVertex, {});
+    IndexedMesh indexed = WeldVertices(tagged.data(), soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "laptop screen");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "laptop screen");
+    KeepOccluderGeometry(mesh, indexed);
 }
 
-// Render Laptop Screen
-//----------------------
-void RenderLaptopScreen()
+// Queue the laptop screen draw
+//------------------------------
+void QueueLaptopScreen(RenderQueue& queue, GLuint program, int textureSet)
 {
     // 1. Scales the object
     glm::mat4 scale = glm::scale(glm::vec3(2.0f, 1.5f, 0.05f));
@@ -719,46 +1015,10 @@ void RenderLaptopScreen()
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection or orthographic projection based on input given
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(programIdTexture);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programIdTexture, "model");
-    GLint viewLoc = glGetUniformLocation(programIdTexture, "view");
-    GLint projLoc = glGetUniformLocation(programIdTexture, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    GLint UVScaleLoc = glGetUniformLocation(programIdTexture, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(laptopScreenMesh.vao);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdLaptopScreen);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, laptopScreenMesh.nVertices);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    DrawData draw;
+    draw.model = model * laptopScreenMesh.dequantize;
+    draw.material = glm::uvec4(gLaptopScreenTexture.array, gLaptopScreenTexture.layer, 0, 0);
+    queue.Add(program, textureSet, laptopScreenMesh, draw);
 }
 
 // Create laptop keyboard
@@ -809,36 +1069,23 @@ void CreateLaptopBase(GLMesh& mesh) {
         -0.5f, -0.5f, -1.0f,  0.0f, 0.0f
     };
 
-
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerUV));
-
-    // Create VAO
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    // Create texture pointers
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(2);
+    // Positions and texture coordinates, plus a layer offset of 0 so the layout matches the book's and the unlit
+    // textured meshes share one heap page and one multi-draw
+    VertexLayout layout = VertexLayout::Create(gVertexFormat, false, true, true);
+
+    // Weld the shared vertices of the triangle soup, reorder them for the GPU and upload them with an index buffer
+    const int soupFloatsPerVertex = layout.SourceFloatsPerVertex() - 1;
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * soupFloatsPerVertex);
+    vector<float> tagged = AppendVertexLayer(verts, soupVertices, soupFloatsPerVertex, {});
+    IndexedMesh indexed = WeldVertices(tagged.data(), soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "laptop base");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "laptop base");
+    KeepOccluderGeometry(mesh, indexed);
 }
 
-// Render laptop keyboard
-//------------------------
-void RenderLaptopBase() {
+// Queue the laptop keyboard draw
+//--------------------------------
+void QueueLaptopBase(RenderQueue& queue, GLuint program, int textureSet) {
 
     // 1. Scales the object
     glm::mat4 scale = glm::scale(glm::vec3(2.0f, 0.05f, 1.8f));
@@ -849,46 +1096,10 @@ void RenderLaptopBase() {
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection or orthographic projection based on input given
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(programIdTexture);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programIdTexture, "model");
-    GLint viewLoc = glGetUniformLocation(programIdTexture, "view");
-    GLint projLoc = glGetUniformLocation(programIdTexture, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    GLint UVScaleLoc = glGetUniformLocation(programIdTexture, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(laptopBaseMesh.vao);
-
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdLaptopKeyboard);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, laptopBaseMesh.nVertices);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    DrawData draw;
+    draw.model = model * laptopBaseMesh.dequantize;
+    draw.material = glm::uvec4(gLaptopKeyboardTexture.array, gLaptopKeyboardTexture.layer, 0, 0);
+    queue.Add(program, textureSet, laptopBaseMesh, draw);
 }
 
 // Create the book
@@ -932,7 +1143,6 @@ void CreateBook(GLMesh& mesh)
         -0.5f, -0.5f, 0.0f,  0.0f, 0.0f,
         -0.5f, -0.5f, -1.0f,  0.0f, 0.0f,
 
-
         0.5f, -0.5f, -1.0f, 0.0f, 0.0f,  // Book Side Binding
         0.5f, 0.5f, -1.0f,  0.0f, 0.2f,
         -0.5f, 0.5f, -1.0f, 0.2f, 0.2f,
@@ -941,36 +1151,24 @@ void CreateBook(GLMesh& mesh)
         -0.5f, -0.5f, -1.0f,  0.2f, 0.0f,
     };
 
-
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerUV));
-
-    // Create VAO
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create VBO
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerUV);
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    // Create texture pointers
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(2);
+    // Positions, texture coordinates and the texture array layer of each part
+    VertexLayout layout = VertexLayout::Create(gVertexFormat, false, true, true);
+
+    // Tag each part with its layer, then weld the shared vertices of the triangle soup, reorder them for the GPU and
+    // upload them with an index buffer
+    const int soupFloatsPerVertex = layout.SourceFloatsPerVertex() - 1;
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * soupFloatsPerVertex);
+    vector<float> tagged = AppendVertexLayer(verts, soupVertices, soupFloatsPerVertex, {
+        { BOOK_PAGES, BOOK_LAYER_PAGES }, { BOOK_SIDE, BOOK_LAYER_SIDE }, { BOOK_COVER, BOOK_LAYER_COVER } });
+    IndexedMesh indexed = WeldVertices(tagged.data(), soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "book");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "book");
+    KeepOccluderGeometry(mesh, indexed);
 }
 
-// Render Book
-//-------------
-void RenderBook() {
+// Queue the book draws
+//-----------------------
+void QueueBook(RenderQueue& queue, GLuint program, int textureSet) {
 
     // 1. Scales the object
     glm::mat4 scale = glm::scale(glm::vec3(2.0f, 0.5f, 1.0f));
@@ -981,56 +1179,11 @@ void RenderBook() {
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection or orthographic projection based on input given
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-
-    // Set the shader to be used
-    glUseProgram(programIdTexture);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programIdTexture, "model");
-    GLint viewLoc = glGetUniformLocation(programIdTexture, "view");
-    GLint projLoc = glGetUniformLocation(programIdTexture, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    GLint UVScaleLoc = glGetUniformLocation(programIdTexture, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(bookMesh.vao);
-
-    // Bind texture for book pages
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdBookPages);
-    // Draws the book pages
-    glDrawArrays(GL_TRIANGLES, 0, 18);
-
-    // bind texture for book side
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdBookSide);
-    glDrawArrays(GL_TRIANGLES, 30, 36);
-
-    // Bind texture for book cover
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdBookCover);
-    glDrawArrays(GL_TRIANGLES, 18, 30);
-
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
-
+    // One draw for every part: the vertices carry their layer offset into the book's texture array
+    DrawData draw;
+    draw.model = model * bookMesh.dequantize;
+    draw.material = glm::uvec4(gBookTexture.array, gBookTexture.layer, 0, 0);
+    queue.Add(program, textureSet, bookMesh, draw);
 }
 // Create paper mesh
 //--------------------
@@ -1080,38 +1233,19 @@ void CreatePaper(GLMesh& mesh) {
         -0.5f, -0.5f, -1.0f,  0.0f, -1.0f, 0.0f, 0.0f, 0.0f
     };
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    // Generate vao
-    glGenVertexArrays(1, &mesh.vao);
-    glBindVertexArray(mesh.vao);
-
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    // Create normal pointers
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    // Create texture pointers
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    // Positions, normals and texture coordinates
+    VertexLayout layout = VertexLayout::Create(gVertexFormat, true, true);
+
+    // Weld the shared vertices of the triangle soup, reorder them for the GPU and upload them with an index buffer
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * layout.SourceFloatsPerVertex());
+    IndexedMesh indexed = WeldVertices(verts, soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "paper");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "paper");
 }
 
-// Render and position the paper. Also add a yellow light to change the color of the paper.
-//-----------------------------------------------------------------------------------------
-void RenderPaper() {
+// Position the paper and queue its draw. Also add a yellow light to change the color of the paper.
+//--------------------------------------------------------------------------------------------------
+void QueuePaper(RenderQueue& queue, GLuint program, int textureSet) {
 
     // 1. Scales the object 
     glm::mat4 scale = glm::scale(glm::vec3(1.0f, 0.0f, 1.5f));
@@ -1121,104 +1255,150 @@ void RenderPaper() {
     glm::mat4 translation = glm::translate(glm::vec3(0.5f, -0.35f, 0.5f));
     // Model matrix: transformations are applied right-to-left order
     glm::mat4 model = translation * rotation * scale;
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
-
-    // Creates a perspective projection or orthographic projection based on input given
-    glm::mat4 projection;
-    if (ortho) {
-        float ortho_scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
+    // Add a yellow tint to this light to meet project requirements
+    DrawData draw;
+    draw.model = model * paperMesh.dequantize;
+    draw.lightColor = glm::vec4(1.0f, 1.0f, 0.6f, 1.0f);
+    draw.material = glm::uvec4(gPaperTexture.array, gPaperTexture.layer, 0, 0);
+    queue.Add(program, textureSet, paperMesh, draw);
+}
+// Create the cube used for every lamp, with per-instance model matrix and color attributes
+//------------------------------------------------------------------------------------------
+void CreateLampMesh(GLMesh& mesh)
+{
+    GLfloat verts[] = {
+        // Vertex Positions
+        0.5f, 0.5f, 0.0f,   0.5f, -0.5f, 0.0f,   -0.5f, 0.5f, 0.0f,
+        0.5f, -0.5f, 0.0f,  -0.5f, -0.5f, 0.0f,  -0.5f, 0.5f, 0.0f,
 
-    // Set the shader to be used
-    glUseProgram(programIdLighting);
+        0.5f, 0.5f, 0.0f,   0.5f, -0.5f, 0.0f,   0.5f, -0.5f, -1.0f,
+        0.5f, 0.5f, 0.0f,   0.5f, -0.5f, -1.0f,  0.5f, 0.5f, -1.0f,
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programIdLighting, "model");
-    GLint viewLoc = glGetUniformLocation(programIdLighting, "view");
-    GLint projLoc = glGetUniformLocation(programIdLighting, "projection");
+        0.5f, 0.5f, 0.0f,   0.5f, 0.5f, -1.0f,   -0.5f, 0.5f, -1.0f,
+        0.5f, 0.5f, 0.0f,   -0.5f, 0.5f, 0.0f,   -0.5f, 0.5f, -1.0f,
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        0.5f, -0.5f, -1.0f, 0.5f, 0.5f, -1.0f,   -0.5f, 0.5f, -1.0f,
+        0.5f, -0.5f, -1.0f, -0.5f, 0.5f, -1.0f,  -0.5f, -0.5f, -1.0f,
 
-    // Reference matrix uniforms from the Shader program for the cube color, light color, light position, and camera position
-    GLint objectColorLoc = glGetUniformLocation(programIdLighting, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(programIdLighting, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(programIdLighting, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(programIdLighting, "viewPosition");
+        -0.5f, -0.5f, 0.0f, -0.5f, 0.5f, 0.0f,   -0.5f, 0.5f, -1.0f,
+        -0.5f, -0.5f, 0.0f, -0.5f, 0.5f, -1.0f,  -0.5f, -0.5f, -1.0f,
 
-    // Pass color, light, and camera data to the Shader program's corresponding uniforms
-    // Add a yellow tint to this light to meet project requirements
-    glUniform3f(objectColorLoc, 1.0f, 1.0f, 0.0f);
-    glUniform3f(lightColorLoc, 1.0f, 1.0f, 0.6f);
-    glUniform3f(lightPositionLoc, 0.0f, 0.0f, 0.0f);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-
-    GLint UVScaleLoc = glGetUniformLocation(programIdLighting, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+        0.5f, -0.5f, 0.0f,  0.5f, -0.5f, -1.0f,  -0.5f, -0.5f, -1.0f,
+        0.5f, -0.5f, 0.0f,  -0.5f, -0.5f, 0.0f,  -0.5f, -0.5f, -1.0f
+    };
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(paperMesh.vao);
+    // Positions only; the lamp shader's instance matrix has no room for a dequantization transform
+    VertexLayout layout = VertexLayout::Create(VertexFormat::Float, false, false);
 
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureIdPaper);
+    // Weld the shared vertices of the triangle soup, reorder them for the GPU and upload them with an index buffer
+    const GLuint soupVertices = sizeof(verts) / (sizeof(verts[0]) * layout.SourceFloatsPerVertex());
+    IndexedMesh indexed = WeldVertices(verts, soupVertices, layout.SourceFloatsPerVertex());
+    OptimizeMesh(indexed, "lamp");
+    UploadIndexedMesh(gGeometryHeap, mesh, indexed, layout, "lamp");
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, paperMesh.nVertices);
+    // Instance buffer: the mat4 takes four vec4 attribute slots, then the color. Each advances once per instance.
+    // They are added to the heap page's VAO, which only the lamp uses with this layout; plain draws ignore them.
+    glGenBuffers(1, &lampInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, lampInstanceBuffer);
+    for (GLuint column = 0; column < 4; ++column)
+    {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(LampInstance), (void*)(sizeof(glm::vec4) * column));
+        glEnableVertexAttribArray(3 + column);
+        glVertexAttribDivisor(3 + column, 1);
+    }
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(LampInstance), (void*)offsetof(LampInstance, color));
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
 
-    // Draw lamps
-    glUseProgram(programIdLamp);
+    glBindVertexArray(0);
+}
 
-    // Position light 1
-    // ------------------
+// Add a light marker lamp
+//-------------------------
+void AddLamp(const glm::vec3& position, const glm::vec3& color)
+{
+    LampInstance lamp;
     //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(glm::vec3(-4.0f, 2.5f, -2.0f)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
-
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(programIdLamp, "model");
-    viewLoc = glGetUniformLocation(programIdLamp, "view");
-    projLoc = glGetUniformLocation(programIdLamp, "projection");
+    lamp.model = glm::translate(position) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
+    lamp.color = glm::vec4(color, 1.0f);
+    gLamps.push_back(lamp);
+    gLampsDirty = true;
+
+    // Each lamp lights what lies within a few units of it
+    PointLight light;
+    light.positionRadius = glm::vec4(position, 6.0f);
+    light.color = glm::vec4(color * 0.4f, 1.0f);
+    gLampLights.push_back(light);
+}
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Position the five ceiling lamps above the countertop
+//------------------------------------------------------
+void CreateLamps()
+{
+    // Interior lights over the granite
+    AddLamp(glm::vec3(-2.0f, 2.5f, -2.0f), glm::vec3(1.0f));
+    AddLamp(glm::vec3(2.0f, 2.5f, -2.0f), glm::vec3(1.0f));
+    AddLamp(glm::vec3(0.0f, 2.5f, -2.0f), glm::vec3(1.0f));
+    // Exterior lights over the paper
+    AddLamp(glm::vec3(-4.0f, 2.5f, -2.0f), glm::vec3(1.0f));
+    AddLamp(glm::vec3(4.0f, 2.5f, -2.0f), glm::vec3(1.0f));
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, paperMesh.nVertices);
+// Copy the lamp instances to the GPU, growing the buffer when needed
+//--------------------------------------------------------------------
+void UploadLampInstances()
+{
+    gStateCache.BindBuffer(GL_ARRAY_BUFFER, lampInstanceBuffer);
+    if (gLamps.size() > lampInstanceCapacity)
+    {
+        lampInstanceCapacity = max(gLamps.size(), lampInstanceCapacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, lampInstanceCapacity * sizeof(LampInstance), nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, gLamps.size() * sizeof(LampInstance), gLamps.data());
+    gLampsDirty = false;
+}
 
-    // Position light 2
-    // ----------------------
-    //Transform the smaller cube used as a visual que for the light source
-    model = glm::translate(glm::vec3(4.0f, 2.5f, -2.0f)) * glm::scale(glm::vec3(0.3f, 0.3f, 0.3f));
+// Draw every lamp with a single instanced draw call
+//---------------------------------------------------
+void RenderLamps()
+{
+    if (gLamps.empty())
+        return;
 
-    // Reference matrix uniforms from the Lamp Shader program
-    modelLoc = glGetUniformLocation(programIdLamp, "model");
-    viewLoc = glGetUniformLocation(programIdLamp, "view");
-    projLoc = glGetUniformLocation(programIdLamp, "projection");
+    if (gLampsDirty)
+        UploadLampInstances();
 
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    gStateCache.UseProgram(programIdLamp);
+    gStateCache.BindVertexArray(lampMesh.vao);
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lampMesh.nIndices, lampMesh.indexType,
+        (void*)(lampMesh.firstIndex * (lampMesh.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t))),
+        (GLsizei)gLamps.size(), lampMesh.baseVertex);
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, paperMesh.nVertices);
-    // Pass matrix data to the Lamp Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Collect the lamps' lights and the animated lights for this frame and assign them to the clusters
+//----------------------------------------------------------------------------------------------------
+void UpdateLights()
+{
+    gLightTime += gDeltaTime;
 
-    glDrawArrays(GL_TRIANGLES, 0, paperMesh.nVertices);
+    gFrameLights.assign(gLampLights.begin(), gLampLights.end());
+    for (int i = 0; i < gAnimatedLightCount; ++i)
+    {
+        // Spread the lights over the countertop on orbits of their own; the golden angle keeps neighbors apart
+        const float phase = i * 2.39996f;
+        const float speed = 0.3f + 0.05f * (i % 7);
+        const float angle = phase + speed * gLightTime;
+        const glm::vec3 center(-4.0f + 8.0f * ((i * 37) % 101) / 100.0f, -0.3f + 0.1f * (i % 5), -3.0f + 3.0f * ((i * 53) % 97) / 96.0f);
+
+        PointLight light;
+        light.positionRadius = glm::vec4(center + 0.75f * glm::vec3(cos(angle), 0.0f, sin(angle)), 1.0f);
+        light.color = glm::vec4(0.5f + 0.5f * cos(phase), 0.5f + 0.5f * cos(phase + 2.1f), 0.5f + 0.5f * cos(phase + 4.2f), 1.0f) * 0.6f;
+        gFrameLights.push_back(light);
+    }
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    gLighting.Update(gStateCache, gFrameLights, gCamera.GetViewMatrix(), GetProjectionMatrix());
 }
+
 // Render the scene
 //------------------
 void RenderScene() {
@@ -1230,74 +1410,132 @@ void RenderScene() {
     glClearColor(0.01f, 0.18f, 0.31f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Call functions to render objects
-    RenderCountertop();
-    RenderLaptopScreen();
-    RenderLaptopBase();
-    RenderBook();
-    RenderPaper();
+    // Upload this frame's view and projection once for every program
+    const glm::mat4 viewProjection = UpdateCameraBlock();
+
+    // Bindings made outside the cache since the last frame (uploads, the headless readback) are not tracked, so the
+    // first request of each state this frame is always issued
+    gStateCache.Invalidate();
+    gStateCache.ResetCounters();
+
+    // Sort this frame's point lights into the clusters of the view before anything is shaded
+    UpdateLights();
+
+    // Bring the shadow maps up to date; with nothing moving this draws nothing
+    gShadows.Update(gStateCache, gCamera.GetViewMatrix(), GetProjectionMatrix(), gLampLights);
+
+    // Collect this frame's object draws, then submit them sorted by program, textures and geometry page
+    gRenderQueue.Clear();
+    gRenderQueue.SetViewPosition(gCamera.Position);
+    QueueCountertop(gRenderQueue, programIdLighting, gSceneTextureSet);
+    QueueLaptopScreen(gRenderQueue, programIdTexture, gSceneTextureSet);
+    QueueLaptopBase(gRenderQueue, programIdTexture, gSceneTextureSet);
+    QueueBook(gRenderQueue, programIdTexture, gSceneTextureSet);
+    QueuePaper(gRenderQueue, programIdLighting, gSceneTextureSet);
+    if (gGpuCulling)
+        gGpuCuller.Begin(viewProjection);
+    else
+    {
+        if (gOcclusionCulling)
+            gOcclusionCuller.Begin(viewProjection);
+        gRenderQueue.Cull(Frustum::FromViewProjection(viewProjection), gOcclusionCulling ? &gOcclusionCuller : nullptr);
+    }
+
+    // The deferred path draws the objects into the G-buffer and lights them in one pass; the lamps are drawn forward
+    // on top either way
+    if (gDeferredShading)
+        gDeferred.BeginGeometry(gStateCache);
+    gRenderQueue.Submit(gStateCache, gGpuCulling ? &gGpuCuller : nullptr);
+    if (gDeferredShading)
+        gDeferred.Resolve(gStateCache, viewProjection);
+
+    RenderLamps();
+
+    // The finished depth becomes the next frame's Hi-Z pyramid
+    if (gGpuCulling)
+        gGpuCuller.CaptureDepth(gStateCache);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Destoy mesh data
-//------------------
-void DestroyMesh(GLMesh& mesh)
+// Creates a perspective projection or orthographic projection based on input given
+//-----------------------------------------------------------------------------------
+glm::mat4 GetProjectionMatrix()
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(1, &mesh.vbo);
+    if (ortho) {
+        float ortho_scale = 100;
+        return glm::ortho(-((float)WINDOW_WIDTH / ortho_scale), ((float)WINDOW_WIDTH / ortho_scale), -((float)WINDOW_HEIGHT / ortho_scale), ((float)WINDOW_HEIGHT / ortho_scale), 4.5f, 6.5f);
+    }
+    return glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 }
 
+// Point the object draws at the forward or the G-buffer programs
+//----------------------------------------------------------------
+void SelectShadingPath(bool deferred)
+{
+    gDeferredShading = deferred;
+    const ObjectPrograms& programs = deferred ? gGBufferPrograms : gForwardPrograms;
+    programIdLighting = programs.lighting;
+    programIdTexture = programs.texture;
+}
 
-// Generate and load the texture
-//-------------------------------
-bool CreateTexture(const char* filename, GLuint& textureId)
+// Write the camera uniform block for this frame
+//-----------------------------------------------
+glm::mat4 UpdateCameraBlock()
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
-
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
-
-        // Set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // Set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
-        }
+    CameraBlock block;
+    block.view = gCamera.GetViewMatrix();
+    block.projection = GetProjectionMatrix();
+    block.viewPosition = glm::vec4(gCamera.Position, 1.0f);
+    gCameraBuffer.update(block);
+    return block.projection * block.view;
+}
 
-        glGenerateMipmap(GL_TEXTURE_2D);
 
-        stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+// Destoy mesh data
+//------------------
+void DestroyMesh(GLMesh& mesh)
+{
+    gGeometryHeap.Free(mesh);
+}
 
-        return true;
-    }
 
-    // Error loading the image
-    return false;
+// Queue the scene's images and pack them into texture arrays. Granite and the keyboard share a size and so an array;
+// the book's textures differ in size and are resampled into one group so the book draws without changing textures.
+// With bindless textures every image keeps its size and the layers index the handle table instead.
+// The images then stream in while the first frames render, except in headless and benchmark runs without --stream-textures.
+//------------------------------------------------------------------------------------------------------------------
+void AddSceneTextures()
+{
+    gTextures.Add("Textures/granite.jpg");                  // SCENE_TEXTURE_GRANITE
+    gTextures.Add("Textures/laptop_screen.jpg");            // SCENE_TEXTURE_LAPTOP_SCREEN
+    gTextures.Add("Textures/laptop_keyboard.jpg");          // SCENE_TEXTURE_LAPTOP_KEYBOARD
+    gTextures.Add("Textures/book_pages.jpg", "book");       // SCENE_TEXTURE_BOOK, BOOK_LAYER_PAGES
+    gTextures.Add("Textures/book_side.jpg", "book");        // BOOK_LAYER_SIDE
+    gTextures.Add("Textures/book_cover.jpg", "book");       // BOOK_LAYER_COVER
+    gTextures.Add("Textures/paper.jpg");                    // SCENE_TEXTURE_PAPER
 }
 
-// Destroy texture data
-//----------------------
-void DestroyTexture(GLuint textureId)
+bool LoadSceneTextures(bool bindless)
 {
-    glGenTextures(1, &textureId);
+    AddSceneTextures();
+    if (!gTextures.Build(gThreadPool, bindless, gUseBakedTextures, gMipFilter, gTextureCache ? "TextureCache" : nullptr))
+        return false;
+    if ((gHeadless || gBenchmarkMode) && !gStreamTextures && !gTextures.Finish())
+        return false;
+
+    if (gTextures.ArrayCount() > SHADER_TEXTURE_UNITS)
+    {
+        cout << "The scene needs " << gTextures.ArrayCount() << " texture arrays but the shaders sample at most " << SHADER_TEXTURE_UNITS << endl;
+        return false;
+    }
+
+    gGraniteTexture = gTextures.Layer(SCENE_TEXTURE_GRANITE);
+    gLaptopScreenTexture = gTextures.Layer(SCENE_TEXTURE_LAPTOP_SCREEN);
+    gLaptopKeyboardTexture = gTextures.Layer(SCENE_TEXTURE_LAPTOP_KEYBOARD);
+    gBookTexture = gTextures.Layer(SCENE_TEXTURE_BOOK);
+    gPaperTexture = gTextures.Layer(SCENE_TEXTURE_PAPER);
+    return true;
 }
 
 // Destroy shader program
@@ -0,0 +1,733 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Texture arrays
+// Description: Decodes the scene's images on worker threads and streams them into texture array layers.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // max, min
+#include <cstring>          // memcpy
+#include <fstream>          // ifstream
+
+#include "stb_image.h"      // Image loading Utility functions
+#include "gl_extensions.h"
+#include "texture_array.h"
+#include "texture_bake.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    int MipLevels(int width, int height)
+    {
+        int levels = 1;
+        while ((width | height) >> levels)
+            ++levels;
+        return levels;
+    }
+
+    GLenum PixelFormat(int channels)
+    {
+        return channels == 4 ? GL_RGBA : GL_RGB;
+    }
+
+    GLenum CompressedFormat(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        }
+    }
+
+    bool FormatSupported(BlockFormat format)
+    {
+        return format == BlockFormat::BC7 || gGLExt.textureCompressionS3TC;
+    }
+
+    size_t MipChainBytes(bool compressed, BlockFormat format, int width, int height)
+    {
+        size_t bytes = 0;
+        for (int level = 0; level < MipLevels(width, height); ++level)
+        {
+            const int levelWidth = max(width >> level, 1), levelHeight = max(height >> level, 1);
+            bytes += compressed ? CompressedSize(format, levelWidth, levelHeight) : static_cast<size_t>(levelWidth) * levelHeight * 4;
+        }
+        return bytes;
+    }
+
+    // Flat mid grey the layers and the bindless table show until their image is complete
+    const GLfloat PLACEHOLDER_COLOR[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    const unsigned char PLACEHOLDER_TEXEL[4] = { 128, 128, 128, 255 };
+
+    double MillisecondsSince(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // Whole file into bytes; false, with bytes empty, when it cannot be read
+    bool ReadWholeFile(const string& filename, vector<unsigned char>& bytes)
+    {
+        ifstream file(filename, ios::binary | ios::ate);
+        bytes.resize(file ? static_cast<size_t>(file.tellg()) : 0);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        if (!file)
+            bytes.clear();
+        return !bytes.empty();
+    }
+
+    // levels: how many mip levels the texture holds, so trilinear filtering never reaches past the uploaded chain
+    void SetSamplerState(GLenum target, int levels)
+    {
+        // Set the texture wrapping parameters
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // Set texture filtering parameters
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+}
+
+
+int TextureArraySet::Add(const char* filename, const char* group)
+{
+    Image image;
+    image.filename = filename;
+    image.group = group ? group : "";
+    mImages.push_back(move(image));
+    return static_cast<int>(mImages.size() - 1);
+}
+
+// Lay the arrays out from the image headers and start decoding the images on the pool; Stream uploads them
+//-----------------------------------------------------------------------------------------------------------
+bool TextureArraySet::Build(ThreadPool& pool, bool bindless, bool baked, MipFilter filter, const char* cacheDirectory)
+{
+    mBindless = bindless && gGLExt.bindlessTexture;
+    mFilter = filter;
+    mCacheDirectory = cacheDirectory ? cacheDirectory : "";
+    if (!mCacheDirectory.empty() && !CreateDecodedCacheDirectory(mCacheDirectory))
+    {
+        cout << "INFO: Cannot create the decoded image cache " << mCacheDirectory << ", decoding every image" << endl;
+        mCacheDirectory.clear();
+    }
+    mPool = &pool;
+    mBuildStart = chrono::steady_clock::now();
+
+    if (!Layout())
+        return false;
+    if (baked)
+        FindBakedFiles(pool);
+
+    if (!mRing.Create(STREAM_SEGMENT_SIZE, STREAM_SEGMENTS))
+        return false;
+    glGenFramebuffers(1, &mClearFramebuffer);
+
+    if (mBindless)
+    {
+        // Table indices follow the arrays, whatever order the decodes finish in
+        GLuint index = 0;
+        for (const Array& array : mArrays)
+        {
+            for (int image : array.images)
+                mImages[image].placement = TextureLayer{ 0, index++ };
+        }
+        mTextures.assign(index, 0);
+        mHandles.assign(index, 0);
+        CreatePlaceholderHandle();
+    }
+    else
+    {
+        for (Array& array : mArrays)
+            Allocate(array);
+    }
+
+    // What the textures take once resident, against the same mip chains stored as RGBA8
+    size_t bakedImages = 0, textureBytes = 0, uncompressedBytes = 0;
+    for (Image& image : mImages)
+    {
+        const Array& array = mArrays[image.placement.array];
+        image.textureWidth = mBindless ? (image.baked ? image.ktx.width : image.width) : array.width;
+        image.textureHeight = mBindless ? (image.baked ? image.ktx.height : image.height) : array.height;
+        bakedImages += image.baked ? 1 : 0;
+        textureBytes += MipChainBytes(image.baked, image.ktx.format, image.textureWidth, image.textureHeight);
+        uncompressedBytes += MipChainBytes(false, image.ktx.format, image.textureWidth, image.textureHeight);
+    }
+    cout << "INFO: Textures: " << bakedImages << " of " << mImages.size() << " images from baked files, " << (textureBytes >> 10)
+        << " KB of texture memory against " << (uncompressedBytes >> 10) << " KB as RGBA8" << endl;
+
+    // Every image is decoded, or its baked file read, on a worker; the finished ones queue up for Stream
+    mDecoding = mImages.size();
+    for (int i = 0; i < static_cast<int>(mImages.size()); ++i)
+    {
+        pool.Run([this, i]() {
+            Image& image = mImages[i];
+            const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+            if (image.baked)
+            {
+                // The levels are uploaded where the header read by Build placed them, so the file must not have changed
+                Ktx2Texture ktx;
+                if (!ReadWholeFile(BakedPath(image.filename), image.file) || !ParseKtx2(image.file.data(), image.file.size(), ktx)
+                    || ktx.format != image.ktx.format || ktx.width != image.ktx.width || ktx.height != image.ktx.height
+                    || ktx.levels.size() != image.ktx.levels.size())
+                    image.file.clear();
+                else
+                    image.ktx.levels = ktx.levels;
+                image.decodeMs = MillisecondsSince(start);
+            }
+            else
+                DecodeImage(image);
+
+            lock_guard<mutex> lock(mDecodedMutex);
+            mDecoded.push(i);
+            --mDecoding;
+            mDecodedSignal.notify_all();
+        });
+    }
+    return true;
+}
+
+// Map the image's decoded cache entry, or decode it, build its mip chain and write the entry; runs on a pool worker
+//-------------------------------------------------------------------------------------------------------------------
+void TextureArraySet::DecodeImage(Image& image)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<unsigned char> bytes;
+    if (!ReadWholeFile(image.filename, bytes))
+        return;
+
+    // The source bytes are hashed even on a warm start, so an edited image misses the cache
+    string cachePath;
+    const string hash = mCacheDirectory.empty() ? string() : SourceHash(bytes.data(), bytes.size());
+    if (!mCacheDirectory.empty())
+    {
+        cachePath = DecodedCachePath(mCacheDirectory, hash, image.textureWidth, image.textureHeight, image.channels, mFilter);
+        image.cacheHit = OpenDecodedCache(cachePath, hash, image.textureWidth, image.textureHeight, image.channels, mFilter, image.cached);
+        if (image.cacheHit)
+        {
+            image.decodeMs = MillisecondsSince(start);
+            return;
+        }
+    }
+
+    // Images are loaded with Y axis going down, but OpenGL's Y axis goes up
+    stbi_set_flip_vertically_on_load_thread(1);
+    int width = 0, height = 0, channels = 0;
+    unsigned char* pixels = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &width, &height, &channels, 0);
+    vector<unsigned char>().swap(bytes);
+    image.decodeMs = MillisecondsSince(start);
+
+    // A file changed since its header was read is dropped; the scene images are all sRGB color. The worker is a pool
+    // thread itself, so the mip chain is built on it alone rather than with ParallelFor.
+    const chrono::steady_clock::time_point mipStart = chrono::steady_clock::now();
+    if (pixels && width == image.width && height == image.height && channels == image.channels)
+    {
+        image.levels = BuildMipChain(pixels, width, height, channels, image.textureWidth, image.textureHeight, mFilter, true,
+            nullptr);
+    }
+    stbi_image_free(pixels);
+    image.mipMs = MillisecondsSince(mipStart);
+
+    // A failed write only costs the next run its warm start
+    if (!cachePath.empty() && !image.levels.empty())
+    {
+        const chrono::steady_clock::time_point cacheStart = chrono::steady_clock::now();
+        WriteDecodedCache(cachePath, hash, image.textureWidth, image.textureHeight, image.channels, mFilter, image.levels);
+        image.cacheMs = MillisecondsSince(cacheStart);
+    }
+}
+
+// Read every image's header and assign it an array and layer
+//--------------------------------------------------------------
+bool TextureArraySet::Layout()
+{
+    // The headers alone give every size, so the arrays exist before the first image is decoded
+    for (Image& image : mImages)
+    {
+        if (!stbi_info(image.filename.c_str(), &image.width, &image.height, &image.channels))
+        {
+            cout << "Failed to load texture " << image.filename << endl;
+            return false;
+        }
+        if (image.channels != 3 && image.channels != 4)
+        {
+            cout << "Not implemented to handle image with " << image.channels << " channels" << endl;
+            return false;
+        }
+    }
+
+    GLint maxSize = MAX_GROUP_SIZE;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+
+    for (int i = 0; i < static_cast<int>(mImages.size()); ++i)
+    {
+        Image& image = mImages[i];
+        string key = image.group.empty() ? to_string(image.width) + "x" + to_string(image.height) : "group " + image.group;
+
+        size_t a = 0;
+        while (a < mArrays.size() && mArrays[a].key != key)
+            ++a;
+        if (a == mArrays.size())
+        {
+            Array array;
+            array.key = key;
+            mArrays.push_back(array);
+        }
+
+        Array& array = mArrays[a];
+        if (image.group.empty())
+        {
+            array.width = image.width;
+            array.height = image.height;
+        }
+        else
+        {
+            int limit = min<int>(MAX_GROUP_SIZE, maxSize);
+            array.width = min(max(array.width, image.width), limit);
+            array.height = min(max(array.height, image.height), limit);
+        }
+        image.placement.array = static_cast<GLuint>(a);
+        image.placement.layer = static_cast<GLuint>(array.images.size());
+        array.images.push_back(i);
+    }
+    return true;
+}
+
+// Keep the baked files written from the current images, then the arrays whose every layer has one that fits
+//-------------------------------------------------------------------------------------------------------------
+void TextureArraySet::FindBakedFiles(ThreadPool& pool)
+{
+    // Hashing the images reads them whole, so the files are checked in parallel
+    pool.ParallelFor(mImages.size(), [this](size_t i) {
+        Image& image = mImages[i];
+        image.baked = ReadKtx2Header(BakedPath(image.filename), image.ktx) && FormatSupported(image.ktx.format)
+            && static_cast<int>(image.ktx.levels.size()) == MipLevels(image.ktx.width, image.ktx.height)
+            && BakeIsCurrent(image.filename, image.ktx);
+    });
+
+    if (mBindless)
+        return;
+    for (size_t a = 0; a < mArrays.size(); ++a)
+    {
+        Array& array = mArrays[a];
+        const Image& first = mImages[array.images[0]];
+        array.compressed = true;
+        array.blockFormat = first.ktx.format;
+        size_t bakedLayers = 0;
+        for (int index : array.images)
+        {
+            const Image& image = mImages[index];
+            bakedLayers += image.baked ? 1 : 0;
+            array.compressed = array.compressed && image.baked && image.ktx.format == array.blockFormat
+                && image.ktx.width == array.width && image.ktx.height == array.height;
+        }
+        if (array.compressed)
+            continue;
+
+        // Layers of one array share a format, so a single missing or stale file sends the whole array to the decoder
+        for (int index : array.images)
+            mImages[index].baked = false;
+        if (bakedLayers > 0)
+            cout << "INFO: Texture array " << a << ": " << array.images.size() - bakedLayers << " of " << array.images.size()
+                << " layers have no current baked file, decoding them all" << endl;
+    }
+}
+
+bool TextureArraySet::Bake(ThreadPool& pool, BlockFormat format, MipFilter filter)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!Layout())
+        return false;
+
+    size_t bakedBytes = 0, uncompressedBytes = 0;
+    for (const Image& image : mImages)
+    {
+        const Array& array = mArrays[image.placement.array];
+        const BlockFormat imageFormat = format == BlockFormat::BC1 && image.channels == 4 ? BlockFormat::BC3 : format;
+        if (!BakeTexture(image.filename, array.width, array.height, imageFormat, filter, pool, bakedBytes, uncompressedBytes))
+            return false;
+    }
+
+    cout << "INFO: Baked " << mImages.size() << " textures in " << MillisecondsSince(start) << " ms on " << pool.WorkerCount() + 1
+        << " threads: " << (bakedBytes >> 10) << " KB against " << (uncompressedBytes >> 10) << " KB of RGBA8 mip chains" << endl;
+    mArrays.clear();
+    return true;
+}
+
+// Allocate one array with a full mip chain and fill every level of every layer with the placeholder
+//----------------------------------------------------------------------------------------------------
+void TextureArraySet::Allocate(Array& array)
+{
+    const int levels = MipLevels(array.width, array.height);
+    const GLsizei layers = static_cast<GLsizei>(array.images.size());
+    glGenTextures(1, &array.id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, array.compressed ? CompressedFormat(array.blockFormat) : GL_RGBA8, array.width,
+        array.height, layers);
+    SetSamplerState(GL_TEXTURE_2D_ARRAY, levels);
+    array.pending = array.images.size();
+
+    if (array.compressed)
+    {
+        // Compressed layers can be neither cleared nor rendered to, so the placeholder is one encoded block repeated
+        unsigned char texels[16 * 4];
+        for (int i = 0; i < 16; ++i)
+            memcpy(texels + i * 4, PLACEHOLDER_TEXEL, 4);
+        const size_t blockBytes = BlockBytes(array.blockFormat);
+        vector<unsigned char> blocks(CompressedSize(array.blockFormat, array.width, array.height));
+        CompressImage(array.blockFormat, texels, 4, 4, blocks.data(), *mPool);
+        for (size_t offset = blockBytes; offset < blocks.size(); offset += blockBytes)
+            memcpy(blocks.data() + offset, blocks.data(), blockBytes);
+
+        for (int level = 0; level < levels; ++level)
+        {
+            const int width = max(array.width >> level, 1), height = max(array.height >> level, 1);
+            for (GLint layer = 0; layer < layers; ++layer)
+            {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, CompressedFormat(array.blockFormat),
+                    static_cast<GLsizei>(CompressedSize(array.blockFormat, width, height)), blocks.data());
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    GLint drawFramebuffer = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mClearFramebuffer);
+    for (int level = 0; level < levels; ++level)
+    {
+        for (GLint layer = 0; layer < layers; ++layer)
+        {
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array.id, level, layer);
+            glClearBufferfv(GL_COLOR, 0, PLACEHOLDER_COLOR);
+        }
+    }
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+}
+
+// Point every slot of the bindless handle table at a one texel placeholder
+//---------------------------------------------------------------------------
+void TextureArraySet::CreatePlaceholderHandle()
+{
+    glGenTextures(1, &mPlaceholder);
+    glBindTexture(GL_TEXTURE_2D, mPlaceholder);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    SetSamplerState(GL_TEXTURE_2D, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, PLACEHOLDER_TEXEL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mPlaceholderHandle = gGLExt.GetTextureHandle(mPlaceholder);
+    gGLExt.MakeTextureHandleResident(mPlaceholderHandle);
+
+    const vector<GLuint64> table(mHandles.size(), mPlaceholderHandle);
+    glGenBuffers(1, &mHandleBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mHandleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, table.size() * sizeof(GLuint64), table.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, HANDLE_BINDING, mHandleBuffer);
+    cout << "INFO: Bindless textures: " << table.size() << " handles, placeholders until each image is resident" << endl;
+}
+
+// The texture an image's rows stream into: a native size copy source for array layers, the image's own texture in bindless
+//----------------------------------------------------------------------------------------------------------------------------
+void TextureArraySet::CreateStaging(Image& image)
+{
+    glGenTextures(1, &image.staging);
+    glBindTexture(GL_TEXTURE_2D, image.staging);
+    glTexStorage2D(GL_TEXTURE_2D, LevelCount(image), image.baked ? CompressedFormat(image.ktx.format) : GL_RGBA8, image.textureWidth,
+        image.textureHeight);
+    if (mBindless)
+        SetSamplerState(GL_TEXTURE_2D, LevelCount(image));
+}
+
+int TextureArraySet::LevelCount(const Image& image) const
+{
+    return image.baked ? static_cast<int>(image.ktx.levels.size()) : MipLevels(image.textureWidth, image.textureHeight);
+}
+
+// Where a level's rows are in the decoded mip chain or the baked file, and how they are cut
+//--------------------------------------------------------------------------------------------
+TextureArraySet::Level TextureArraySet::SourceLevel(const Image& image, int level) const
+{
+    const int width = max(image.textureWidth >> level, 1), height = max(image.textureHeight >> level, 1);
+    if (!image.baked)
+    {
+        const unsigned char* data = image.cacheHit ? image.cached.levels[level] : image.levels[level].data();
+        return Level{ data, width, height, static_cast<size_t>(width) * image.channels, height, 1 };
+    }
+
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    return Level{ image.file.data() + image.ktx.levels[level].offset, width, height, blocksX * BlockBytes(image.ktx.format), blocksY, 4 };
+}
+
+void TextureArraySet::Stream()
+{
+    StreamSegment(false);
+}
+
+bool TextureArraySet::Finish()
+{
+    while (!Resident())
+    {
+        // With nothing decoded left to stream, sleep until a worker hands over the next image
+        if (mUploads.empty())
+        {
+            unique_lock<mutex> lock(mDecodedMutex);
+            mDecodedSignal.wait(lock, [this] { return !mDecoded.empty(); });
+        }
+        StreamSegment(true);
+    }
+    return !mFailed;
+}
+
+// Fill one ring segment with the rows of the decoded images in order, then upload them all from the ring
+//---------------------------------------------------------------------------------------------------------
+void TextureArraySet::StreamSegment(bool wait)
+{
+    mStreamedBytes = 0;
+    {
+        lock_guard<mutex> lock(mDecodedMutex);
+        for (; !mDecoded.empty(); mDecoded.pop())
+        {
+            Image& image = mImages[mDecoded.front()];
+            if (!image.levels.empty() || image.cacheHit || !image.file.empty())
+            {
+                mUploads.push_back(mDecoded.front());
+                continue;
+            }
+
+            // A failed image keeps the placeholder
+            cout << "Failed to load texture " << image.filename << endl;
+            mFailed = true;
+            ++mCompleted;
+        }
+    }
+    if (mUploads.empty())
+        return;
+
+    unsigned char* segment = mRing.Begin(wait);
+    if (!segment)
+        return; // the GPU is still reading every segment; try again next frame
+
+    // Whole rows only, so an image larger than a segment is spread over several
+    mStrips.clear();
+    size_t used = 0;
+    for (int index : mUploads)
+    {
+        Image& image = mImages[index];
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const size_t firstStrip = mStrips.size();
+        while (image.streamLevel < LevelCount(image))
+        {
+            const Level level = SourceLevel(image, image.streamLevel);
+            const int rows = min(level.rows - image.streamedRows, static_cast<int>((STREAM_SEGMENT_SIZE - used) / level.rowSize));
+            if (rows <= 0)
+                break;
+
+            const int y = image.streamedRows * level.rowHeight;
+            memcpy(segment + used, level.data + image.streamedRows * level.rowSize, rows * level.rowSize);
+            mStrips.push_back(Strip{ index, image.streamLevel, y, level.width, min(rows * level.rowHeight, level.height - y),
+                rows * level.rowSize, segment + used });
+            used = (used + rows * level.rowSize + 15) & ~size_t(15);
+            image.streamedRows += rows;
+            if (image.streamedRows == level.rows)
+            {
+                ++image.streamLevel;
+                image.streamedRows = 0;
+            }
+        }
+        image.segments += mStrips.size() > firstStrip ? 1 : 0;
+        image.uploadMs += MillisecondsSince(start);
+
+        if (image.streamLevel < LevelCount(image))
+            break; // the segment is full
+        vector<vector<unsigned char>>().swap(image.levels);
+        vector<unsigned char>().swap(image.file);
+        image.cached = DecodedCacheEntry();
+    }
+    mRing.Commit();
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const Strip& strip : mStrips)
+    {
+        Image& image = mImages[strip.image];
+        const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!image.staging)
+            CreateStaging(image);
+        else
+            glBindTexture(GL_TEXTURE_2D, image.staging);
+        if (image.baked)
+        {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, strip.level, 0, strip.y, strip.width, strip.height, CompressedFormat(image.ktx.format),
+                static_cast<GLsizei>(strip.size), mRing.Offset(strip.data));
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, strip.level, 0, strip.y, strip.width, strip.height, PixelFormat(image.channels), GL_UNSIGNED_BYTE,
+                mRing.Offset(strip.data));
+        }
+        image.uploadMs += MillisecondsSince(start);
+        mStreamedBytes += strip.size;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    mRing.End();
+    ++mSegments;
+
+    // Images whose last rows were in this segment move into place
+    while (!mUploads.empty() && mImages[mUploads.front()].streamLevel == LevelCount(mImages[mUploads.front()]))
+    {
+        CompleteImage(mImages[mUploads.front()]);
+        mUploads.pop_front();
+    }
+}
+
+// Replace the placeholder with a fully streamed image: copy or scale it into its layer, or publish its bindless handle
+//-----------------------------------------------------------------------------------------------------------------------
+void TextureArraySet::CompleteImage(Image& image)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (mBindless)
+    {
+        // The texture's state is frozen once a handle exists, so the handle is taken after its last level arrived
+        const GLuint64 handle = gGLExt.GetTextureHandle(image.staging);
+        gGLExt.MakeTextureHandleResident(handle);
+        mTextures[image.placement.layer] = image.staging;
+        mHandles[image.placement.layer] = handle;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mHandleBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, image.placement.layer * sizeof(GLuint64), sizeof(GLuint64), &handle);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        image.staging = 0;
+    }
+    else
+    {
+        const Array& array = mArrays[image.placement.array];
+        const GLint layer = static_cast<GLint>(image.placement.layer);
+        // Decoded or baked, the image arrived at the layer's size with every level
+        for (int level = 0; level < LevelCount(image); ++level)
+        {
+            glCopyImageSubData(image.staging, GL_TEXTURE_2D, level, 0, 0, 0, array.id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+                max(array.width >> level, 1), max(array.height >> level, 1), 1);
+        }
+        glDeleteTextures(1, &image.staging);
+        image.staging = 0;
+    }
+    image.uploadMs += MillisecondsSince(start);
+    mUploadMs += image.uploadMs;
+    (image.cacheHit ? mMappedMs : mDecodeMs) += image.decodeMs;
+    mMipMs += image.mipMs;
+    mCacheMs += image.cacheMs;
+    mCacheHits += image.cacheHit ? 1 : 0;
+    mCacheMisses += image.baked || image.cacheHit ? 0 : 1;
+    cout << "INFO: Texture " << image.filename;
+    if (image.baked)
+        cout << ": read baked " << BlockFormatName(image.ktx.format) << " file in " << image.decodeMs << " ms";
+    else if (image.cacheHit)
+        cout << ": mapped from the decoded cache in " << image.decodeMs << " ms";
+    else
+    {
+        cout << ": decoded in " << image.decodeMs << " ms, " << MipFilterName(mFilter) << " mips built in " << image.mipMs << " ms";
+        if (!mCacheDirectory.empty())
+            cout << ", cached in " << image.cacheMs << " ms";
+    }
+    cout << ", streamed in " << image.segments << (image.segments == 1 ? " segment, " : " segments, ") << image.uploadMs
+        << " ms of copies and uploads" << endl;
+
+    // The last layer of an array completes it
+    if (!mBindless && --mArrays[image.placement.array].pending == 0)
+        CompleteArray(mArrays[image.placement.array]);
+
+    if (++mCompleted == mImages.size())
+    {
+        // A warm start maps every image that is not baked; images decoded anyway are new or edited since the last run
+        cout << "INFO: Textures resident after " << MillisecondsSince(mBuildStart) << " ms";
+        if (!mCacheDirectory.empty() && mCacheHits + mCacheMisses > 0)
+        {
+            cout << " (" << (mCacheMisses == 0 ? "warm" : mCacheHits == 0 ? "cold" : "partly warm") << " start, " << mCacheHits
+                << " of " << mCacheHits + mCacheMisses << " decoded images mapped from the cache in " << mMappedMs << " ms, "
+                << mCacheMs << " ms of cache writes)";
+        }
+        cout << ": " << mDecodeMs << " ms of decoding and " << mMipMs << " ms of mip generation on " << mPool->WorkerCount()
+            << (mPool->WorkerCount() == 1 ? " worker thread, " : " worker threads, ") << mUploadMs
+            << " ms of uploads in " << mSegments << " ring segments (" << mRing.BusyCount() << " frames found the ring busy)" << endl;
+    }
+}
+
+// Report an array whose layers have all arrived; every layer brought its whole mip chain
+//-----------------------------------------------------------------------------------------
+void TextureArraySet::CompleteArray(const Array& array)
+{
+    string names;
+    bool resampled = false;
+    for (size_t layer = 0; layer < array.images.size(); ++layer)
+    {
+        const Image& image = mImages[array.images[layer]];
+        names += (layer ? ", " : "") + image.filename;
+        resampled = resampled || image.width != array.width || image.height != array.height;
+    }
+
+    const size_t layers = array.images.size();
+    const string& group = mImages[array.images[0]].group;
+    cout << "INFO: Texture array " << (&array - mArrays.data()) << ": " << array.width << "x" << array.height << " "
+        << (array.compressed ? BlockFormatName(array.blockFormat) : "RGBA8") << ", " << layers
+        << (layers == 1 ? " layer" : " layers") << (group.empty() ? "" : " (group " + group + (resampled ? ", resampled)" : ")"))
+        << ": " << names << endl;
+}
+
+vector<TextureBinding> TextureArraySet::Bindings(GLuint firstUnit) const
+{
+    vector<TextureBinding> bindings;
+    if (!mBindless)
+    {
+        for (size_t i = 0; i < mArrays.size(); ++i)
+            bindings.push_back(TextureBinding{ firstUnit + static_cast<GLuint>(i), GL_TEXTURE_2D_ARRAY, mArrays[i].id });
+    }
+    return bindings;
+}
+
+void TextureArraySet::Destroy()
+{
+    // The decode tasks write into mImages, so every one still running is waited for
+    {
+        unique_lock<mutex> lock(mDecodedMutex);
+        mDecodedSignal.wait(lock, [this] { return mDecoding == 0; });
+        mDecoded = queue<int>();
+    }
+    for (Image& image : mImages)
+    {
+        vector<vector<unsigned char>>().swap(image.levels);
+        vector<unsigned char>().swap(image.file);
+        image.cached = DecodedCacheEntry();
+        glDeleteTextures(1, &image.staging);
+    }
+    mUploads.clear();
+    mRing.Destroy();
+    glDeleteFramebuffers(1, &mClearFramebuffer);
+    mClearFramebuffer = 0;
+
+    for (GLuint64 handle : mHandles)
+    {
+        if (handle)
+            gGLExt.MakeTextureHandleNonResident(handle); // images that never completed have no handle
+    }
+    if (mPlaceholderHandle)
+        gGLExt.MakeTextureHandleNonResident(mPlaceholderHandle);
+    if (!mTextures.empty())
+        glDeleteTextures(static_cast<GLsizei>(mTextures.size()), mTextures.data());
+    glDeleteTextures(1, &mPlaceholder);
+    glDeleteBuffers(1, &mHandleBuffer);
+    mHandleBuffer = mPlaceholder = 0;
+    mPlaceholderHandle = 0;
+    mHandles.clear();
+    mTextures.clear();
+
+    for (Array& array : mArrays)
+        glDeleteTextures(1, &array.id);
+    mArrays.clear();
+    mImages.clear();
+    mCompleted = 0;
+}
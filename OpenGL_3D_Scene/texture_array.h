@@ -0,0 +1,200 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Texture arrays: scene images packed into GL_TEXTURE_2D_ARRAY layers so draws select a texture by array and layer instead
+ * of rebinding. Images of equal size share an array; images of a named group share one array at a common resampled size.
+ * In bindless mode every image keeps its own size in a resident 2D texture and the layers are flattened into a storage
+ * buffer of 64-bit handles, so a layer becomes an index into that table. Images are decoded on a thread pool, where the
+ * worker also scales each to its layer's size and builds its mip chain (mip_chain.h), and streamed in while the scene
+ * renders: every frame moves at most one segment of a persistently mapped pixel buffer ring into the textures, so no
+ * frame pays for a whole image. An image is assembled level by level in a staging texture and only copied into its layer,
+ * or its handle published, once complete; until then draws sample a flat placeholder. An image with a current baked KTX2
+ * file (texture_bake.h) is read from it instead: its block-compressed levels stream in as they are, with no decode and no
+ * mip generation. Given a cache directory, the mip chain of every decoded image is also written to a decoded cache entry
+ * (decoded_cache.h), and on later runs that entry is mapped and streamed from instead of decoding the image again.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "block_compression.h"
+#include "decoded_cache.h"
+#include "gl_state_cache.h"
+#include "ktx2_file.h"
+#include "mip_chain.h"
+#include "pixel_upload_ring.h"
+#include "thread_pool.h"
+
+// Where an image ended up after packing
+struct TextureLayer
+{
+    GLuint array = 0;   // position of the array in the set; bound to texture unit firstUnit + array (0 in bindless mode)
+    GLuint layer = 0;   // layer in the array, or index in the handle table in bindless mode
+};
+
+class TextureArraySet
+{
+public:
+    static const int MAX_GROUP_SIZE = 2048; // largest width or height a resampled group is stored at
+    static const GLuint HANDLE_BINDING = 2; // shader storage binding point of the bindless handle table
+    static const GLsizeiptr STREAM_SEGMENT_SIZE = 4 << 20; // bytes of pixels one Stream call uploads at most
+    static const int STREAM_SEGMENTS = 3;   // ring segments, so the GPU can still read two while the next one is written
+
+    // Queues an image file and returns its handle. Within a group, layers follow the order of the Add calls.
+    int Add(const char* filename, const char* group = nullptr);
+
+    // Lays the arrays out from the image headers, or with bindless one texture per image, fills them with the placeholder
+    // and starts decoding every queued image on the pool's workers. Returns without waiting for a decode. Handles are
+    // stored array by array, so the images of a group keep consecutive indices. With baked, an array is block-compressed
+    // when every one of its images has a current baked file of one format at the array's size; a bindless texture only
+    // needs its own image's file. The decoded images are scaled and mipped with filter, and with a cacheDirectory read
+    // from or written to the decoded cache there; a directory that cannot be created only disables the cache.
+    bool Build(ThreadPool& pool, bool bindless = false, bool baked = true, MipFilter filter = MipFilter::Kaiser,
+        const char* cacheDirectory = nullptr);
+
+    // Writes the baked file of every queued image, at the size Build gives its layer: the images of a group are scaled
+    // to the group's size. BC1 stands for BC3 on images with an alpha channel.
+    bool Bake(ThreadPool& pool, BlockFormat format, MipFilter filter = MipFilter::Kaiser);
+
+    // Uploads the next segment of decoded pixels; call once per frame. Waits neither for decodes nor for the GPU, and
+    // prints the decode and upload time of each image that becomes resident and the file of each that failed to load.
+    void Stream();
+
+    // Streams until every image is resident, waiting for decodes and ring segments; false when an image failed to load
+    bool Finish();
+
+    bool Resident() const { return mCompleted == mImages.size(); }
+    size_t PendingCount() const { return mImages.size() - mCompleted; }  // images still showing the placeholder
+    size_t StreamedBytes() const { return mStreamedBytes; }               // pixel bytes uploaded by the last Stream
+
+    TextureLayer Layer(int handle) const { return mImages[handle].placement; }
+    bool Bindless() const { return mBindless; }
+    size_t ArrayCount() const { return mBindless ? 0 : mArrays.size(); } // texture units the set occupies
+
+    // Bindings placing array i on texture unit firstUnit + i; empty in bindless mode, where the handle table is bound
+    // to HANDLE_BINDING once by Build. Valid from Build on; layers hold the placeholder until their image arrives.
+    std::vector<TextureBinding> Bindings(GLuint firstUnit) const;
+
+    void Destroy();
+
+private:
+    struct Image
+    {
+        std::string filename;
+        std::string group;
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        int textureWidth = 0;   // size of level 0 in the texture: the layer's, or in bindless mode the image's own or
+        int textureHeight = 0;  // its baked file's
+        std::vector<std::vector<unsigned char>> levels; // set by the worker that decoded the image, freed once in the ring
+        double decodeMs = 0.0;  // for a cache hit, hashing the file and mapping its entry
+        double mipMs = 0.0;     // scaling and mip generation on the worker
+        DecodedCacheEntry cached;           // levels mapped instead of decoded, unmapped once in the ring
+        bool cacheHit = false;
+        double cacheMs = 0.0;   // writing the decoded cache entry
+        TextureLayer placement;
+
+        bool baked = false;                 // loaded from its baked file, whose header is in ktx
+        Ktx2Texture ktx;
+        std::vector<unsigned char> file;    // the baked file, read by a worker and freed once it is in the ring
+
+        GLuint staging = 0;     // texture the rows are streamed into; in bindless mode the image's own texture
+        int streamLevel = 0;    // mip level being streamed
+        int streamedRows = 0;   // rows of the level copied into the ring so far, in blocks for a baked image
+        int segments = 0;       // ring segments the image was spread over
+        double uploadMs = 0.0;  // copies into the ring and upload calls
+    };
+
+    struct Array
+    {
+        std::string key;
+        GLuint id = 0;
+        int width = 0;
+        int height = 0;
+        std::vector<int> images;
+        size_t pending = 0;     // layers not complete yet
+        bool compressed = false;                    // holds the baked levels of its images in blockFormat
+        BlockFormat blockFormat = BlockFormat::BC7;
+    };
+
+    // One level of an image as it is streamed: whole rows of texels, or of 4x4 blocks for a baked image
+    struct Level
+    {
+        const unsigned char* data;
+        int width;
+        int height;
+        size_t rowSize;
+        int rows;
+        int rowHeight;  // texel rows per row
+    };
+
+    // Rows of one image level copied into the current ring segment
+    struct Strip
+    {
+        int image;
+        int level;
+        int y;
+        int width;
+        int height;
+        size_t size;
+        const unsigned char* data;
+    };
+
+    bool Layout();
+    void FindBakedFiles(ThreadPool& pool);
+    void DecodeImage(Image& image);
+    int LevelCount(const Image& image) const;
+    Level SourceLevel(const Image& image, int level) const;
+    void Allocate(Array& array);
+    void CreatePlaceholderHandle();
+    void CreateStaging(Image& image);
+    void StreamSegment(bool wait);
+    void CompleteImage(Image& image);
+    void CompleteArray(const Array& array);
+
+    std::vector<Image> mImages;
+    std::vector<Array> mArrays;
+
+    bool mBindless = false;
+    MipFilter mFilter = MipFilter::Kaiser;
+    std::string mCacheDirectory;        // empty when the decoded cache is off
+    std::vector<GLuint> mTextures;      // one texture per image in bindless mode
+    std::vector<GLuint64> mHandles;     // resident handles in table order, 0 until the image is complete
+    GLuint mHandleBuffer = 0;
+    GLuint mPlaceholder = 0;            // what the handle table points at until an image is complete
+    GLuint64 mPlaceholderHandle = 0;
+
+    // Decodes run on the pool and hand their image index to the GL thread through mDecoded
+    ThreadPool* mPool = nullptr;
+    std::mutex mDecodedMutex;
+    std::condition_variable mDecodedSignal;
+    std::queue<int> mDecoded;
+    size_t mDecoding = 0;               // decode tasks not finished yet
+
+    PixelUploadRing mRing;
+    GLuint mClearFramebuffer = 0;       // draw framebuffer the placeholder clears go through
+    std::deque<int> mUploads;           // decoded images in streaming order; the front one may be partly streamed
+    std::vector<Strip> mStrips;
+    size_t mCompleted = 0;              // images resident or failed
+    bool mFailed = false;
+    size_t mStreamedBytes = 0;
+    size_t mSegments = 0;
+    double mDecodeMs = 0.0;
+    double mMipMs = 0.0;
+    double mMappedMs = 0.0;
+    double mCacheMs = 0.0;
+    size_t mCacheHits = 0;
+    size_t mCacheMisses = 0;
+    double mUploadMs = 0.0;
+    std::chrono::steady_clock::time_point mBuildStart;
+};
+
+#endif
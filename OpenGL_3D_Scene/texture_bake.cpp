@@ -0,0 +1,134 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Texture bake
+// Description: Decodes, scales and mips a source image on the CPU and writes it block-compressed into a KTX2 file.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <iostream>         // cout
+#include <algorithm>        // max
+#include <chrono>           // steady_clock
+#include <cstdint>          // uint64_t
+#include <cstdio>           // snprintf
+#include <fstream>          // ifstream
+#include <vector>
+
+#include "stb_image.h"      // Image loading Utility functions
+#include "mip_chain.h"
+#include "texture_bake.h"
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const char* const SOURCE_HASH_KEY = "SceneSourceHash";
+
+    const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+    // 64-bit FNV-1a, continued over data
+    uint64_t Fnv1a(uint64_t hash, const unsigned char* data, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        return hash;
+    }
+
+    string HexDigits(uint64_t hash)
+    {
+        char digits[17];
+        snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(hash));
+        return digits;
+    }
+
+    // SourceHash of a file read in chunks; empty when the file cannot be read
+    string HashFile(const string& filename)
+    {
+        ifstream file(filename, ios::binary);
+        if (!file)
+            return string();
+
+        uint64_t hash = FNV_OFFSET_BASIS;
+        vector<char> buffer(1 << 16);
+        while (file)
+        {
+            file.read(buffer.data(), buffer.size());
+            hash = Fnv1a(hash, reinterpret_cast<const unsigned char*>(buffer.data()), static_cast<size_t>(file.gcount()));
+        }
+        return HexDigits(hash);
+    }
+}
+
+
+string SourceHash(const unsigned char* data, size_t size)
+{
+    return HexDigits(Fnv1a(FNV_OFFSET_BASIS, data, size));
+}
+
+string BakedPath(const string& source)
+{
+    const size_t dot = source.find_last_of('.');
+    const size_t slash = source.find_last_of("/\\");
+    const bool hasExtension = dot != string::npos && (slash == string::npos || dot > slash);
+    return (hasExtension ? source.substr(0, dot) : source) + ".ktx2";
+}
+
+bool BakeIsCurrent(const string& source, const Ktx2Texture& baked)
+{
+    const string* hash = baked.Find(SOURCE_HASH_KEY);
+    return hash && *hash == HashFile(source);
+}
+
+// Decode, scale, mip and compress one image; the levels are the ones a run decoding the image builds for its layer
+//--------------------------------------------------------------------------------------------------------------------
+bool BakeTexture(const string& source, int width, int height, BlockFormat format, MipFilter filter, ThreadPool& pool,
+    size_t& bakedBytes, size_t& uncompressedBytes)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // Rows bottom up like the decoded textures, so the baked levels load the same way round
+    stbi_set_flip_vertically_on_load_thread(1);
+    int sourceWidth = 0, sourceHeight = 0, channels = 0;
+    unsigned char* pixels = stbi_load(source.c_str(), &sourceWidth, &sourceHeight, &channels, 4);
+    if (!pixels)
+    {
+        cout << "Failed to load texture " << source << endl;
+        return false;
+    }
+
+    // Scene images are sRGB color, so every level is filtered in linear light
+    const vector<vector<unsigned char>> mips = BuildMipChain(pixels, sourceWidth, sourceHeight, 4, width, height, filter, true, &pool);
+    stbi_image_free(pixels);
+
+    Ktx2Texture texture;
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+    texture.metadata.emplace_back("KTXwriter", "OpenGL_3D_Scene texture bake");
+    texture.metadata.emplace_back(SOURCE_HASH_KEY, HashFile(source));
+    texture.metadata.emplace_back("SceneMipFilter", MipFilterName(filter));
+
+    vector<vector<unsigned char>> levels;
+    size_t rgbaBytes = 0;
+    for (size_t level = 0; level < mips.size(); ++level)
+    {
+        const int levelWidth = max(width >> level, 1), levelHeight = max(height >> level, 1);
+        levels.emplace_back(CompressedSize(format, levelWidth, levelHeight));
+        CompressImage(format, mips[level].data(), levelWidth, levelHeight, levels.back().data(), pool);
+        rgbaBytes += mips[level].size();
+    }
+
+    const string target = BakedPath(source);
+    if (!WriteKtx2(target, texture, levels))
+    {
+        cout << "Failed to write " << target << endl;
+        return false;
+    }
+
+    size_t compressed = 0;
+    for (const vector<unsigned char>& data : levels)
+        compressed += data.size();
+    bakedBytes += compressed;
+    uncompressedBytes += rgbaBytes;
+    cout << "INFO: Baked " << target << ": " << width << "x" << height << ", " << levels.size() << " levels of "
+        << BlockFormatName(format) << " (" << MipFilterName(filter) << " mips), " << (compressed >> 10) << " KB against " << (rgbaBytes >> 10) << " KB of RGBA8, in "
+        << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+    return true;
+}
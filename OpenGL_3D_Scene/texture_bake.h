@@ -0,0 +1,33 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Texture bake: turns a source image into a block-compressed KTX2 file with its whole mip chain, so a run that finds the
+ * file uploads it as is instead of decoding the image and building mips. The file records a hash of the source image's
+ * bytes and is ignored once the image changes.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef TEXTURE_BAKE_H
+#define TEXTURE_BAKE_H
+
+#include <cstddef>
+#include <string>
+
+#include "block_compression.h"
+#include "ktx2_file.h"
+#include "mip_chain.h"
+#include "thread_pool.h"
+
+// Hex digits of a 64-bit FNV-1a hash of a source image's bytes: what a baked file records, and the key of the decoded
+// image cache (decoded_cache.h)
+std::string SourceHash(const unsigned char* data, size_t size);
+
+// The source image's path with its extension replaced by .ktx2
+std::string BakedPath(const std::string& source);
+
+// True when baked was written from the current contents of source
+bool BakeIsCurrent(const std::string& source, const Ktx2Texture& baked);
+
+// Decodes source, scales it to width x height when its own size differs, builds the mip chain down to 1x1 with filter
+// and writes every level in format to BakedPath(source). Adds the file's and the equivalent RGBA8 mip chain's sizes to
+// the totals.
+bool BakeTexture(const std::string& source, int width, int height, BlockFormat format, MipFilter filter, ThreadPool& pool,
+    size_t& bakedBytes, size_t& uncompressedBytes);
+
+#endif
@@ -0,0 +1,117 @@
+//---------------------------------------------------------------------------------------------------------------------------------------------
+// Title: Thread pool
+// Description: Worker threads for parallel CPU work.
+//----------------------------------------------------------------------------------------------------------------------------------------------
+#include <algorithm>        // min, max
+#include <atomic>           // atomic
+#include <memory>           // shared_ptr, make_shared
+
+#include "thread_pool.h"
+
+using namespace std; // Standard namespace
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    if (workers == 0)
+    {
+        const unsigned hardware = thread::hardware_concurrency();
+        workers = hardware > 1 ? hardware - 1 : 1;
+    }
+    for (size_t i = 0; i < workers; ++i)
+        mWorkers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mWake.notify_all();
+    for (thread& worker : mWorkers)
+        worker.join();
+}
+
+// Take tasks until the pool shuts down
+//--------------------------------------
+void ThreadPool::WorkerLoop()
+{
+    for (;;)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mWake.wait(lock, [this] { return mStopping || !mTasks.empty(); });
+            if (mStopping && mTasks.empty())
+                return;
+            task = move(mTasks.front());
+            mTasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::Run(function<void()> task)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mTasks.push(move(task));
+    }
+    mWake.notify_one();
+}
+
+// Helpers and the caller pull indices from a shared counter, so uneven jobs balance themselves
+//----------------------------------------------------------------------------------------------
+void ThreadPool::ParallelFor(size_t count, const function<void(size_t)>& job)
+{
+    if (count == 0)
+        return;
+
+    // Helpers may sit behind long Run tasks, so the caller never waits for one to start: once it runs out of indices it
+    // closes the state, waits for the helpers already inside, and any helper dequeued later finds the state closed and
+    // returns without touching job. The state is shared because those late helpers outlive this call.
+    struct State
+    {
+        atomic<size_t> next{0};
+        mutex doneMutex;
+        condition_variable done;
+        size_t active = 0;
+        bool closed = false;
+    };
+    const shared_ptr<State> state = make_shared<State>();
+
+    auto run = [state, count, &job]() {
+        for (size_t i = state->next.fetch_add(1); i < count; i = state->next.fetch_add(1))
+            job(i);
+    };
+
+    const size_t helpers = min(mWorkers.size(), count - 1);
+    if (helpers > 0)
+    {
+        {
+            lock_guard<mutex> lock(mMutex);
+            for (size_t h = 0; h < helpers; ++h)
+            {
+                mTasks.push([state, run]() {
+                    {
+                        lock_guard<mutex> doneLock(state->doneMutex);
+                        if (state->closed)
+                            return;
+                        ++state->active;
+                    }
+                    run();
+                    lock_guard<mutex> doneLock(state->doneMutex);
+                    if (--state->active == 0)
+                        state->done.notify_one();
+                });
+            }
+        }
+        mWake.notify_all();
+    }
+
+    run();
+
+    unique_lock<mutex> lock(state->doneMutex);
+    state->closed = true;
+    state->done.wait(lock, [&] { return state->active == 0; });
+}
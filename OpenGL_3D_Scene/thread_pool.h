@@ -0,0 +1,44 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Thread pool: a fixed set of worker threads shared by the CPU-side frame work. ParallelFor spreads indexed jobs over the
+ * workers and the calling thread and returns when every index has run; Run queues a single task without waiting.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // 0 workers: one less than the hardware threads, since the calling thread joins every ParallelFor
+    explicit ThreadPool(size_t workers = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t WorkerCount() const { return mWorkers.size(); }
+
+    // Runs job(i) for every i in [0, count) and waits for all of them
+    void ParallelFor(size_t count, const std::function<void(size_t)>& job);
+
+    // Hands task to a worker and returns at once; the caller learns of its completion through the task itself
+    void Run(std::function<void()> task);
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> mWorkers;
+    std::queue<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    bool mStopping = false;
+};
+
+#endif
@@ -0,0 +1,42 @@
+/*---------------------------------------------------------------------------------------------------------------------------------------
+ * Uniform buffer object holding one std140 block, bound to a fixed binding point shared by every shader program.
+----------------------------------------------------------------------------------------------------------------------------------------*/
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+
+// T must mirror the std140 layout of the GLSL block (vec3 members padded to vec4, mat4 columns on 16 byte boundaries)
+template <typename T>
+class UniformBuffer
+{
+public:
+    unsigned int ID = 0;
+
+    // allocate the buffer and attach it to the binding point named in the shaders' layout(binding = N)
+    // ------------------------------------------------------------------------
+    void create(GLuint binding)
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+    }
+    // upload the whole block; called once per frame
+    // ------------------------------------------------------------------------
+    void update(const T& data)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    // ------------------------------------------------------------------------
+    void destroy()
+    {
+        glDeleteBuffers(1, &ID);
+        ID = 0;
+    }
+};
+
+#endif